@@ -0,0 +1,123 @@
+"""Default memory table band plan, compiled into src/tuning/band_plan.c by cog.
+
+These are the tops and bottoms of all the Ham Bands, in KHz. An up-to-date
+version of this information should be available at:
+http://www.arrl.org/band-plan
+
+** 60 Meters only contains 5 channels and isn't worth dedicating a group to.
+
+Every band is widened by OVERLAP_MARGIN, and the gaps between the bands get
+groups of their own. The groups have to add up to NUMBER_OF_TABLE_ENTRIES.
+
+A unit can be given a different plan at runtime, this is only the one it uses
+until then.
+"""
+
+OVERLAP_MARGIN = 200
+
+FREQ_MIN = 1
+FREQ_MAX = 55000
+
+NUMBER_OF_TABLE_ENTRIES = 3500
+
+# (name, bottom, top, slots in the band, slots in the gap above it)
+bands = [
+    ('160M', 1800, 2000, 100, 200),
+    ('80M', 3500, 4000, 200, 200),
+    ('40M', 7000, 7300, 100, 200),
+    ('30M', 10010, 10150, 100, 200),
+    ('20M', 14000, 14350, 100, 200),
+    ('17M', 18068, 18168, 100, 200),
+    ('15M', 21000, 21450, 200, 200),
+    ('12M', 24890, 24990, 100, 200),
+    ('10M', 28000, 29700, 200, 200),
+    ('6M', 50000, 54000, 200, 100),
+]
+
+# slots below the bottom band
+BOTTOM_SLOTS = 200
+
+# frequencies are bucketed by their top bits, see find_memory_slot()
+BUCKET_SHIFT = 8
+
+# slot = firstSlot + (((frequency - start) * scale) >> SCALE_SHIFT)
+SCALE_SHIFT = 24
+
+
+def groups():
+    """Returns the frequency groups as (start, end, slots), end is exclusive"""
+    result = []
+    start = FREQ_MIN
+    slots = BOTTOM_SLOTS
+    for _, bottom, top, band_slots, gap_slots in bands:
+        result.append((start, bottom - OVERLAP_MARGIN, slots))
+        result.append((bottom - OVERLAP_MARGIN, top + OVERLAP_MARGIN, band_slots))
+        start = top + OVERLAP_MARGIN
+        slots = gap_slots
+    result.append((start, FREQ_MAX, slots))
+
+    assert sum(g[2] for g in result) == NUMBER_OF_TABLE_ENTRIES
+    return result
+
+
+def default_plan():
+    """C source for the default plan, see src/tuning/band_plan.c"""
+    lines = []
+    lines.append(f'#define NUMBER_OF_DEFAULT_GROUPS {len(groups())}')
+    lines.append('')
+    lines.append('const band_plan_group_t defaultGroups[NUMBER_OF_DEFAULT_GROUPS] = {')
+    lines.append('    // {end, number of slots}')
+    for start, end, slots in groups():
+        entry = f'{{{end}, {slots}}},'
+        lines.append(f'    {entry:14}// ({start:05} KHz -> {end:05} KHz)')
+    lines.append('};')
+
+    return '\n'.join(lines)
+
+
+
+def slot_groups(plan):
+    """Returns (start, firstSlot, lastSlot, scale, slotWidth) for every group,
+    the same way build_slot_tables() does it"""
+    result = []
+    first_slot = 0
+    for start, end, slots in plan:
+        width = end - start
+        # rounded up, so the shift gives the same answer as a division
+        scale = ((slots << SCALE_SHIFT) + width - 1) // width
+        slot_width = min(max(width // slots, 1), 255)
+        result.append((start, first_slot, first_slot + slots - 1, scale, slot_width))
+        first_slot += slots
+    return result
+
+
+def buckets(plan):
+    """Returns the group that holds the bottom of every bucket"""
+    result = []
+    group = 0
+    for bucket in range((FREQ_MAX >> BUCKET_SHIFT) + 1):
+        bottom = bucket << BUCKET_SHIFT
+        while group + 1 < len(plan) and bottom >= plan[group + 1][0]:
+            group += 1
+        result.append(group)
+    return result
+
+
+def default_slot_tables():
+    """C source for the default plan's lookup tables, see src/tuning/band_plan.c"""
+    lines = []
+    lines.append('const slot_group_t defaultSlotGroups[NUMBER_OF_DEFAULT_GROUPS] = {')
+    lines.append('    // {start, firstSlot, lastSlot, scale, slotWidth}')
+    for start, first_slot, last_slot, scale, slot_width in slot_groups(groups()):
+        lines.append(f'    {{{start}, {first_slot}, {last_slot}, {scale}UL, {slot_width}}},')
+    lines.append('};')
+    lines.append('')
+
+    lines.append('const uint8_t defaultSlotBuckets[NUMBER_OF_BUCKETS] = {')
+    table = buckets(groups())
+    for i in range(0, len(table), 16):
+        row = ', '.join(str(b) for b in table[i : i + 16])
+        lines.append(f'    {row},')
+    lines.append('};')
+
+    return '\n'.join(lines)
@@ -0,0 +1,102 @@
+"""Compare nearest-band and interpolated calibration against the sweep data.
+
+This parses the polynomial tables straight out of src/calibration.c, so it
+checks what the firmware actually ships with.
+
+Each band is checked twice:
+  - 'at band' uses the band's own polynomial, which is what the firmware does
+    at exactly that frequency, with or without interpolation.
+  - 'leave out' pretends the band was never calibrated, and predicts it from
+    its neighbors. This is the error an operator sees between two bands, e.g.
+    on 60 meters, and is where nearest-band and interpolation differ.
+
+The firmware interpolates only where it helps: reverse is interpolated, and
+forward uses the nearest band.
+
+usage: python check_interpolation.py
+"""
+
+import json
+import re
+from pathlib import Path
+
+HERE = Path(__file__).parent
+CALIBRATION_C = HERE.parent / 'src' / 'calibration.c'
+
+
+def load_tables():
+    text = CALIBRATION_C.read_text()
+    tables = {}
+    for name in ['forwardCalibrationTable', 'reverseCalibrationTable']:
+        body = re.search(name + r'\[NUM_OF_BANDS\] = \{(.*?)\};', text, re.S).group(1)
+        rows = re.findall(r'\{([^}]*)\},\s*// (\d+)', body)
+        tables[name] = [(int(freq) // 1000, [float(v) for v in row.split(',')]) for row, freq in rows]
+    return tables
+
+
+def evaluate(poly, x):
+    a, b, c = poly
+    return max(((a * x) + b) * x + c, 0)
+
+
+def interpolate(table, freq):
+    if freq <= table[0][0]:
+        return table[0][1]
+    for (f1, p1), (f2, p2) in zip(table, table[1:]):
+        if freq < f2:
+            t = (freq - f1) / (f2 - f1)
+            return [a + (b - a) * t for a, b in zip(p1, p2)]
+    return table[-1][1]
+
+
+def nearest(table, freq):
+    return min(table, key=lambda band: abs(band[0] - freq))[1]
+
+
+def load_points(*names):
+    points = []
+    for name in names:
+        points.extend(json.loads((HERE / name).read_text())['data'])
+    return points
+
+
+def percent_error(predicted, measured):
+    return abs(predicted - measured) / measured * 100
+
+
+def check(label, table, points, x_label):
+    print(label)
+    print('  band  | at band | leave out: nearest | interpolated')
+    print('  ------|---------|--------------------|-------------')
+
+    totals = [0, 0, 0]
+    for i, (freq, poly) in enumerate(table):
+        band_points = [p for p in points if int(p['freq']) // 1000 == freq and p['m_fwd'] > 0]
+        others = table[:i] + table[i + 1 :]
+
+        errors = [0, 0, 0]
+        for p in band_points:
+            x = p[x_label]
+            errors[0] += percent_error(evaluate(poly, x), p['m_fwd'])
+            errors[1] += percent_error(evaluate(nearest(others, freq), x), p['m_fwd'])
+            errors[2] += percent_error(evaluate(interpolate(others, freq), x), p['m_fwd'])
+        errors = [e / len(band_points) for e in errors]
+        totals = [t + e for t, e in zip(totals, errors)]
+
+        print(f'  {freq:5} | {errors[0]:6.2f}% | {errors[1]:17.2f}% | {errors[2]:11.2f}%')
+
+    totals = [t / len(table) for t in totals]
+    print(f'  mean  | {totals[0]:6.2f}% | {totals[1]:17.2f}% | {totals[2]:11.2f}%')
+    print()
+    return totals
+
+
+if __name__ == '__main__':
+    tables = load_tables()
+    forward = check('forward', tables['forwardCalibrationTable'], load_points('fwd.json', 'fwd_attenuated.json'), 't_fwd_volts')
+    reverse = check('reverse', tables['reverseCalibrationTable'], load_points('rev.json'), 't_rev_volts')
+
+    # the firmware interpolates reverse and snaps forward to the nearest band
+    ok = forward[1] <= forward[2] and reverse[2] <= reverse[1]
+    print('firmware choice:', 'ok' if ok else 'REVISIT, see the notes in src/calibration.c')
+    raise SystemExit(0 if ok else 1)
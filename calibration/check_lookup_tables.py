@@ -0,0 +1,104 @@
+"""Report the error of the CALIBRATION_LUT_ENABLED path against the polynomials.
+
+This mirrors build_lut(), lookup_watts(), square_root_q16(), and swrTable[]
+from src/calibration.c, using the polynomial tables parsed out of that file.
+
+The power check also runs each forward polynomial scaled up by 1.25, which
+reaches past the table's 655.35W ceiling inside the ADC's range, so the
+saturated segments are exercised too. Errors are measured against the
+polynomial clamped at 0W, same as the table.
+
+usage: python check_lookup_tables.py
+"""
+
+import math
+
+from check_interpolation import evaluate, load_tables
+
+ADC_MAX_COUNTS = 4095
+LUT_SEGMENT_SHIFT = 6
+LUT_LENGTH = (ADC_MAX_COUNTS >> LUT_SEGMENT_SHIFT) + 2
+SWR_TABLE = [round((256 + i) / (256 - i) * 100) for i in range(256)]
+MIN_SWR = 1.1
+
+
+LUT_SATURATED = 65535
+
+
+def build_lut(poly):
+    points = [evaluate(poly, i << LUT_SEGMENT_SHIFT) * 100 for i in range(LUT_LENGTH)]
+    return [int(min(max(p, 0), LUT_SATURATED)) for p in points]
+
+
+def lookup_watts(lut, poly, counts):
+    """Returns (watts, True if the polynomial was used instead of the table)."""
+    counts = min(counts, ADC_MAX_COUNTS)
+    index = counts >> LUT_SEGMENT_SHIFT
+    if lut[index] == 0 or lut[index + 1] == LUT_SATURATED:
+        return max(evaluate(poly, counts), 0), True
+
+    delta = lut[index + 1] - lut[index]
+    mask = (1 << LUT_SEGMENT_SHIFT) - 1
+    # C shifts toward negative infinity for negative deltas, same as python
+    return (lut[index] + ((delta * (counts & mask)) >> LUT_SEGMENT_SHIFT)) / 100, False
+
+
+def check_power(label, table):
+    print(label)
+    print('  band  | max error | max error above 1W | polynomial counts | top reading')
+    print('  ------|-----------|--------------------|-------------------|------------')
+    for freq, poly in table:
+        lut = build_lut(poly)
+        worst = 0
+        worst_relative = 0
+        fallbacks = 0
+        for counts in range(ADC_MAX_COUNTS + 1):
+            exact = max(evaluate(poly, counts), 0)
+            watts, fallback = lookup_watts(lut, poly, counts)
+            fallbacks += fallback
+            error = abs(watts - exact)
+            worst = max(worst, error)
+            if exact > 1:
+                worst_relative = max(worst_relative, error / exact * 100)
+        top = lookup_watts(lut, poly, ADC_MAX_COUNTS)[0]
+        print(f'  {freq:5} | {worst:7.4f}W | {worst_relative:17.3f}% | {fallbacks:17} | {top:9.2f}W')
+    print()
+
+
+def exact_swr(forward, reverse):
+    rho = math.sqrt(min(reverse, forward - 0.01) / forward)
+    return max((1 + rho) / (1 - rho), MIN_SWR)
+
+
+def table_swr(forward, reverse):
+    if forward < 0.01:
+        return MIN_SWR
+    ratio = 65535 if reverse >= forward else min(int(reverse / forward * 65536), 65535)
+    return max(SWR_TABLE[math.isqrt(ratio)] / 100, MIN_SWR)
+
+
+def check_swr():
+    print('swr')
+    print('  true SWR range | max error')
+    print('  ---------------|----------')
+    ranges = [(1.0, 1.5), (1.5, 2.0), (2.0, 3.0), (3.0, 5.0), (5.0, 10.0)]
+    worst = {r: 0 for r in ranges}
+    for forward in [5, 25, 100, 200, 400, 700, 1000]:
+        for step in range(1, 1000):
+            reverse = forward * step / 1000
+            exact = exact_swr(forward, reverse)
+            for low, high in ranges:
+                if low <= exact < high:
+                    error = abs(table_swr(forward, reverse) - exact)
+                    worst[(low, high)] = max(worst[(low, high)], error)
+    for (low, high), error in worst.items():
+        print(f'  {low:4.1f} - {high:4.1f}    | {error:8.4f}')
+    print()
+
+
+if __name__ == '__main__':
+    tables = load_tables()
+    check_power('forward', tables['forwardCalibrationTable'])
+    check_power('forward x1.25', [(f, [v * 1.25 for v in p]) for f, p in tables['forwardCalibrationTable']])
+    check_power('reverse', tables['reverseCalibrationTable'])
+    check_swr()
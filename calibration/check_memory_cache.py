@@ -0,0 +1,129 @@
+"""Benchmark memory recall on a flash model, with and without filling the cache.
+
+This replays the recall pattern of memory_tune() from src/tuning/tuning.c
+against a model of the table in flash, and reports what each tune costs in
+flash reads two ways: reading each entry's bytes on its own, the way
+nvm_table_read() does now, and filling the block cache from
+src/tuning/nvm_table.c on every miss, the way it used to. memory_tune()
+searches MEMORY_SEARCH_RADIUS slots each way, and only recalls the slots the
+occupancy map in src/tuning/tuning_memories.c says are used, so empty slots
+cost no flash reads.
+
+The timing model is rough: one flash_read_byte() call is taken as ~40
+instruction cycles with its TBLPTR setup, and flash_read_block() as ~6 cycles
+per byte, at 16 MIPS.
+
+usage: python check_memory_cache.py
+"""
+
+import random
+import re
+from pathlib import Path
+
+HERE = Path(__file__).parent
+SRC = HERE.parent / 'src' / 'tuning'
+
+FLASH_BUFFER_SIZE = 128
+MIPS = 16
+BYTE_READ_CYCLES = 40
+BLOCK_READ_CYCLES_PER_BYTE = 6
+
+
+def load_define(path, name):
+    return int(re.search(r'#define ' + name + r' (\d+)', path.read_text()).group(1))
+
+
+TABLE_ENTRY_SIZE = load_define(SRC / 'nvm_table.h', 'TABLE_ENTRY_SIZE')
+NUMBER_OF_TABLE_ENTRIES = load_define(SRC / 'nvm_table.h', 'NUMBER_OF_TABLE_ENTRIES')
+NVM_CACHE_BLOCKS = load_define(SRC / 'nvm_table.c', 'NVM_CACHE_BLOCKS')
+NUM_OF_MEMORIES = load_define(SRC / 'tuning.c', 'NUM_OF_MEMORIES')
+MEMORY_SEARCH_RADIUS = load_define(SRC / 'tuning.c', 'MEMORY_SEARCH_RADIUS')
+ENTRIES_PER_BLOCK = FLASH_BUFFER_SIZE // TABLE_ENTRY_SIZE
+
+
+class BlockCache:
+    """Least recently used, like get_cached_block()."""
+
+    def __init__(self, size):
+        self.size = size
+        self.blocks = []
+        self.block_reads = 0
+
+    def read(self, slot):
+        block = slot // ENTRIES_PER_BLOCK
+        if block in self.blocks:
+            self.blocks.remove(block)
+        else:
+            self.block_reads += 1
+            if len(self.blocks) == self.size:
+                self.blocks.pop(0)
+        self.blocks.append(block)
+
+
+def memory_tune_recalls(table, slot):
+    """The slots memory_tune() reads from flash, in order."""
+    recalls = []
+
+    # recall_memory_record() skips the flash read for an empty slot
+    if table[slot]:
+        recalls.append(slot)
+
+    for offset in range(1, MEMORY_SEARCH_RADIUS + 1):
+        for candidate in [slot + offset, slot - offset]:
+            # memory_slot_is_used() is false off either end of the table
+            if not 0 <= candidate < NUMBER_OF_TABLE_ENTRIES or not table[candidate]:
+                continue
+            recalls.append(candidate)
+            if len(recalls) == NUM_OF_MEMORIES:
+                return recalls
+    return recalls
+
+
+def benchmark(fill, tunes=2000, seed=1):
+    rng = random.Random(seed)
+    table = [rng.random() < fill for _ in range(NUMBER_OF_TABLE_ENTRIES)]
+
+    recalls = []
+    block_reads = []
+    for _ in range(tunes):
+        slot = rng.randrange(NUMBER_OF_TABLE_ENTRIES)
+        pattern = memory_tune_recalls(table, slot)
+
+        # the cache is cold at the start of every tune, which is the worst case
+        cache = BlockCache(NVM_CACHE_BLOCKS)
+        for recall in pattern:
+            cache.read(recall)
+
+        recalls.append(len(pattern))
+        block_reads.append(cache.block_reads)
+
+    return recalls, block_reads
+
+
+def microseconds(cycles):
+    return cycles / MIPS
+
+
+def main():
+    print(f'{NVM_CACHE_BLOCKS} cached blocks of {ENTRIES_PER_BLOCK} entries')
+    print('fill | recalls avg/max | byte reads | block reads avg/max |  entries | blocks')
+    print('-----|-----------------|------------|---------------------|----------|-------')
+
+    for fill in [0.01, 0.05, 0.2, 0.5]:
+        recalls, block_reads = benchmark(fill)
+        avg_recalls = sum(recalls) / len(recalls)
+        avg_blocks = sum(block_reads) / len(block_reads)
+
+        entries = microseconds(avg_recalls * TABLE_ENTRY_SIZE * BYTE_READ_CYCLES)
+        blocks = microseconds(avg_blocks * FLASH_BUFFER_SIZE * BLOCK_READ_CYCLES_PER_BYTE)
+
+        print(
+            f'{fill:4.0%} | {avg_recalls:7.1f} / {max(recalls):5} |'
+            f' {avg_recalls * TABLE_ENTRY_SIZE:10.0f} |'
+            f' {avg_blocks:9.2f} / {max(block_reads):7} |'
+            f' {entries:6.0f}uS | {blocks:4.0f}uS'
+        )
+
+
+if __name__ == '__main__':
+    main()
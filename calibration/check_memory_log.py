@@ -0,0 +1,322 @@
+"""Simulate a year of memory stores on both memory table engines.
+
+This compares erase counts per flash block between the plain table from
+src/tuning/nvm_table.c and the MEMORY_LOG_ENABLED engine from
+src/tuning/nvm_log.c, for the same synthetic year of stores.
+
+The synthetic operator works a few favorite frequencies, mostly on 40m and
+20m, and stores STORES_PER_DAY tune results a day. The relays for a frequency
+drift a little between tunes, so most stores change the entry. A store that
+doesn't change it only makes the memory younger, like a hit.
+
+Every day also has MEMORY_TUNES_PER_DAY memory tunes that win a stored
+memory, and count_memory_hit() credits it with a hit and a new generation.
+Those are simulated twice: written to the table on every hit, the way it used
+to work, and kept in RAM as pending hits that are saved at power off, once a
+day, or when the pending table is full, the way it works now. The generation
+moves on every EVENTS_PER_GENERATION stores and hits, and every MAXIMUM_AGE + 1
+generations the memories older than that are restamped in one batch.
+
+The plain table is modeled with write-back, flushing after every store, since
+stores are usually further apart than the flush delay. The log is compacted by
+the idle loop once it passes its high-water mark, which is modeled as right
+after the store that crossed it.
+
+usage: python check_memory_log.py
+"""
+
+import random
+import re
+import sys
+from pathlib import Path
+
+HERE = Path(__file__).parent
+SRC = HERE.parent / 'src' / 'tuning'
+
+sys.path.insert(0, str(HERE.parent))
+
+import bandplan  # noqa: E402
+
+FLASH_BLOCK_SIZE = 128
+FLASH_ENDURANCE = 10000
+STORES_PER_DAY = 40
+MEMORY_TUNES_PER_DAY = 120
+DAYS = 365
+
+# (KHz, relative popularity)
+FAVORITES = [
+    (7030, 10), (7074, 30), (7185, 15), (14074, 40), (14230, 20), (14300, 10),
+    (3573, 8), (3850, 8), (10136, 6), (18100, 4), (21074, 6), (28074, 5), (1840, 2),
+]
+
+
+def load_define(path, name):
+    return int(re.search(r'#define ' + name + r' (\d+)', path.read_text()).group(1))
+
+
+TABLE_ENTRY_SIZE = load_define(SRC / 'nvm_table.h', 'TABLE_ENTRY_SIZE')
+NUMBER_OF_TABLE_ENTRIES = load_define(SRC / 'nvm_table.h', 'NUMBER_OF_TABLE_ENTRIES')
+MEMORY_LOG_BLOCKS = load_define(SRC / 'nvm_log.h', 'MEMORY_LOG_BLOCKS')
+PENDING_HITS = load_define(SRC / 'tuning_memories.c', 'PENDING_HITS')
+EVENTS_PER_GENERATION = load_define(SRC / 'tuning_memories.c', 'EVENTS_PER_GENERATION')
+MAXIMUM_AGE = load_define(SRC / 'tuning_memories.c', 'MAXIMUM_AGE')
+ENTRIES_PER_BLOCK = FLASH_BLOCK_SIZE // TABLE_ENTRY_SIZE
+LOG_RECORD_SIZE = 1 + 2 + TABLE_ENTRY_SIZE
+LOG_CAPACITY = MEMORY_LOG_BLOCKS * (FLASH_BLOCK_SIZE // LOG_RECORD_SIZE)
+LOG_HIGH_WATER_MARK = (LOG_CAPACITY // 4) * 3
+
+
+# (start, end, slots) for every group of the default band plan
+GROUPS = bandplan.groups()
+assert sum(slots for _, _, slots in GROUPS) == NUMBER_OF_TABLE_ENTRIES
+
+
+def find_memory_slot(frequency):
+    base = 0
+    for start, end, slots in GROUPS:
+        if end > frequency:
+            return base + (frequency - start) * slots // (end - start)
+        base += slots
+    return base - 1
+
+
+def must_erase(new, old):
+    return any(~o & n for n, o in zip(new, old))
+
+
+class PlainTable:
+    def __init__(self):
+        self.flash = {}
+        self.erases = {}
+        self.batch = None
+
+    def read(self, slot):
+        return self.flash.get(slot, bytes(TABLE_ENTRY_SIZE))
+
+    def write(self, slot, entry):
+        old = self.read(slot)
+        if entry == old:
+            return
+        if must_erase(entry, old):
+            block = slot // ENTRIES_PER_BLOCK
+            if self.batch is None:
+                self.erases[block] = self.erases.get(block, 0) + 1
+            else:
+                self.batch.add(block)
+        self.flash[slot] = entry
+
+    def start_batch(self):
+        """writes until flush() are merged into one erase per block, like write-back"""
+        self.batch = set()
+
+    def flush(self):
+        for block in self.batch or ():
+            self.erases[block] = self.erases.get(block, 0) + 1
+        self.batch = None
+
+
+class LogTable(PlainTable):
+    def __init__(self):
+        super().__init__()
+        self.log = []
+        self.log_erases = 0
+
+    def start_batch(self):
+        pass
+
+    def flush(self):
+        pass
+
+    def read(self, slot):
+        for logged_slot, entry in reversed(self.log):
+            if logged_slot == slot:
+                return entry
+        return super().read(slot)
+
+    def write(self, slot, entry):
+        if entry == self.read(slot):
+            return
+        if len(self.log) == LOG_CAPACITY:
+            self.compact()
+        self.log.append((slot, entry))
+
+        # the idle loop, between stores
+        if len(self.log) >= LOG_HIGH_WATER_MARK:
+            self.compact()
+
+    def compact(self):
+        staged = {}
+        for slot, entry in self.log:
+            staged[slot] = entry
+
+        blocks = {}
+        for slot, entry in staged.items():
+            blocks.setdefault(slot // ENTRIES_PER_BLOCK, []).append((slot, entry))
+
+        for block, entries in blocks.items():
+            if any(must_erase(entry, super(LogTable, self).read(slot)) for slot, entry in entries):
+                self.erases[block] = self.erases.get(block, 0) + 1
+            for slot, entry in entries:
+                self.flash[slot] = entry
+
+        self.log = []
+        self.log_erases += 1
+
+
+def crc8(data):
+    """CRC-8/SMBUS, same as crc8() in src/crc.c"""
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else crc << 1
+    return crc
+
+
+def pack_memory(bits, frequency, hits, generation):
+    """Same layout as pack_memory() in src/tuning/tuning_memories.c"""
+    entry = bytes([bits & 0xFF, bits >> 8, frequency & 0xFF, frequency >> 8, 26, hits, generation])
+    return entry + bytes([crc8(entry)])
+
+
+class Memories:
+    """store_memory() and count_memory_hit() on top of <table>"""
+
+    def __init__(self, table, pending_hits):
+        self.table = table
+        self.pending_hits = pending_hits
+        self.pending = {}  # slot: (hits, generation)
+        self.generation = 0
+        self.events = 0
+
+    def read(self, slot):
+        entry = self.table.read(slot)
+        bits = entry[0] | (entry[1] << 8)
+        frequency = entry[2] | (entry[3] << 8)
+        hits, generation = entry[5], entry[6]
+        if slot in self.pending:
+            extra, generation = self.pending[slot]
+            hits = min(hits + extra, 255)
+        return bits, frequency, hits, generation
+
+    def write(self, slot, entry):
+        self.table.write(slot, entry)
+        self.pending.pop(slot, None)
+
+    def next_generation(self):
+        self.events += 1
+        if self.events < EVENTS_PER_GENERATION:
+            return self.generation
+        self.events = 0
+        self.generation = (self.generation + 1) & 0xFF
+        if not self.generation & MAXIMUM_AGE:
+            self.restamp()
+        return self.generation
+
+    def restamp(self):
+        # restamp_memories(), flushed by the idle loop
+        self.table.start_batch()
+        for slot in list(self.table.flash):
+            bits, frequency, hits, generation = self.read(slot)
+            if bits and (self.generation - generation) & 0xFF > MAXIMUM_AGE:
+                self.write(slot, pack_memory(bits, frequency, hits, (self.generation - MAXIMUM_AGE) & 0xFF))
+        self.table.flush()
+
+    def store(self, slot, bits, frequency):
+        old_bits, old_frequency, hits, _ = self.read(slot)
+        if old_bits == bits and find_memory_slot(old_frequency) == slot:
+            self.add_hits(slot, 0)
+            return
+
+        generation = self.next_generation()
+        self.write(slot, pack_memory(bits, frequency, hits if old_bits == bits else 0, generation))
+
+    def hit(self, slot):
+        self.add_hits(slot, 1)
+
+    def add_hits(self, slot, extra):
+        generation = self.next_generation()
+        if not self.pending_hits:
+            bits, frequency, hits, _ = self.read(slot)
+            self.write(slot, pack_memory(bits, frequency, min(hits + extra, 255), generation))
+            return
+
+        if slot not in self.pending and len(self.pending) == self.pending_hits:
+            oldest = max(self.pending, key=lambda s: (generation - self.pending[s][1]) & 0xFF)
+            self.save_hit(oldest)
+        hits, _ = self.pending.get(slot, (0, 0))
+        self.pending[slot] = (min(hits + extra, 255), generation)
+
+    def save_hit(self, slot):
+        self.write(slot, pack_memory(*self.read(slot)))
+
+    def power_off(self):
+        # save_memory_hits(), then flush_memories()
+        self.table.start_batch()
+        for slot in list(self.pending):
+            self.save_hit(slot)
+        self.table.flush()
+
+
+def synthetic_year(seed=1):
+    """('store', slot, bits, KHz), ('hit', slot) and ('power_off',) events"""
+    rng = random.Random(seed)
+    frequencies = [f for f, _ in FAVORITES]
+    weights = [w for _, w in FAVORITES]
+    settings = {f: (rng.randrange(128), rng.randrange(128), rng.randrange(2)) for f in frequencies}
+
+    for _ in range(DAYS):
+        day = ['store'] * STORES_PER_DAY + ['hit'] * MEMORY_TUNES_PER_DAY
+        rng.shuffle(day)
+        for kind in day:
+            frequency = rng.choices(frequencies, weights)[0] + rng.randint(-3, 3)
+            if kind == 'hit':
+                yield 'hit', find_memory_slot(frequency)
+                continue
+            caps, inds, z = settings[min(frequencies, key=lambda f: abs(f - frequency))]
+            caps = max(0, min(127, caps + rng.randint(-2, 2)))
+            inds = max(0, min(127, inds + rng.randint(-2, 2)))
+            yield 'store', find_memory_slot(frequency), caps | (z << 7) | (inds << 8), frequency
+        yield ('power_off',)
+
+
+def report(name, erases, extra_blocks=0, extra_erases=0):
+    counts = sorted(erases.values(), reverse=True)
+    worst = max(counts[0] if counts else 0, extra_erases)
+    total = sum(counts) + extra_blocks * extra_erases
+    blocks = len(counts) + extra_blocks
+    years = FLASH_ENDURANCE / worst if worst else float('inf')
+    print(f'{name:>6}: {total:6} erases over {blocks:3} blocks, worst block {worst:5}/year, '
+          f'{years:6.1f} years to {FLASH_ENDURANCE} cycles')
+    print(f'        busiest table blocks: {counts[:8]}')
+
+
+def simulate(pending_hits):
+    plain = Memories(PlainTable(), pending_hits)
+    logged = Memories(LogTable(), pending_hits)
+    for event in synthetic_year():
+        for memories in (plain, logged):
+            if event[0] == 'store':
+                memories.store(*event[1:])
+            elif event[0] == 'hit' and memories.read(event[1])[0]:
+                memories.hit(event[1])
+            elif event[0] == 'power_off':
+                memories.power_off()
+
+    report('plain', plain.table.erases)
+    report('log', logged.table.erases, MEMORY_LOG_BLOCKS, logged.table.log_erases)
+
+
+def main():
+    print(f'{DAYS * STORES_PER_DAY} stores, {DAYS * MEMORY_TUNES_PER_DAY} memory tunes, '
+          f'{LOG_CAPACITY} record log in {MEMORY_LOG_BLOCKS} blocks, compacted at {LOG_HIGH_WATER_MARK}')
+    print()
+    print('hits written on every memory tune:')
+    simulate(0)
+    print()
+    print(f'hits pending in RAM, {PENDING_HITS} slots, saved at power off once a day:')
+    simulate(PENDING_HITS)
+
+
+if __name__ == '__main__':
+    main()
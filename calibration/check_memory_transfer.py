@@ -0,0 +1,203 @@
+"""Round trip memory tables through a model of src/tuning/memory_transfer.c.
+
+This mirrors encode_chunk(), chunk_crc() and import_memory_chunk(), exports a
+few tables of different densities chunk by chunk, imports the chunks into an
+empty table, and checks that the copy is identical. It also checks that a
+damaged chunk is rejected, and that an export restarted from the middle
+produces the same chunks. It reports how many chunks and bytes each table
+takes on the wire, and fails if a memory_import command gets too long.
+
+usage: python check_memory_transfer.py
+"""
+
+import base64
+import random
+import re
+from pathlib import Path
+
+HERE = Path(__file__).parent
+SRC = HERE.parent / 'src' / 'tuning'
+
+ENTRY_SIZE = 8
+EMPTY_RUN = 0x80
+RUN_LENGTH_MASK = 0x7F
+MAX_RUN_LENGTH = RUN_LENGTH_MASK + 1
+
+
+def load_define(path, name):
+    return int(re.search(r'#define ' + name + r' (\d+)', path.read_text()).group(1))
+
+
+NUMBER_OF_TABLE_ENTRIES = load_define(SRC / 'nvm_table.h', 'NUMBER_OF_TABLE_ENTRIES')
+MEMORY_CHUNK_SIZE = load_define(SRC / 'memory_transfer.h', 'MEMORY_CHUNK_SIZE')
+MAX_CHUNK_SLOTS = load_define(SRC / 'memory_transfer.c', 'MAX_CHUNK_SLOTS')
+
+# room for a memory_import command, see the notes in memory_transfer.c
+MAX_IMPORT_LENGTH = 256
+
+
+def crc16_update(crc, byte):
+    crc ^= byte << 8
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+    return crc & 0xFFFF
+
+
+def chunk_crc(start, data):
+    crc = 0xFFFF
+    for byte in [start & 0xFF, start >> 8] + list(data):
+        crc = crc16_update(crc, byte)
+    return crc
+
+
+def encode_chunk(table, slot):
+    start = slot
+    data = []
+    header = 0
+    run_length = 0
+    run_is_empty = False
+
+    while slot < NUMBER_OF_TABLE_ENTRIES and slot - start < MAX_CHUNK_SLOTS:
+        entry = table[slot]
+        is_empty = not any(entry)
+
+        extends_run = run_length > 0 and is_empty == run_is_empty and run_length < MAX_RUN_LENGTH
+        needed = (0 if extends_run else 1) + (0 if is_empty else ENTRY_SIZE)
+        if len(data) + needed > MEMORY_CHUNK_SIZE:
+            break
+
+        if not extends_run:
+            header = len(data)
+            data.append(0)
+            run_length = 0
+            run_is_empty = is_empty
+
+        run_length += 1
+        data[header] = (EMPTY_RUN if run_is_empty else 0) | (run_length - 1)
+
+        if not is_empty:
+            data.extend(entry)
+
+        slot += 1
+
+    return start, slot, bytes(data), chunk_crc(start, data)
+
+
+def export(table, slot=0):
+    chunks = []
+    while slot < NUMBER_OF_TABLE_ENTRIES:
+        chunk = encode_chunk(table, slot)
+        chunks.append(chunk)
+        slot = chunk[1]
+    return chunks
+
+
+def import_chunk(table, start, data, crc):
+    """Returns the next slot, or start if the chunk was rejected"""
+    if chunk_crc(start, data) != crc:
+        return start
+
+    # same walk as chunk_is_valid()
+    slot = start
+    i = 0
+    while i < len(data):
+        header = data[i]
+        i += 1
+        run_length = (header & RUN_LENGTH_MASK) + 1
+        if not header & EMPTY_RUN:
+            if i + run_length * ENTRY_SIZE > len(data):
+                return start
+            i += run_length * ENTRY_SIZE
+        slot += run_length
+        if slot > NUMBER_OF_TABLE_ENTRIES:
+            return start
+
+    slot = start
+    i = 0
+    while i < len(data):
+        header = data[i]
+        i += 1
+        for _ in range((header & RUN_LENGTH_MASK) + 1):
+            if header & EMPTY_RUN:
+                table[slot] = bytes(ENTRY_SIZE)
+            else:
+                table[slot] = bytes(data[i : i + ENTRY_SIZE])
+                i += ENTRY_SIZE
+            slot += 1
+    return slot
+
+
+def random_table(density, rng):
+    table = [bytes(ENTRY_SIZE)] * NUMBER_OF_TABLE_ENTRIES
+    for slot in range(NUMBER_OF_TABLE_ENTRIES):
+        if rng.random() < density:
+            table[slot] = bytes([rng.randrange(1, 256)] + [rng.randrange(256) for _ in range(ENTRY_SIZE - 1)])
+    return table
+
+
+# the longest band plan crc, so the lengths are the worst case
+PLAN_CRC = 65535
+
+
+def message_length(start, next_slot, data, crc):
+    """Length of the memory_chunk update printed by send_memory_chunk()"""
+    text = '{"update":{"memory_chunk":{"start":%u,"next":%u,"plan":%u,"crc":%u,"data":"%s"}}}'
+    return len(text % (start, next_slot, PLAN_CRC, crc, base64.b64encode(data).decode()))
+
+
+def import_length(start, next_slot, data, crc):
+    """Length of the memory_import command that sends the chunk back"""
+    text = '{"command":"memory_import","start":%u,"plan":%u,"crc":%u,"data":"%s"}'
+    return len(text % (start, PLAN_CRC, crc, base64.b64encode(data).decode()))
+
+
+def main():
+    rng = random.Random(48)
+    ok = True
+
+    print('density | chunks | wire bytes | raw table bytes | longest import')
+    print('--------|--------|------------|-----------------|---------------')
+    for density in [0, 0.01, 0.05, 0.2, 0.5, 1]:
+        table = random_table(density, rng)
+        chunks = export(table)
+
+        copy = [bytes(ENTRY_SIZE)] * NUMBER_OF_TABLE_ENTRIES
+        slot = 0
+        for start, next_slot, data, crc in chunks:
+            assert start == slot
+            slot = import_chunk(copy, start, data, crc)
+            assert slot == next_slot
+        if copy != table:
+            print(f'{density}: copy differs')
+            ok = False
+
+        # resuming from any chunk gives the same chunks from there on
+        middle = len(chunks) // 2
+        if export(table, chunks[middle][0]) != chunks[middle:]:
+            print(f'{density}: resumed export differs')
+            ok = False
+
+        # a damaged chunk is rejected and leaves the table alone
+        start, next_slot, data, crc = chunks[0]
+        if data:
+            damaged = bytearray(data)
+            damaged[-1] ^= 1
+            if import_chunk(copy, start, bytes(damaged), crc) != start:
+                print(f'{density}: damaged chunk accepted')
+                ok = False
+
+        wire = sum(message_length(*chunk) for chunk in chunks)
+        raw = NUMBER_OF_TABLE_ENTRIES * ENTRY_SIZE
+        longest = max(import_length(*chunk) for chunk in chunks)
+        print(f'{density:7} | {len(chunks):6} | {wire:10} | {raw:15} | {longest}')
+
+        if longest > MAX_IMPORT_LENGTH:
+            print(f'{density}: a memory_import is longer than {MAX_IMPORT_LENGTH} characters')
+            ok = False
+
+    if not ok:
+        raise SystemExit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,285 @@
+"""Check the relay SPI bit order against the relay_bits_t layout.
+
+This models the pair of daisy-chained TPIC6B595s and drives it with both relay
+back ends, translated from the source instead of written out by hand:
+  - 'bitbang' runs the body of relay_spi_bitbang_tx_word() from
+    src/relay_driver.c, translated line by line into Python
+  - 'spi' runs the body of relay_spi_tx_word(), with an SPI1 model that takes
+    its bit order, clock polarity and clock edge from relay_spi_init()
+
+The chain is wired to the physical pins that pinmap.py assigns to
+RELAY_CLOCK_PIN, RELAY_DATA_PIN and RELAY_STROBE_PIN. The bitbang back end
+reaches them through the set_<name>() pin functions. SPI1 reaches them through
+the PPS outputs that relay_spi_init() selects, so a PPS call that names the
+wrong pin shows up as a mismatch.
+
+Every 16 bit word has to land on the same drains from both back ends. Each
+relay_bits_t field also has to land on the drains given in the notes in
+src/relay_driver.c: bit n on chip n / 8, drain Q(n % 8). Those notes are the
+only record of the board wiring here, so this checks the firmware against
+them, not against the schematic.
+
+usage: python check_relay_bits.py
+"""
+
+import re
+import sys
+from pathlib import Path
+
+HERE = Path(__file__).parent
+SRC = HERE.parent / 'src'
+RELAY_DRIVER_C = SRC / 'relay_driver.c'
+RELAY_DRIVER_H = SRC / 'relay_driver.h'
+
+sys.path.insert(0, str(HERE.parent))
+import pinmap  # noqa: E402
+
+RELAY_PINS = {
+    'RELAY_CLOCK_PIN': 'SRCK',
+    'RELAY_DATA_PIN': 'SER IN',
+    'RELAY_STROBE_PIN': 'RCK',
+}
+
+
+def load_layout():
+    """Return [(field, first bit, width)] for relay_bits_t, LSB first like XC8."""
+    text = RELAY_DRIVER_H.read_text()
+    defines = dict(re.findall(r'#define (\w+) (\d+)', text))
+    struct = re.search(r'typedef union \{\s*struct \{(.*?)\};', text, re.S).group(1)
+
+    layout = []
+    bit = 0
+    for name, width in re.findall(r'unsigned (\w+) : (\w+);', struct):
+        width = int(defines.get(width, width))
+        layout.append((name, bit, width))
+        bit += width
+    assert bit == 16, f'relay_bits_t has {bit} bits'
+    return layout
+
+
+def load_pins():
+    """Return {pin name: (port pin, tags)} for the relay pins, from pinmap.py."""
+    pins = {}
+    for port_pin, entry in pinmap.common.items():
+        if entry and entry[0] in RELAY_PINS:
+            pins[entry[0]] = (port_pin, entry[1])
+    missing = set(RELAY_PINS) - set(pins)
+    assert not missing, f'pinmap.py has no {sorted(missing)}'
+    return pins
+
+
+def function_body(text, name):
+    """The lines between the braces of 'static void <name>(...) {'."""
+    start = re.search(rf'^static void {name}\(.*\) \{{\n', text, re.M)
+    assert start, f'{name}() not found'
+    end = text.index('\n}\n', start.end())
+    return text[start.end() : end].split('\n')
+
+
+# ---------------------------------------------------------------------------- #
+
+
+def translate(lines):
+    """Turn the small subset of C used by the back ends into a Python function.
+
+    Only what the two tx functions use is supported: pin setters, SPI1TXB
+    writes, a counted for loop, if/else, casts to uint8_t, busy waits and
+    delays. Anything else is an error, so a rewrite of the C can't be silently
+    skipped.
+    """
+    python = ['def tx(word, pins, spi):']
+    skipping_wait = False
+    for line in lines:
+        indent = line[: len(line) - len(line.lstrip())]
+        code = re.sub(r'\s*//.*$', '', line).strip()
+
+        if skipping_wait:
+            skipping_wait = code != '}'
+            continue
+        if not code or code == '}' or code.startswith('delay_us('):
+            continue
+        if re.fullmatch(r'while \(SPI1CON2bits\.BUSY\) \{', code):
+            skipping_wait = True  # the model finishes each byte as it's written
+            continue
+
+        code = re.sub(r'\(uint8_t\)\(([^;]*)\)', r'((\1) & 0xFF)', code)
+        code = re.sub(r'\(uint8_t\)(\w+)', r'(\1 & 0xFF)', code)
+
+        if match := re.fullmatch(r'set_(\w+)\((\d)\);', code):
+            python.append(f"{indent}pins.set('{match[1]}', {match[2]})")
+        elif match := re.fullmatch(r'SPI1TXB = (.*);', code):
+            python.append(f'{indent}spi.transmit({match[1]})')
+        elif match := re.fullmatch(r'for \(uint8_t (\w+) = 0; \1 < (\d+); \1\+\+\) \{', code):
+            python.append(f'{indent}for {match[1]} in range({match[2]}):')
+        elif match := re.fullmatch(r'if \((.*)\) \{', code):
+            python.append(f'{indent}if {match[1]}:')
+        elif code == '} else {':
+            python.append(f'{indent}else:')
+        else:
+            raise SystemExit(f'check_relay_bits.py can\'t translate: {code}')
+
+    namespace = {}
+    exec('\n'.join(python), namespace)
+    return namespace['tx']
+
+
+def load_spi_config(text):
+    """The SPI1 settings and PPS outputs from relay_spi_init()."""
+    body = '\n'.join(function_body(text, 'relay_spi_init'))
+    config = {k: int(v) for k, v in re.findall(r'SPI1CON\dbits\.(\w+) = (\d);', body)}
+    pps = dict(re.findall(r'pps_out_SPI1_(\w+)\(PPS_(\w+)\);', body))
+    return config, pps
+
+
+# ---------------------------------------------------------------------------- #
+
+
+class ShiftRegisterChain:
+    """Two TPIC6B595s, SER OUT of the first feeding SER IN of the second."""
+
+    def __init__(self, chips=2):
+        self.shift = [0] * chips
+        self.drains = [0] * chips
+        self.inputs = {'SRCK': 0, 'SER IN': 0, 'RCK': 0}
+
+    def set_input(self, name, value):
+        rising = value and not self.inputs[name]
+        self.inputs[name] = value
+        if rising and name == 'SRCK':
+            carry = self.inputs['SER IN']
+            for i, reg in enumerate(self.shift):
+                self.shift[i] = ((reg << 1) | carry) & 0xFF
+                carry = reg >> 7
+        if rising and name == 'RCK':
+            self.drains = list(self.shift)
+
+    def output(self):
+        """The drains as one word, first chip in the low byte."""
+        return sum(reg << (8 * i) for i, reg in enumerate(self.drains))
+
+
+class Board:
+    """The port pins, with the relay chain wired up the way pinmap.py says."""
+
+    def __init__(self, pins):
+        self.chain = ShiftRegisterChain()
+        self.wiring = {port_pin: RELAY_PINS[name] for name, (port_pin, _) in pins.items()}
+        self.by_name = {name: port_pin for name, (port_pin, _) in pins.items()}
+
+    def drive(self, port_pin, value):
+        if port_pin in self.wiring:
+            self.chain.set_input(self.wiring[port_pin], value)
+
+
+class GpioPins:
+    """What set_<name>() does, by name through pinmap.py."""
+
+    def __init__(self, board):
+        self.board = board
+
+    def set(self, name, value):
+        self.board.drive(self.board.by_name[name], value)
+
+
+class Spi1:
+    """SPI1 in host mode, driving whatever port pins the PPS gave it."""
+
+    def __init__(self, board, config, pps):
+        self.board = board
+        self.lsb_first = config['LSBF']
+        self.idle = config['CKP']
+        self.change_on_idle_edge = config['CKE']
+        self.sck = board.by_name[pps['SCK']]
+        self.sdo = board.by_name[pps['SDO']]
+        board.drive(self.sck, self.idle)
+
+    def transmit(self, byte):
+        for i in range(8):
+            bit = (byte >> (i if self.lsb_first else 7 - i)) & 1
+            if self.change_on_idle_edge:
+                # data is set up before the active edge
+                self.board.drive(self.sdo, bit)
+                self.board.drive(self.sck, not self.idle)
+            else:
+                # data changes on the active edge, and is sampled on the idle one
+                self.board.drive(self.sck, not self.idle)
+                self.board.drive(self.sdo, bit)
+            self.board.drive(self.sck, self.idle)
+
+
+# ---------------------------------------------------------------------------- #
+
+
+def check_pins(pins, pps):
+    failures = 0
+    for name, (port_pin, tags) in pins.items():
+        print(f'{name:>16}: R{port_pin}, {RELAY_PINS[name]}')
+        if 'gpio' not in tags:
+            failures += 1
+            print(f'    {name} isn\'t a GPIO, the bitbang back end can\'t drive it')
+    for signal, name in pps.items():
+        if name not in pins:
+            failures += 1
+            print(f'    SPI1 {signal} goes to {name}, which isn\'t a relay pin')
+        elif 'pps' not in pins[name][1]:
+            failures += 1
+            print(f'    SPI1 {signal} goes to {name}, which pinmap.py doesn\'t give a PPS output')
+    if sorted(pps) != ['SCK', 'SDO']:
+        failures += 1
+        print(f'    relay_spi_init() routes {sorted(pps)}, expected SCK and SDO')
+    return failures
+
+
+def main():
+    text = RELAY_DRIVER_C.read_text()
+    layout = load_layout()
+    pins = load_pins()
+    config, pps = load_spi_config(text)
+
+    bitbang_tx = translate(function_body(text, 'relay_spi_bitbang_tx_word'))
+    spi_tx = translate(function_body(text, 'relay_spi_tx_word'))
+
+    def bitbang(word):
+        board = Board(pins)
+        bitbang_tx(word, GpioPins(board), None)
+        return board.chain.output()
+
+    def spi(word):
+        board = Board(pins)
+        spi_tx(word, GpioPins(board), Spi1(board, config, pps))
+        return board.chain.output()
+
+    bitbang.__name__, spi.__name__ = 'bitbang', 'spi'
+
+    failures = check_pins(pins, pps)
+
+    mismatches = 0
+    for word in range(1 << 16):
+        expected = bitbang(word)
+        actual = spi(word)
+        if expected != actual:
+            mismatches += 1
+            if mismatches <= 10:
+                print(f'{word:#06x}: bitbang {expected:#06x}, spi {actual:#06x}')
+
+    print(f'bitbang vs spi: {65536 - mismatches}/65536 words match')
+    failures += mismatches
+
+    for name, first, width in layout:
+        for bit in range(width):
+            word = 1 << (first + bit)
+            for back_end in [bitbang, spi]:
+                drain = back_end(word)
+                chip, pin = divmod(drain.bit_length() - 1, 8)
+                if drain != word:
+                    failures += 1
+                    print(f'{name}[{bit}] via {back_end.__name__}: chip {chip + 1} Q{pin}')
+        print(f'{name:>5}: bits {first}-{first + width - 1}, chip {first // 8 + 1} Q{first % 8}')
+
+    if failures:
+        raise SystemExit(f'{failures} failures')
+    print('ok')
+
+
+if __name__ == '__main__':
+    main()
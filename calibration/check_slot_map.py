@@ -0,0 +1,221 @@
+"""Exhaustively check find_memory_slot() against a reference model.
+
+This mirrors build_slot_tables() and find_memory_slot() from
+src/tuning/band_plan.c, and compares them with the plain proportional map for
+every frequency from 1 to 55000 KHz. It checks the default plan from
+bandplan.py, and a few custom plans of the kind a MARS or commercial site
+would upload. It also checks that defaultGroups[], defaultSlotGroups[] and
+defaultSlotBuckets[] in band_plan.c are the ones bandplan.py generates right
+now.
+
+It also checks find_original_slot_frequency(), the way back from the mapping
+memories were stored under before the band plan, see the notes in
+band_plan.c. Every slot that mapping used has to come back to itself, in
+frequency order, and the table shows how far the memories have to move.
+
+usage: python check_slot_map.py
+"""
+
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..'))
+
+import bandplan  # noqa: E402
+
+SOURCE = os.path.join(os.path.dirname(__file__), '..', 'src', 'tuning', 'band_plan.c')
+
+BUCKET_SHIFT = bandplan.BUCKET_SHIFT
+SCALE_SHIFT = bandplan.SCALE_SHIFT
+
+# (start, end, slots), end is exclusive
+custom_plans = {
+    # most of the table in the 2-30 MHz gaps, 6M squeezed
+    'MARS': [
+        (1, 2000, 100),
+        (2000, 30000, 3000),
+        (30000, 55000, 400),
+    ],
+    # a few narrow channels, to exercise groups smaller than a bucket
+    'channels': [
+        (1, 4000, 200),
+        (4000, 4050, 100),
+        (4050, 4100, 100),
+        (4100, 4120, 50),
+        (4120, 10000, 1000),
+        (10000, 10001, 1),
+        (10001, 30000, 1849),
+        (30000, 55000, 200),
+    ],
+    # one wide group with one slot
+    'sparse': [
+        (1, 14000, 3249),
+        (14000, 14350, 250),
+        (14350, 55000, 1),
+    ],
+}
+
+
+def split_large_groups(plan):
+    """Plans store slots in a byte, so big groups are uploaded in pieces"""
+    result = []
+    for start, end, slots in plan:
+        pieces = -(-slots // 255)
+        for i in range(pieces):
+            piece_start = start + (end - start) * i // pieces
+            piece_end = start + (end - start) * (i + 1) // pieces
+            piece_slots = slots * (i + 1) // pieces - slots * i // pieces
+            result.append((piece_start, piece_end, piece_slots))
+    return result
+
+
+def is_valid(plan):
+    """Same rules as band_plan_is_valid()"""
+    if not 0 < len(plan) <= 32:
+        return False
+    start = bandplan.FREQ_MIN
+    for group_start, end, slots in plan:
+        if group_start != start or end <= start or not 0 < slots <= 255:
+            return False
+        start = end
+    return start == bandplan.FREQ_MAX and sum(g[2] for g in plan) == bandplan.NUMBER_OF_TABLE_ENTRIES
+
+
+def build_slot_tables(plan):
+    """Same steps as build_slot_tables(), bandplan.py generates the default
+    plan's tables with the same functions"""
+    groups = bandplan.slot_groups(plan)
+    for group in groups:
+        assert group[3] < 1 << 32
+    return groups, bandplan.buckets(plan)
+
+
+def lookup_slot(frequency, groups, buckets):
+    """Same steps as find_memory_slot(), also returns the groups it had to step"""
+    if frequency >= bandplan.FREQ_MAX:
+        return bandplan.NUMBER_OF_TABLE_ENTRIES - 1, 0
+
+    group = buckets[frequency >> BUCKET_SHIFT]
+    steps = 0
+    while group + 1 < len(groups) and frequency >= groups[group + 1][0]:
+        group += 1
+        steps += 1
+
+    start, first_slot, last_slot, scale, _ = groups[group]
+    product = (frequency - start) * scale
+    assert product < 1 << 32
+    return min(first_slot + (product >> SCALE_SHIFT), last_slot), steps
+
+
+def reference_slot(frequency, plan):
+    """The group's slots spread evenly across the group's frequencies"""
+    first_slot = 0
+    for start, end, slots in plan:
+        if end > frequency:
+            return first_slot + (frequency - start) * slots // (end - start)
+        first_slot += slots
+    return bandplan.NUMBER_OF_TABLE_ENTRIES - 1
+
+
+def check_plan(name, plan):
+    assert is_valid(plan), name
+    groups, buckets = build_slot_tables(plan)
+
+    mismatches = 0
+    worst = 0
+    most_steps = 0
+    for frequency in range(bandplan.FREQ_MIN, bandplan.FREQ_MAX + 1):
+        expected = reference_slot(frequency, plan)
+        actual, steps = lookup_slot(frequency, groups, buckets)
+        most_steps = max(most_steps, steps)
+        if expected != actual:
+            mismatches += 1
+            worst = max(worst, abs(expected - actual))
+
+    print(f'{name:9} | {len(plan):6} | {mismatches:10} | {worst:9} | {most_steps}')
+    return mismatches == 0
+
+
+def original_slot(frequency, plan):
+    """Same steps as the find_memory_slot() from before the band plan, which
+    spread each group over the next group's slot count. The last group read
+    past the end of the table, so it isn't modelled."""
+    first_slot = 0
+    for i, (start, end, slots) in enumerate(plan[:-1]):
+        if end > frequency:
+            return first_slot + (frequency - start) * plan[i + 1][2] // (end - start)
+        first_slot += slots
+    return None
+
+
+def original_slot_frequency(slot, plan):
+    """Same steps as find_original_slot_frequency()"""
+    first_slot = 0
+    for i, (start, end, _) in enumerate(plan[:-1]):
+        slots = plan[i + 1][2]
+        if first_slot <= slot < first_slot + slots:
+            return start + ((slot - first_slot) * 2 + 1) * (end - start) // (2 * slots)
+        first_slot += plan[i][2]
+    return 0
+
+
+def check_original_mapping(plan):
+    used = {}
+    for frequency in range(bandplan.FREQ_MIN, bandplan.FREQ_MAX):
+        slot = original_slot(frequency, plan)
+        if slot is not None:
+            used.setdefault(slot, frequency)
+
+    lost = 0
+    unordered = 0
+    previous = 0
+    shifts = {}
+    for slot in range(bandplan.NUMBER_OF_TABLE_ENTRIES):
+        frequency = original_slot_frequency(slot, plan)
+        if slot not in used:
+            continue
+        if not frequency or original_slot(frequency, plan) != slot:
+            lost += 1
+            continue
+        if frequency < previous:
+            unordered += 1
+        previous = frequency
+
+        shift = abs(reference_slot(frequency, plan) - slot)
+        group = next(i for i, g in enumerate(plan) if g[1] > frequency)
+        shifts[group] = max(shifts.get(group, 0), shift)
+
+    moved = sum(1 for shift in shifts.values() if shift)
+    print()
+    print('original mapping')
+    print(f'used slots: {len(used)}, lost: {lost}, out of order: {unordered}')
+    print(f'groups that move: {moved} of {len(plan)}, furthest move: {max(shifts.values())} slots')
+    return lost == 0 and unordered == 0
+
+
+def check_generated_source():
+    with open(SOURCE) as f:
+        source = f.read()
+    for generated in (bandplan.default_plan(), bandplan.default_slot_tables()):
+        if generated not in source:
+            print('band_plan.c is out of date, run cog')
+            return False
+    return True
+
+
+def main():
+    print('plan      | groups | mismatches | max error | most extra steps')
+    print('----------|--------|------------|-----------|-----------------')
+
+    ok = check_plan('default', bandplan.groups())
+    for name, plan in custom_plans.items():
+        ok = check_plan(name, split_large_groups(plan)) and ok
+
+    ok = check_original_mapping(bandplan.groups()) and ok
+
+    if not check_generated_source() or not ok:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,217 @@
+"""Fit the forward/reverse calibration polynomials from the sweep data.
+
+This replaces the copy-and-paste step of calibration.ipynb. It reads fwd.json
+and rev.json, fits one Ax^2 + Bx + C polynomial per band, prints the residuals
+of every band and power level, and prints (or writes) the
+forwardCalibrationTable and reverseCalibrationTable blocks of src/calibration.c.
+
+fwd_attenuated.json is a second forward sweep through an attenuator, covering
+roughly 0.3 - 3W at the tuner. calibration.ipynb merged it into the forward
+fit, but one quadratic can't follow both sweeps: the merged fit was off by
+up to -365% on the attenuated points. So it's fit on its own, per band, and
+reported next to the error of the forward table at those same points. It
+isn't written to calibration.c, which has no low power table to put it in.
+--plain still merges it, to reproduce the notebook.
+
+Outliers are handled in three places:
+  - within a point: raw samples more than 3 MADs from the median are dropped
+    before averaging.
+  - between points: any point whose _reject_count is above --max-rejects had
+    trouble settling during the sweep and is left out.
+  - after fitting: up to --max-outliers points per band whose residual is more
+    than --sigma times the band's median residual are dropped, and the band is
+    fit again.
+
+usage:
+    python fit.py            # print residuals and the new tables
+    python fit.py --write    # also update src/calibration.c in place
+    python fit.py --plain    # reproduce calibration.ipynb exactly
+"""
+
+import argparse
+import json
+import re
+from pathlib import Path
+from statistics import median
+
+HERE = Path(__file__).parent
+CALIBRATION_C = HERE.parent / 'src' / 'calibration.c'
+
+TABLES = {
+    'fwd': ('forwardCalibrationTable', ['fwd.json'], 't_fwd_volts'),
+    'rev': ('reverseCalibrationTable', ['rev.json'], 't_rev_volts'),
+}
+LOW_POWER = ('fwd', 'fwd_attenuated.json')
+Y_LABEL = 'm_fwd'
+
+# ---------------------------------------------------------------------------- #
+
+
+def robust_mean(samples):
+    center = median(samples)
+    mad = median(abs(s - center) for s in samples)
+    if mad == 0:
+        return center
+    kept = [s for s in samples if abs(s - center) <= 3 * mad]
+    return sum(kept) / len(kept)
+
+
+def load_points(names, x_label, args):
+    points = []
+    for name in names:
+        for p in json.loads((HERE / name).read_text())['data']:
+            if args.plain:
+                x, y = p[x_label], p[Y_LABEL]
+            else:
+                if p['_reject_count'] > args.max_rejects:
+                    print(f'  skipping {name} {p["freq"]} {p["power"]}W: {p["_reject_count"]} rejects')
+                    continue
+                x = robust_mean(p['raw'][x_label + '_raw'])
+                y = robust_mean(p['raw'][Y_LABEL + '_raw'])
+            # the attenuated sweep reuses the same power setpoints, so tag them
+            power = p['power'] + ('a' if 'attenuated' in name else '')
+            points.append({'freq': p['freq'], 'power': power, 'x': x, 'y': y})
+    return points
+
+
+# ---------------------------------------------------------------------------- #
+
+
+def solve(matrix, vector):
+    """Gaussian elimination with partial pivoting, fine for 3x3."""
+    n = len(vector)
+    m = [row[:] + [v] for row, v in zip(matrix, vector)]
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(m[r][col]))
+        m[col], m[pivot] = m[pivot], m[col]
+        for row in range(col + 1, n):
+            factor = m[row][col] / m[col][col]
+            for k in range(col, n + 1):
+                m[row][k] -= factor * m[col][k]
+    result = [0.0] * n
+    for row in reversed(range(n)):
+        result[row] = (m[row][n] - sum(m[row][k] * result[k] for k in range(row + 1, n))) / m[row][row]
+    return result
+
+
+def polyfit(xs, ys):
+    """Least squares quadratic, same as np.polyfit(x, y, 2)."""
+    powers = [sum(x**k for x in xs) for k in range(5)]
+    matrix = [[powers[4 - r - c] for c in range(3)] for r in range(3)]
+    vector = [sum(y * x ** (2 - r) for x, y in zip(xs, ys)) for r in range(3)]
+    return solve(matrix, vector)
+
+
+def evaluate(poly, x):
+    a, b, c = poly
+    return ((a * x) + b) * x + c
+
+
+def fit_points(points):
+    """The origin is included as a point, matching calibration.ipynb."""
+    return polyfit([0, *[p['x'] for p in points]], [0, *[p['y'] for p in points]])
+
+
+def fit_band(points, args):
+    poly = fit_points(points)
+    if args.plain:
+        return poly, points
+
+    residuals = [abs(evaluate(poly, p['x']) - p['y']) for p in points]
+    limit = args.sigma * median(residuals)
+    worst = sorted(range(len(points)), key=lambda i: residuals[i], reverse=True)
+    rejected = [i for i in worst[: args.max_outliers] if residuals[i] > limit]
+    if not rejected:
+        return poly, points
+
+    for i in rejected:
+        p = points[i]
+        print(f'  rejecting {p["freq"]} {p["power"]}W: residual {residuals[i]:.3f}W over {limit:.3f}W')
+    points = [p for i, p in enumerate(points) if i not in rejected]
+    return fit_points(points), points
+
+
+# ---------------------------------------------------------------------------- #
+
+
+def print_residuals(label, fits):
+    print(f'{label} residuals (W, %)')
+    for freq, (poly, points) in sorted(fits.items()):
+        cells = []
+        for p in sorted(points, key=lambda p: (p['power'].endswith('a'), p['power'])):
+            error = evaluate(poly, p['x']) - p['y']
+            cells.append(f'{p["power"]}:{error:+.2f}/{error / p["y"] * 100:+.0f}%')
+        worst = max(abs(evaluate(poly, p['x']) - p['y']) for p in points)
+        print(f'  {freq} max {worst:.3f}W | ' + ' '.join(cells))
+    print()
+
+
+def print_low_power(fits, low_fits):
+    print('fwd low power, fit separately (W, %), and the error of the fwd table there')
+    for freq, (poly, points) in sorted(low_fits.items()):
+        own = max(abs(evaluate(poly, p['x']) - p['y']) / p['y'] for p in points)
+        if freq not in fits:
+            print(f'  {freq} own fit max {own * 100:.0f}% | no fwd table')
+            continue
+        table = fits[freq][0]
+        worst = max(abs(evaluate(table, p['x']) - p['y']) / p['y'] for p in points)
+        cells = ' '.join(f'{p["power"]}:{(evaluate(poly, p["x"]) - p["y"]) / p["y"] * 100:+.0f}%' for p in points)
+        print(f'  {freq} own fit max {own * 100:.0f}%, fwd table max {worst * 100:.0f}% | {cells}')
+    print()
+
+
+def format_table(name, fits):
+    lines = [f'polynomial_t {name}[NUM_OF_BANDS] = {{']
+    for freq, (poly, _) in sorted(fits.items()):
+        values = ', '.join(str(round(v, 10)) for v in poly)
+        lines.append(f'    {{{values}}}, // {freq}')
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def write_table(text, name, table):
+    pattern = re.compile(r'polynomial_t ' + name + r'\[NUM_OF_BANDS\] = \{.*?\};', re.S)
+    return pattern.sub(lambda _: table, text, count=1)
+
+
+# ---------------------------------------------------------------------------- #
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--write', action='store_true', help='update src/calibration.c')
+    parser.add_argument('--plain', action='store_true', help='no outlier rejection, like calibration.ipynb')
+    parser.add_argument('--max-rejects', type=int, default=20, help='skip points with more rejects than this')
+    parser.add_argument('--sigma', type=float, default=6.0, help='residual limit, in median residuals')
+    parser.add_argument('--max-outliers', type=int, default=2, help='most points to reject per band')
+    args = parser.parse_args()
+
+    tables = {}
+    for key, (name, files, x_label) in TABLES.items():
+        print(f'fitting {name}')
+        if args.plain and key == LOW_POWER[0]:
+            files = [*files, LOW_POWER[1]]
+        points = load_points(files, x_label, args)
+        freqs = sorted({p['freq'] for p in points})
+        fits = {f: fit_band([p for p in points if p['freq'] == f], args) for f in freqs}
+        print()
+        print_residuals(key, fits)
+        tables[name] = format_table(name, fits)
+
+        if not args.plain and key == LOW_POWER[0]:
+            print(f'fitting {LOW_POWER[1]}')
+            points = load_points([LOW_POWER[1]], x_label, args)
+            freqs = sorted({p['freq'] for p in points})
+            low_fits = {f: fit_band([p for p in points if p['freq'] == f], args) for f in freqs}
+            print()
+            print_low_power(fits, low_fits)
+
+    for table in tables.values():
+        print(table)
+        print()
+
+    if args.write:
+        text = CALIBRATION_C.read_text()
+        for name, table in tables.items():
+            text = write_table(text, name, table)
+        CALIBRATION_C.write_text(text)
+        print(f'updated {CALIBRATION_C}')
@@ -19,6 +19,7 @@ class Pin:
     analog_in = ['input', 'analog']
     led = ['output', 'gpio']
     freq = ['input', 'gpio', 'pps']
+    spi_out = ['output', 'gpio', 'pps']
 
 
 common = {
@@ -40,8 +41,8 @@ common = {
     'B6': None,
     'B7': None,
     #
-    'C0': ('RELAY_CLOCK_PIN', Pin.led),
-    'C1': ('RELAY_DATA_PIN', Pin.led),
+    'C0': ('RELAY_CLOCK_PIN', Pin.spi_out),
+    'C1': ('RELAY_DATA_PIN', Pin.spi_out),
     'C2': ('RELAY_STROBE_PIN', Pin.led),
     'C3': ('BYPASS_LED_PIN', Pin.led),
     'C4': ('FP_STROBE_PIN', Pin.led),
@@ -1,7 +1,15 @@
 #include "calibration.h"
+#include "crc.h"
+#include "os/logging.h"
+#include "peripherals/nonvolatile_memory.h"
+#include "tuning/nvm_table.h"
 #include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static uint8_t LOG_LEVEL = L_SILENT;
 
 /* ************************************************************************** */
 
@@ -37,6 +45,148 @@ polynomial_t reverseCalibrationTable[NUM_OF_BANDS] = {
     {9.2993e-06, 0.0066398257, 0.0677537797}, // 50000000
 };
 
+/* ************************************************************************** */
+/*  Notes on calibration storage
+
+    The tables above are the defaults, compiled into every unit. Calibration
+    tables that were uploaded with 'poly load' can be committed to a reserved
+    region of flash, just below the tune memory table, and are restored from
+    there on every boot.
+
+    The stored record has a header, a format version, the unit's serial number,
+    a revision counter, and a CRC over all of it. A record that fails any of
+    those checks is ignored, and the compiled defaults are used instead.
+
+    The lookup tables used by CALIBRATION_LUT_ENABLED are derived from the
+    polynomials whenever they're needed, so they don't need to be stored.
+
+    The array that reserves the region is initialized, so every HEX file has
+    it as zeros, and programming erases the whole chip anyway. A saved
+    calibration only survives a firmware load if the programmer preserves the
+    region, see preserve_program_memory in project.yaml. It's the two erase
+    blocks below TABLE_LOCATION, 0x19100-0x191FF on the development board's
+    18LF57K42.
+
+    Release builds have no shell or USB, and the release board doesn't bring
+    out a USB port, so a release unit can't take an uploaded calibration. Its
+    tables are compiled in instead: 'calibration/fit.py --write' puts the
+    fitted tables above, then the release build is made from that. The region
+    stays empty, and load_calibration() keeps the compiled tables.
+*/
+
+#define CALIBRATION_MAGIC 0xCA1B
+#define CALIBRATION_FORMAT_VERSION 1
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t revision;
+    uint16_t serial;
+    polynomial_t forward[NUM_OF_BANDS];
+    polynomial_t reverse[NUM_OF_BANDS];
+    uint16_t crc; // must be last, covers everything above it
+} calibration_record_t;
+
+#define CALIBRATION_CRC_LENGTH (sizeof(calibration_record_t) - sizeof(uint16_t))
+
+// calibration_record_t is 248 bytes, so reserve two erase blocks
+#define CALIBRATION_REGION_SIZE (2 * FLASH_ERASE_BLOCKSIZE)
+#define CALIBRATION_LOCATION (TABLE_LOCATION - CALIBRATION_REGION_SIZE)
+
+// save_calibration() erases one block per buffer
+#if FLASH_BUFFER_SIZE != FLASH_ERASE_BLOCKSIZE
+#error "save_calibration() needs FLASH_BUFFER_SIZE to be the erase block size"
+#endif
+
+// reserve the region, same as nvmTable[]
+const uint8_t calibrationRegion[CALIBRATION_REGION_SIZE] __at(CALIBRATION_LOCATION) = {};
+
+calibration_info_t calibrationInfo;
+
+/* -------------------------------------------------------------------------- */
+
+void calibration_init(void) {
+    nonvolatile_memory_init();
+
+    calibrationInfo.serial = 0;
+    calibrationInfo.revision = 0;
+    calibrationInfo.isLoaded = false;
+
+    log_register();
+
+    // the compiled tables need their hot switch limits too
+    invalidate_calibration_cache();
+    load_calibration();
+}
+
+static void read_calibration_record(calibration_record_t *record) {
+    NVM_address_t address = (NVM_address_t)&calibrationRegion[0];
+    uint8_t *bytes = (uint8_t *)record;
+
+    for (uint16_t i = 0; i < sizeof(calibration_record_t); i++) {
+        bytes[i] = flash_read_byte(address + i);
+    }
+}
+
+bool load_calibration(void) {
+    calibration_record_t record;
+    read_calibration_record(&record);
+
+    if (record.magic != CALIBRATION_MAGIC || record.version != CALIBRATION_FORMAT_VERSION) {
+        LOG_INFO({ println("no saved calibration, using defaults"); });
+        return false;
+    }
+
+    if (record.crc != crc16(&record, CALIBRATION_CRC_LENGTH)) {
+        LOG_ERROR({ println("saved calibration failed crc, using defaults"); });
+        return false;
+    }
+
+    memcpy(forwardCalibrationTable, record.forward, sizeof(forwardCalibrationTable));
+    memcpy(reverseCalibrationTable, record.reverse, sizeof(reverseCalibrationTable));
+    invalidate_calibration_cache();
+
+    calibrationInfo.serial = record.serial;
+    calibrationInfo.revision = record.revision;
+    calibrationInfo.isLoaded = true;
+
+    LOG_INFO({ printf("loaded calibration for %u, rev %u\r\n", record.serial, record.revision); });
+    return true;
+}
+
+void save_calibration(uint16_t serial) {
+    calibration_record_t record;
+
+    record.magic = CALIBRATION_MAGIC;
+    record.version = CALIBRATION_FORMAT_VERSION;
+    record.revision = calibrationInfo.revision + 1;
+    record.serial = serial;
+    memcpy(record.forward, forwardCalibrationTable, sizeof(forwardCalibrationTable));
+    memcpy(record.reverse, reverseCalibrationTable, sizeof(reverseCalibrationTable));
+    record.crc = crc16(&record, CALIBRATION_CRC_LENGTH);
+
+    // write the record one block at a time, padding the last block
+    NVM_address_t address = (NVM_address_t)&calibrationRegion[0];
+    uint8_t *bytes = (uint8_t *)&record;
+    uint8_t buffer[FLASH_BUFFER_SIZE];
+
+    for (uint16_t offset = 0; offset < sizeof(calibration_record_t); offset += FLASH_BUFFER_SIZE) {
+        memset(buffer, 0xff, FLASH_BUFFER_SIZE);
+        for (uint16_t i = 0; (i < FLASH_BUFFER_SIZE) && (offset + i < sizeof(calibration_record_t)); i++) {
+            buffer[i] = bytes[offset + i];
+        }
+
+        flash_erase_block(address + offset);
+        flash_write_block(address + offset, buffer);
+    }
+
+    calibrationInfo.serial = record.serial;
+    calibrationInfo.revision = record.revision;
+    calibrationInfo.isLoaded = true;
+
+    LOG_INFO({ printf("saved calibration for %u, rev %u\r\n", record.serial, record.revision); });
+}
+
 /* ************************************************************************** */
 
 // TODO: perhaps these should be right in the center of their bands?
@@ -63,29 +213,281 @@ uint8_t decode_frequency_to_band_index(uint16_t frequency) {
 }
 
 /* -------------------------------------------------------------------------- */
+/*  Notes on calibration interpolation
 
-float correct_forward_power(float forward, uint16_t frequency) {
-    uint8_t band = decode_frequency_to_band_index(frequency);
+    The calibration tables only have polynomials for the ten frequencies that
+    were measured during calibration. Snapping to the nearest band leaves a
+    step in the reported power halfway between every pair of bands, and it
+    means that 60 meters gets calibrated like 80 or 40 meters.
+
+    Instead, each reverse coefficient is linearly interpolated between the two
+    bands that bracket the frequency. Frequencies below the first band or above
+    the last band use that band's polynomial unchanged.
+
+    Forward power still snaps to the nearest band. The forward polynomials
+    don't vary smoothly with frequency, and calibration/check_interpolation.py
+    shows interpolating them is worse than the nearest band between bands
+    (18.19% vs 17.83% mean error, leaving each band out). Reverse improves,
+    9.38% to 8.65%.
+
+    Interpolating costs some float math, but the frequency doesn't change very
+    often. The interpolated polynomials are cached, and only recalculated when
+    the frequency changes or the tables are modified.
+*/
+
+static uint16_t cachedFrequency;
+static bool cacheIsValid = false;
+static polynomial_t cachedForward;
+static polynomial_t cachedReverse;
+
+// frequency measurements jitter, don't rebuild the cache for small changes
+#define CALIBRATION_CACHE_TOLERANCE 25 // KHz
+
+static void update_hot_switch_limits(void);
 
-    polynomial_t poly = forwardCalibrationTable[band];
+void invalidate_calibration_cache(void) {
+    cacheIsValid = false;
+    update_hot_switch_limits();
+}
+
+static polynomial_t interpolate_poly(polynomial_t *table, uint16_t frequency) {
+    if (frequency <= bands[0]) {
+        return table[0];
+    }
+
+    for (uint8_t i = 0; i < NUM_OF_BANDS - 1; i++) {
+        if (frequency < bands[i + 1]) {
+            float t = (float)(frequency - bands[i]) / (float)(bands[i + 1] - bands[i]);
+
+            polynomial_t poly;
+            poly.A = table[i].A + (table[i + 1].A - table[i].A) * t;
+            poly.B = table[i].B + (table[i + 1].B - table[i].B) * t;
+            poly.C = table[i].C + (table[i + 1].C - table[i].C) * t;
+            return poly;
+        }
+    }
+
+    return table[NUM_OF_BANDS - 1];
+}
 
-    float temp = (poly.A * pow(forward, 2)) + (poly.B * forward) + poly.C;
+// Ax^2 + Bx + C, rearranged as (Ax + B)x + C
+static float evaluate_poly(polynomial_t *poly, float x) {
+    float temp = ((poly->A * x) + poly->B) * x + poly->C;
     if (temp < 0) {
         temp = 0;
     }
     return temp;
 }
 
-float correct_reverse_power(float reverse, uint16_t frequency) {
-    uint8_t band = decode_frequency_to_band_index(frequency);
+#define ADC_MAX_COUNTS 4095
 
-    polynomial_t poly = reverseCalibrationTable[band];
+/* -------------------------------------------------------------------------- */
+#ifdef CALIBRATION_LUT_ENABLED
+/*  Notes on calibration lookup tables
 
-    float temp = (poly.A * pow(reverse, 2)) + (poly.B * reverse) + poly.C;
-    if (temp < 0) {
-        temp = 0;
+    Even in Horner form, correcting a reading costs a handful of float
+    operations, and it happens on every bargraph update and every relay
+    actuation. With CALIBRATION_LUT_ENABLED, the cached polynomials are sampled
+    into a pair of piecewise-linear tables every time the cache is rebuilt.
+    Correcting a reading is then a table lookup, one multiply, and a shift.
+
+    The tables have a point every 64 ADC counts and store centiwatts. For our
+    polynomials, the error from curvature is A * 64^2 / 4, which is ~0.03 watts
+    forward and ~0.01 watts reverse.
+
+    Two kinds of segment can't be interpolated, so lookup_watts() evaluates the
+    polynomial for them instead:
+    - a segment that starts at or below 0 watts. The forward polynomials go
+      negative below 35-75 counts and the points there are clamped to 0, so
+      interpolating across the zero crossing was off by up to ~0.25 watts, in
+      the few watts where QRP tuning happens.
+    - a segment that ends at LUT_SATURATED. A uint16 of centiwatts tops out at
+      655.35 watts, and a calibration that reaches that inside the ADC's range
+      would otherwise read as a flat 655 watts.
+    Those readings cost the float math again, but they're a few percent of the
+    ADC's range, and the bottom one only while the power is too low to matter
+    for speed.
+
+    calibration/check_lookup_tables.py reports the error on the host.
+*/
+
+#define LUT_SEGMENT_SHIFT 6
+#define LUT_SEGMENT_MASK ((1 << LUT_SEGMENT_SHIFT) - 1)
+#define LUT_LENGTH ((ADC_MAX_COUNTS >> LUT_SEGMENT_SHIFT) + 2)
+
+#define LUT_SATURATED UINT16_MAX
+
+static uint16_t forwardLUT[LUT_LENGTH]; // centiwatts
+static uint16_t reverseLUT[LUT_LENGTH]; // centiwatts
+
+static void build_lut(uint16_t *lut, polynomial_t *poly) {
+    for (uint8_t i = 0; i < LUT_LENGTH; i++) {
+        float centiwatts = evaluate_poly(poly, (float)((uint16_t)i << LUT_SEGMENT_SHIFT)) * 100;
+        if (!(centiwatts > 0.0f)) {
+            centiwatts = 0.0f;
+        }
+        if (centiwatts > LUT_SATURATED) {
+            centiwatts = LUT_SATURATED;
+        }
+        lut[i] = (uint16_t)centiwatts;
     }
-    return temp;
+}
+
+// see the notes above for when the polynomial is used instead of the table
+static float lookup_watts(uint16_t *lut, polynomial_t *poly, float reading) {
+    uint16_t counts = (uint16_t)reading;
+    if (counts > ADC_MAX_COUNTS) {
+        counts = ADC_MAX_COUNTS;
+    }
+
+    uint8_t index = counts >> LUT_SEGMENT_SHIFT;
+    if (lut[index] == 0 || lut[index + 1] == LUT_SATURATED) {
+        float watts = evaluate_poly(poly, reading);
+        if (!(watts > 0.0f)) {
+            return 0.0f;
+        }
+        return watts;
+    }
+
+    int32_t delta = (int32_t)lut[index + 1] - (int32_t)lut[index];
+    uint16_t centiwatts = lut[index] + (int16_t)((delta * (counts & LUT_SEGMENT_MASK)) >> LUT_SEGMENT_SHIFT);
+    return centiwatts * 0.01f;
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+static void update_calibration_cache(uint16_t frequency) {
+    uint16_t difference = frequency - cachedFrequency;
+    if (frequency < cachedFrequency) {
+        difference = cachedFrequency - frequency;
+    }
+
+    if (cacheIsValid && (difference <= CALIBRATION_CACHE_TOLERANCE)) {
+        return;
+    }
+
+    cachedForward = forwardCalibrationTable[decode_frequency_to_band_index(frequency)];
+    cachedReverse = interpolate_poly(reverseCalibrationTable, frequency);
+    cachedFrequency = frequency;
+    cacheIsValid = true;
+
+#ifdef CALIBRATION_LUT_ENABLED
+    build_lut(forwardLUT, &cachedForward);
+    build_lut(reverseLUT, &cachedReverse);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on hot switch limits
+
+    The relays must not be switched with more than HOT_SWITCH_WATTS of forward
+    power. Checking that by converting a measurement to watts means a full
+    measure_RF() and calculate_watts_and_swr() before every actuation.
+
+    Instead, each band's forward polynomial is solved for HOT_SWITCH_WATTS
+    once, whenever the tables change, giving the limit in raw ADC counts.
+    Between two bands, the lower of the two limits is used, so the limit is
+    never less conservative than the nearest band's.
+
+    A band whose polynomial has no positive root in the ADC's range can't be
+    trusted to enforce anything, so it borrows the lowest limit of the bands
+    that could be solved. If none could, every band gets
+    FALLBACK_HOT_SWITCH_LIMIT, which is under every compiled band's limit.
+*/
+
+#define FALLBACK_HOT_SWITCH_LIMIT 1700
+
+static uint16_t hotSwitchLimits[NUM_OF_BANDS]; // ADC counts
+
+// solves Ax^2 + Bx + C = watts for the positive root, 0 if there isn't one
+static uint16_t solve_for_counts(polynomial_t *poly, float watts) {
+    float counts;
+    if (poly->A == 0.0f) {
+        counts = (watts - poly->C) / poly->B;
+    } else {
+        float discriminant = (poly->B * poly->B) - (4 * poly->A * (poly->C - watts));
+        counts = (sqrt(discriminant) - poly->B) / (2 * poly->A);
+    }
+
+    if (!(counts >= 1.0f) || counts > ADC_MAX_COUNTS) {
+        return 0;
+    }
+    return (uint16_t)counts;
+}
+
+static void update_hot_switch_limits(void) {
+    uint16_t lowest = UINT16_MAX;
+    for (uint8_t i = 0; i < NUM_OF_BANDS; i++) {
+        hotSwitchLimits[i] = solve_for_counts(&forwardCalibrationTable[i], HOT_SWITCH_WATTS);
+        if (hotSwitchLimits[i] && hotSwitchLimits[i] < lowest) {
+            lowest = hotSwitchLimits[i];
+        }
+    }
+
+    if (lowest == UINT16_MAX) {
+        LOG_WARN({ println("no usable hot switch limit"); });
+        lowest = FALLBACK_HOT_SWITCH_LIMIT;
+    }
+
+    // the bands that couldn't be solved borrow the lowest limit
+    for (uint8_t i = 0; i < NUM_OF_BANDS; i++) {
+        if (!hotSwitchLimits[i]) {
+            hotSwitchLimits[i] = lowest;
+        }
+    }
+}
+
+uint16_t get_hot_switch_limit(uint16_t frequency) {
+    uint16_t limit = ADC_MAX_COUNTS;
+
+    // without a frequency, any band could be the right one
+    if (frequency == 0 || frequency == UINT16_MAX) {
+        for (uint8_t i = 0; i < NUM_OF_BANDS; i++) {
+            if (hotSwitchLimits[i] < limit) {
+                limit = hotSwitchLimits[i];
+            }
+        }
+        return limit;
+    }
+
+    if (frequency <= bands[0]) {
+        return hotSwitchLimits[0];
+    }
+
+    for (uint8_t i = 0; i < NUM_OF_BANDS - 1; i++) {
+        if (frequency < bands[i + 1]) {
+            limit = hotSwitchLimits[i];
+            if (hotSwitchLimits[i + 1] < limit) {
+                limit = hotSwitchLimits[i + 1];
+            }
+            return limit;
+        }
+    }
+
+    return hotSwitchLimits[NUM_OF_BANDS - 1];
+}
+
+/* -------------------------------------------------------------------------- */
+
+float correct_forward_power(float forward, uint16_t frequency) {
+    update_calibration_cache(frequency);
+
+#ifdef CALIBRATION_LUT_ENABLED
+    return lookup_watts(forwardLUT, &cachedForward, forward);
+#else
+    return evaluate_poly(&cachedForward, forward);
+#endif
+}
+
+float correct_reverse_power(float reverse, uint16_t frequency) {
+    update_calibration_cache(frequency);
+
+#ifdef CALIBRATION_LUT_ENABLED
+    return lookup_watts(reverseLUT, &cachedReverse, reverse);
+#else
+    return evaluate_poly(&cachedReverse, reverse);
+#endif
 }
 
 /* -------------------------------------------------------------------------- */
@@ -94,6 +496,112 @@ float correct_reverse_power(float reverse, uint16_t frequency) {
 
     SWR = (1 + sqrt(Pr/Pf))/(1 - sqrt(Pr/Pf))
 */
+#define MIN_SWR 1.1f
+
+#ifdef CALIBRATION_LUT_ENABLED
+/*  With CALIBRATION_LUT_ENABLED, SWR is found without any float math:
+
+    The power ratio is computed in Q16, an integer square root turns that into
+    the reflection coefficient in Q8, and swrTable[] converts the reflection
+    coefficient directly into SWR, in hundredths.
+
+    swrTable[] is generated by cog, run it again if the table format changes.
+*/
+
+/* [[[cog
+    rows = [round((256 + i) / (256 - i) * 100) for i in range(256)]
+    cog.outl('const uint16_t swrTable[256] = {')
+    for i in range(0, 256, 8):
+        cog.outl('    ' + ', '.join(f'{r:5}' for r in rows[i : i + 8]) + ',')
+    cog.outl('};')
+]]] */
+const uint16_t swrTable[256] = {
+      100,   101,   102,   102,   103,   104,   105,   106,
+      106,   107,   108,   109,   110,   111,   112,   112,
+      113,   114,   115,   116,   117,   118,   119,   120,
+      121,   122,   123,   124,   125,   126,   127,   128,
+      129,   130,   131,   132,   133,   134,   135,   136,
+      137,   138,   139,   140,   142,   143,   144,   145,
+      146,   147,   149,   150,   151,   152,   153,   155,
+      156,   157,   159,   160,   161,   163,   164,   165,
+      167,   168,   169,   171,   172,   174,   175,   177,
+      178,   180,   181,   183,   184,   186,   188,   189,
+      191,   193,   194,   196,   198,   199,   201,   203,
+      205,   207,   208,   210,   212,   214,   216,   218,
+      220,   222,   224,   226,   228,   230,   232,   235,
+      237,   239,   241,   244,   246,   248,   251,   253,
+      256,   258,   261,   263,   266,   268,   271,   274,
+      276,   279,   282,   285,   288,   291,   294,   297,
+      300,   303,   306,   310,   313,   316,   320,   323,
+      327,   330,   334,   338,   341,   345,   349,   353,
+      357,   361,   365,   370,   374,   379,   383,   388,
+      392,   397,   402,   407,   412,   417,   422,   428,
+      433,   439,   445,   451,   457,   463,   469,   475,
+      482,   489,   495,   502,   510,   517,   524,   532,
+      540,   548,   556,   565,   574,   583,   592,   601,
+      611,   621,   631,   642,   653,   664,   676,   688,
+      700,   713,   726,   739,   753,   768,   783,   798,
+      814,   831,   848,   866,   885,   904,   924,   945,
+      967,   989,  1013,  1038,  1064,  1091,  1119,  1149,
+     1180,  1213,  1247,  1284,  1322,  1363,  1406,  1452,
+     1500,  1552,  1607,  1666,  1729,  1796,  1869,  1948,
+     2033,  2126,  2227,  2338,  2460,  2595,  2744,  2912,
+     3100,  3313,  3557,  3838,  4167,  4555,  5020,  5589,
+     6300,  7214,  8433, 10140, 12700, 16967, 25500, 51100,
+};
+// [[[end]]]
+
+// bitwise integer square root, Q16 in, Q8 out
+static uint8_t square_root_q16(uint16_t value) {
+    uint16_t root = 0;
+    uint16_t bit = 1U << 14;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint8_t)root;
+}
+
+float calculate_SWR_by_watts(float forward, float reverse) {
+    // less than a centiwatt, same as the float path's MIN_SWR for no power
+    if (!(forward >= 0.01f)) {
+        return MIN_SWR;
+    }
+
+    // do not allow reverse to be greater than forward
+    uint16_t ratio = UINT16_MAX;
+    if (reverse < forward) {
+        // Q16 straight from the floats, centiwatts overflow a uint16 at 655 W
+        float q16 = (reverse / forward) * 65536.0f;
+        if (q16 < 0.0f) {
+            q16 = 0.0f;
+        }
+        if (q16 < (float)UINT16_MAX) {
+            ratio = (uint16_t)q16;
+        }
+    }
+
+    float swr = swrTable[square_root_q16(ratio)] * 0.01f;
+
+    // Actual SWR will almost never be <1.1, but our math is poor at low SWR
+    if (swr < MIN_SWR) {
+        swr = MIN_SWR;
+    }
+
+    return swr;
+}
+#else
 float calculate_SWR_by_watts(float forward, float reverse) {
     // do not allow reverse to be greater than forward
     float tempReverse = reverse;
@@ -107,9 +615,10 @@ float calculate_SWR_by_watts(float forward, float reverse) {
     float swr = ((1.0f + reflectionCoefficient) / (1.0f - reflectionCoefficient));
 
     // Actual SWR will almost never be <1.1, but our math is poor at low SWR
-    if (swr < 1.1f) {
-        swr = 1.1f;
+    if (swr < MIN_SWR) {
+        swr = MIN_SWR;
     }
 
     return swr;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
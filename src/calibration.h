@@ -1,6 +1,7 @@
 #ifndef _CALIBRATION_H_
 #define _CALIBRATION_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /* ************************************************************************** */
@@ -34,11 +35,44 @@ extern polynomial_t forwardCalibrationTable[NUM_OF_BANDS];
 
 extern polynomial_t reverseCalibrationTable[NUM_OF_BANDS];
 
+/* -------------------------------------------------------------------------- */
+// Calibration storage, see calibration.c for details
+
+typedef struct {
+    uint16_t serial;  // serial number of the unit these tables belong to
+    uint8_t revision; // incremented every time the tables are saved
+    bool isLoaded;    // true if the tables were loaded from flash
+} calibration_info_t;
+
+// read-only: describes the calibration tables currently in use
+extern calibration_info_t calibrationInfo;
+
+// setup, restores saved calibration tables if there are any
+extern void calibration_init(void);
+
+// replace the calibration tables with the ones saved in flash
+extern bool load_calibration(void);
+
+// commit the calibration tables to flash, tagged with <serial>
+extern void save_calibration(uint16_t serial);
+
 /* ************************************************************************** */
 
+// call this after modifying either calibration table
+extern void invalidate_calibration_cache(void);
+
+// corrected power is interpolated between the bands surrounding <frequency>
 extern float correct_forward_power(float forward, uint16_t frequency);
 extern float correct_reverse_power(float reverse, uint16_t frequency);
 
 extern float calculate_SWR_by_watts(float forward, float reverse);
 
+/* -------------------------------------------------------------------------- */
+
+// Relays should not be switched above this many forward watts
+#define HOT_SWITCH_WATTS 125
+
+// returns the forward reading, in ADC counts, that equals HOT_SWITCH_WATTS
+extern uint16_t get_hot_switch_limit(uint16_t frequency);
+
 #endif
\ No newline at end of file
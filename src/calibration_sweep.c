@@ -0,0 +1,215 @@
+#include "calibration_sweep.h"
+#include "os/logging.h"
+#include "peripherals/adc.h"
+#include "pins.h"
+#include "rf_sensor.h"
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on the calibration sweep
+
+    The old calibration procedure had the host script ask for a single RF
+    reading at a time, ten times per point, with a full round trip for each
+    one. A 120 point plan took the best part of ten minutes.
+
+    Now the host sends the whole plan up front: the list of frequencies, the
+    list of power levels, and how many ADC samples to take per point. The
+    points are visited frequency major, in the same order as the old sweep
+    files, so fit.py doesn't care which way the data was collected.
+
+    The tuner can't control the transmitter, so every point is one key-down.
+    Once RF is present and stable, the sweep checks the frequency against the
+    plan, captures the point in one tight loop, and hands it to the caller.
+    The radio has to be unkeyed before the next point is taken. A key-down
+    that measures a different frequency than planned isn't captured, and the
+    sweep waits for the next one. It used to be dropped without a word, which
+    left the host waiting on a point that had been thrown away. Now it's
+    counted in sweepStatus, and the idle loop sends a calibration_sweep update
+    with the rejected count and the frequency that was actually measured.
+
+    Each channel is collected into an adc_stats_t, so the host gets the mean
+    and variance without the raw samples.
+*/
+
+// how long to wait for the forward power to settle before each point
+#define SETTLE_TIMEOUT 500
+
+// planned and measured frequency must agree within 1/64th, about 1.5%
+#define FREQUENCY_TOLERANCE_SHIFT 6
+
+typedef enum {
+    SWEEP_IDLE,
+    SWEEP_WAIT_FOR_RF,
+    SWEEP_WAIT_FOR_UNKEY,
+} sweep_state_t;
+
+static sweep_state_t state;
+static uint16_t pointIndex;
+
+sweep_plan_t sweepPlan;
+sweep_point_t sweepPoint;
+sweep_status_t sweepStatus;
+
+/* -------------------------------------------------------------------------- */
+
+void calibration_sweep_init(void) {
+    state = SWEEP_IDLE;
+    pointIndex = 0;
+
+    sweepPlan.numOfFrequencies = 0;
+    sweepPlan.numOfPowers = 0;
+    sweepPlan.samples = DEFAULT_SWEEP_SAMPLES;
+
+    sweepStatus.next = 0;
+    sweepStatus.rejected = 0;
+    sweepStatus.rejectedFrequency = 0;
+
+    log_register();
+}
+
+/* ************************************************************************** */
+
+static uint16_t plan_size(void) {
+    return (uint16_t)sweepPlan.numOfFrequencies * sweepPlan.numOfPowers;
+}
+
+static bool plan_is_valid(void) {
+    if (sweepPlan.numOfFrequencies == 0 || sweepPlan.numOfFrequencies > MAX_SWEEP_FREQUENCIES) {
+        return false;
+    }
+    if (sweepPlan.numOfPowers == 0 || sweepPlan.numOfPowers > MAX_SWEEP_POWERS) {
+        return false;
+    }
+    if (sweepPlan.samples < 2 || sweepPlan.samples > MAX_SWEEP_SAMPLES) {
+        return false;
+    }
+    return true;
+}
+
+bool start_calibration_sweep(void) {
+    if (!plan_is_valid()) {
+        LOG_WARN({ println("rejected sweep plan"); });
+
+        // an empty plan tells the host that nothing is going to happen
+        sweepPlan.numOfFrequencies = 0;
+        sweepPlan.numOfPowers = 0;
+        state = SWEEP_IDLE;
+        return false;
+    }
+
+    LOG_INFO({ printf("starting %u point sweep\r\n", plan_size()); });
+
+    pointIndex = 0;
+    sweepStatus.next = 0;
+    sweepStatus.rejected = 0;
+    sweepStatus.rejectedFrequency = 0;
+
+    // don't take the first point from a carrier that was already there
+    state = SWEEP_WAIT_FOR_UNKEY;
+    return true;
+}
+
+void abort_calibration_sweep(void) {
+    LOG_INFO({ printf("aborted at point %u\r\n", pointIndex); });
+
+    state = SWEEP_IDLE;
+}
+
+bool calibration_sweep_is_running(void) { return state != SWEEP_IDLE; }
+
+/* ************************************************************************** */
+
+static void capture_point(void) {
+    adc_stats_t forward;
+    adc_stats_t reverse;
+    uint16_t samples = sweepPlan.samples;
+
+    // use the same range measure_RF() would settle on for this carrier
+    set_ADC_range(RANGE_HIGH);
+    if (fits_in_low_range(adc_read(ADC_FWD_PIN), adc_read(ADC_REV_PIN))) {
+        set_ADC_range(RANGE_LOW);
+    }
+    float gain = get_ADC_range_gain();
+
+    reset_adc_stats(&forward);
+    reset_adc_stats(&reverse);
+
+    // same interleaving as measure_RF(), but with nothing else in the loop
+    for (uint16_t i = 0; i < samples; i++) {
+        add_adc_sample(&forward, adc_read(ADC_FWD_PIN));
+        add_adc_sample(&reverse, adc_read(ADC_REV_PIN));
+    }
+
+    sweepPoint.index = pointIndex;
+    sweepPoint.frequency = sweepPlan.frequencies[pointIndex / sweepPlan.numOfPowers];
+    sweepPoint.power = sweepPlan.powers[pointIndex % sweepPlan.numOfPowers];
+    sweepPoint.measuredFrequency = currentRF.frequency;
+    sweepPoint.samples = samples;
+    sweepPoint.range = currentRF.range;
+
+    // scale everything into high range counts
+    sweepPoint.forwardMean = adc_stats_mean(&forward) / gain;
+    sweepPoint.forwardVariance = adc_stats_variance(&forward) / (gain * gain);
+    sweepPoint.reverseMean = adc_stats_mean(&reverse) / gain;
+    sweepPoint.reverseVariance = adc_stats_variance(&reverse) / (gain * gain);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool frequency_matches_plan(void) {
+    uint16_t planned = sweepPlan.frequencies[pointIndex / sweepPlan.numOfPowers];
+    uint16_t tolerance = planned >> FREQUENCY_TOLERANCE_SHIFT;
+
+    if (currentRF.frequency > planned) {
+        return (currentRF.frequency - planned) <= tolerance;
+    }
+    return (planned - currentRF.frequency) <= tolerance;
+}
+
+uint8_t calibration_sweep_update(void) {
+    switch (state) {
+    case SWEEP_IDLE:
+        return SWEEP_NO_UPDATE;
+
+    case SWEEP_WAIT_FOR_RF:
+        if (!RF_is_present()) {
+            return SWEEP_NO_UPDATE;
+        }
+        if (!wait_for_stable_RF(SETTLE_TIMEOUT)) {
+            return SWEEP_NO_UPDATE;
+        }
+
+        // the next point has to come from a fresh key-down, good or bad
+        state = SWEEP_WAIT_FOR_UNKEY;
+
+        // a failed measurement can't contradict the plan, only a wrong one can
+        if (measure_frequency() && !frequency_matches_plan()) {
+            LOG_WARN({ printf("point %u: wrong frequency %u\r\n", pointIndex, currentRF.frequency); });
+            if (sweepStatus.rejected < UINT16_MAX) {
+                sweepStatus.rejected++;
+            }
+            sweepStatus.rejectedFrequency = currentRF.frequency;
+            return SWEEP_REJECTED;
+        }
+
+        capture_point();
+        pointIndex++;
+        sweepStatus.next = pointIndex;
+        LOG_INFO({ printf("captured point %u\r\n", sweepPoint.index); });
+        return SWEEP_CAPTURED;
+
+    case SWEEP_WAIT_FOR_UNKEY:
+        if (!RF_is_absent()) {
+            return SWEEP_NO_UPDATE;
+        }
+        if (pointIndex >= plan_size()) {
+            LOG_INFO({ println("sweep finished"); });
+            state = SWEEP_IDLE;
+            return SWEEP_NO_UPDATE;
+        }
+        state = SWEEP_WAIT_FOR_RF;
+        return SWEEP_NO_UPDATE;
+    }
+
+    return SWEEP_NO_UPDATE;
+}
\ No newline at end of file
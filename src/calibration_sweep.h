@@ -0,0 +1,72 @@
+#ifndef _CALIBRATION_SWEEP_H_
+#define _CALIBRATION_SWEEP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+
+#define MAX_SWEEP_FREQUENCIES 16
+#define MAX_SWEEP_POWERS 16
+
+#define DEFAULT_SWEEP_SAMPLES 256
+#define MAX_SWEEP_SAMPLES 1024
+
+typedef struct {
+    uint16_t frequencies[MAX_SWEEP_FREQUENCIES]; // KHz
+    uint16_t powers[MAX_SWEEP_POWERS];           // watts, only used as labels
+    uint8_t numOfFrequencies;
+    uint8_t numOfPowers;
+    uint16_t samples; // ADC samples per channel per point
+} sweep_plan_t;
+
+typedef struct {
+    uint16_t index;     // position in the plan, frequency major
+    uint16_t frequency; // planned frequency in KHz
+    uint16_t power;     // planned power in watts
+    uint16_t measuredFrequency;
+    uint16_t samples;
+    uint8_t range;     // adc_range_t, the range the samples were taken in
+    float forwardMean; // in high range ADC counts, like currentRF.forwardVolts
+    float forwardVariance;
+    float reverseMean;
+    float reverseVariance;
+} sweep_point_t;
+
+// read-only: the plan the sweep is currently following
+extern sweep_plan_t sweepPlan;
+
+// read-only: the most recently captured point
+extern sweep_point_t sweepPoint;
+
+typedef struct {
+    uint16_t next;              // the plan position waiting for a key-down
+    uint16_t rejected;          // key-downs thrown out for the wrong frequency
+    uint16_t rejectedFrequency; // measured frequency of the last one, in KHz
+} sweep_status_t;
+
+// read-only: progress of the current sweep
+extern sweep_status_t sweepStatus;
+
+/* ************************************************************************** */
+
+// setup
+extern void calibration_sweep_init(void);
+
+// start a sweep, returns false and empties the plan if it is invalid
+extern bool start_calibration_sweep(void);
+
+// stop a sweep before it's finished
+extern void abort_calibration_sweep(void);
+
+extern bool calibration_sweep_is_running(void);
+
+// what calibration_sweep_update() has for the host
+#define SWEEP_NO_UPDATE 0
+#define SWEEP_CAPTURED 1 // sweepPoint holds a new capture
+#define SWEEP_REJECTED 2 // a key-down was on the wrong frequency, see sweepStatus
+
+// call this from the idle loop while a sweep is running
+extern uint8_t calibration_sweep_update(void);
+
+#endif // _CALIBRATION_SWEEP_H_
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "crc.h"
+
+/* ************************************************************************** */
+
+uint16_t crc16_update(uint16_t crc, uint8_t data) {
+    crc ^= (uint16_t)data << 8;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        if (crc & 0x8000) {
+            crc = (crc << 1) ^ 0x1021;
+        } else {
+            crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+uint16_t crc16(const void *data, uint16_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint16_t crc = CRC16_INITIAL_VALUE;
+
+    for (uint16_t i = 0; i < length; i++) {
+        crc = crc16_update(crc, bytes[i]);
+    }
+
+    return crc;
+}
+
+/* ************************************************************************** */
+
+uint8_t crc8(const void *data, uint8_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+
+        for (uint8_t j = 0; j < 8; j++) {
+            if (crc & 0x80) {
+                crc = (crc << 1) ^ 0x07;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+
+    return crc;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stdint.h>
+
+/* ************************************************************************** */
+/*  CRC-16/CCITT-FALSE
+
+    Polynomial 0x1021, initial value 0xFFFF. Used to validate blobs that we
+    keep in flash or send over USB.
+*/
+
+#define CRC16_INITIAL_VALUE 0xFFFF
+
+// feed one byte into a running crc
+extern uint16_t crc16_update(uint16_t crc, uint8_t data);
+
+// returns the crc of <length> bytes starting at <data>
+extern uint16_t crc16(const void *data, uint16_t length);
+
+/* ************************************************************************** */
+/*  CRC-8/SMBUS
+
+    Polynomial 0x07, initial value 0x00. Used for the tuning memory entries,
+    where 8 bits is all there's room for. A run of zeros has a crc of 0.
+*/
+
+// returns the crc of <length> bytes starting at <data>
+extern uint8_t crc8(const void *data, uint8_t length);
+
+#endif // _CRC_H_
\ No newline at end of file
@@ -102,7 +102,8 @@ void manual_store(void) {
     if (currentRF.frequency) {
         uint16_t slot = find_memory_slot(currentRF.frequency);
         relays_t relays = read_current_relays();
-        store_memory(slot, relays);
+        // currentRF.swr is from the last measurement, the best guess there is
+        store_memory(slot, relays, currentRF.frequency, currentRF.swr);
         play_animation(&center_crawl[0]);
         return;
     }
@@ -146,6 +147,10 @@ bool set_power_off(void) {
 
     currentRelays[systemFlags.antenna] = tempRelays;
     systemFlags.antenna = tempAnt;
+
+    // don't leave any stored memories or hits sitting in RAM
+    save_memory_hits();
+    flush_memories();
     return true;
 }
 
@@ -166,6 +171,8 @@ void request_memory_tune(void) {
         errors = full_tune();
     }
 
+    // show the last comparison, it hasn't been drawn yet
+    flush_pending_bargraphs();
     disable_bargraph_updates();
     skip_next_peak_decay();
 
@@ -183,6 +190,8 @@ void request_full_tune(void) {
     // do the thing
     tuning_errors_t errors = full_tune();
 
+    // show the last comparison, it hasn't been drawn yet
+    flush_pending_bargraphs();
     disable_bargraph_updates();
     skip_next_peak_decay();
 
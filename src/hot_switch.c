@@ -0,0 +1,93 @@
+#include "hot_switch.h"
+#include "os/logging.h"
+#include "os/system_time.h"
+#include "peripherals/pic_header.h"
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on the hot switch trip
+
+    check_if_safe() only looks at the forward power right before each relay
+    actuation. During a tune, the radio can go from QRP to full power in the
+    middle of a comparison, and the tune would carry on until the next one.
+
+    The forward detector is on RA0, which is also C1IN0-, so comparator 1
+    watches it continuously against DAC1. The DAC runs from the second FVR
+    buffer at the same gain as the ADC's high range, which makes the DAC's 32
+    steps line up with every 128 ADC counts. The trip point is rounded up to
+    the next step, so the comparator never trips below the software limit.
+
+    When the forward voltage rises above the DAC, the comparator interrupt
+    latches hotSwitchTripped. The tuning code checks the latch before every
+    comparison and abandons the tune as soon as it's set.
+*/
+
+#define DAC_STEPS 32
+#define DAC_STEP_SHIFT 7 // 4096 ADC counts / 32 DAC steps
+
+// CM1NCH and CM1PCH channel selections
+#define COMPARATOR_C1IN0N 0b000 // RA0, the forward detector
+#define COMPARATOR_DAC 0b101
+
+// uS for the DAC and comparator outputs to settle after a change
+#define TRIP_SETTLE_TIME 10
+
+static volatile bool hotSwitchTripped;
+
+/* -------------------------------------------------------------------------- */
+
+void hot_switch_init(void) {
+    // DAC1 uses FVR buffer 2, at the same gain as the ADC's high range
+    FVRCONbits.CDAFVR = FVRCONbits.ADFVR;
+    DAC1CON0bits.PSS = 0b10; // positive source is FVR buffer 2
+    DAC1CON0bits.NSS = 0;    // negative source is Vss
+    DAC1CON1 = DAC_STEPS - 1;
+    DAC1CON0bits.EN = 1;
+
+    // the output falls when the forward voltage rises above the DAC
+    CM1NCH = COMPARATOR_C1IN0N;
+    CM1PCH = COMPARATOR_DAC;
+    CM1CON0bits.POL = 0;
+    CM1CON0bits.HYS = 1;
+    CM1CON1bits.INTP = 0;
+    CM1CON1bits.INTN = 1;
+    CM1CON0bits.EN = 1;
+
+    delay_us(TRIP_SETTLE_TIME);
+    hotSwitchTripped = false;
+    PIR1bits.C1IF = 0;
+    PIE1bits.C1IE = 1;
+
+    log_register();
+}
+
+void __interrupt(irq(C1), high_priority) hot_switch_ISR(void) {
+    PIR1bits.C1IF = 0;
+
+    hotSwitchTripped = true;
+}
+
+/* ************************************************************************** */
+
+void arm_hot_switch_trip(uint16_t limit) {
+    uint8_t step = (limit + (1 << DAC_STEP_SHIFT) - 1) >> DAC_STEP_SHIFT;
+    if (step > DAC_STEPS - 1) {
+        step = DAC_STEPS - 1;
+    }
+
+    DAC1CON1 = step;
+    delay_us(TRIP_SETTLE_TIME);
+
+    // moving the DAC can glitch the comparator, so clear the latch afterwards
+    PIR1bits.C1IF = 0;
+    hotSwitchTripped = false;
+
+    // there's no edge if the forward power is already over the limit
+    if (CM1CON0bits.OUT == 0) {
+        hotSwitchTripped = true;
+    }
+
+    LOG_DEBUG({ printf("armed at %u counts, step %u\r\n", limit, step); });
+}
+
+bool hot_switch_tripped(void) { return hotSwitchTripped; }
\ No newline at end of file
@@ -0,0 +1,20 @@
+#ifndef _HOT_SWITCH_H_
+#define _HOT_SWITCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+
+// setup, call this while the ADC is in the high range
+extern void hot_switch_init(void);
+
+/* ************************************************************************** */
+
+// set the trip point to <limit> high range ADC counts and clear any old trip
+extern void arm_hot_switch_trip(uint16_t limit);
+
+// true if forward power has crossed the trip point since it was armed
+extern bool hot_switch_tripped(void);
+
+#endif // _HOT_SWITCH_H_
\ No newline at end of file
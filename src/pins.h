@@ -62,6 +62,8 @@ enum {
 #ifdef DEVELOPMENT
     #define PPS_DEBUG_TX_PIN PPS_OUTPUT(B, 7)
 #endif
+#define PPS_RELAY_CLOCK_PIN PPS_OUTPUT(C, 0)
+#define PPS_RELAY_DATA_PIN PPS_OUTPUT(C, 1)
 #ifdef DEVELOPMENT
     #define PPS_FREQ_PIN PPS_INPUT(F, 0)
 #else
@@ -2,17 +2,118 @@
 #include "os/logging.h"
 #include "os/system_time.h"
 #include "peripherals/pic_header.h"
+#include "peripherals/pps.h"
 #include "pins.h"
+#include "relay_wear.h"
 static uint8_t LOG_LEVEL = L_SILENT;
 
 /* ************************************************************************** */
+/*  Notes on the relay SPI back ends
+
+    The TPIC6B595s shift on the rising edge of SRCK and copy the shift register
+    to the drains on the rising edge of RCK. The first bit shifted in ends up
+    at the far end of the chain, so the word goes out MSB first: bit 15 (ant)
+    lands on the last drain of the second chip, and bit 0 (the smallest cap)
+    on the first drain of the first chip.
+
+    The bitbang back end toggles the pins by hand, with 10uS per edge. It takes
+    around 500uS per word, which adds up over the hundreds of publishes in a
+    full tune.
+
+    The hardware back end hands the word to SPI1 as two bytes, bot then top,
+    in mode 0 and MSB first. That's the same bit sequence as the bitbang loop,
+    and it finishes in about 35uS. The strobe pin is still driven by hand,
+    after the transfer is complete.
+
+    RELAY_SPI_ENABLED selects the hardware back end. Without it, the clock and
+    data pins stay plain GPIO and the bitbang back end is used.
+
+    calibration/check_relay_bits.py models the chain on the pins from
+    pinmap.py, and runs both tx functions below through it, translated from
+    this file. It checks them against each other and against the drain order
+    described above. Keep the tx functions to the simple statements it knows
+    how to translate.
+*/
+
+// SPI1 clock is Fosc / (2 * (BAUD + 1)), 64MHz / 64 = 1MHz
+#define RELAY_SPI_BAUD 31
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on relay settling
+
+    The relays bounce for RELAY_COIL_DELAY mS after every actuation, and any
+    RF measurement taken in that window is garbage. publish_relays() used to
+    sit in delay_ms() for the whole time, so nothing else could run.
+
+    start_publish_relays() shifts the new word out, stamps the settle deadline,
+    and returns right away. relays_are_settled() reports when the deadline has
+    passed, and the caller is free to do anything that doesn't need settled
+    relays in the meantime.
+
+    wait_for_relays_to_settle() spins until the deadline, running the settle
+    callback on every pass. The callback is how the UI gets its housekeeping
+    done while a tune is in progress, so it must never publish relays itself.
+    publish_relays() is the blocking version of the whole thing.
+*/
+
+static system_time_t settleStartTime;
+static bool relaysAreSettling = false;
+
+// the coils are non-latching, so every relay is off at power-up
+static uint16_t publishedBits = 0;
+static void (*settleCallback)(void);
+
+/* -------------------------------------------------------------------------- */
+
+#ifdef RELAY_SPI_ENABLED
+static void relay_spi_init(void) {
+    pps_out_SPI1_SCK(PPS_RELAY_CLOCK_PIN);
+    pps_out_SPI1_SDO(PPS_RELAY_DATA_PIN);
+
+    SPI1CON0bits.EN = 0;
+    SPI1CON0bits.MST = 1;   // host mode
+    SPI1CON0bits.BMODE = 1; // a byte goes out whenever SPI1TXB is written
+    SPI1CON0bits.LSBF = 0;  // MSB first
+    SPI1CON1bits.CKP = 0;   // clock idles low
+    SPI1CON1bits.CKE = 1;   // data changes on the falling edge
+    SPI1CON2bits.TXR = 1;   // transmit only, nothing to read back
+    SPI1CON2bits.RXR = 0;
+    SPI1CLK = 0; // Fosc
+    SPI1BAUD = RELAY_SPI_BAUD;
+    SPI1CON0bits.EN = 1;
+}
+
+static void relay_spi_tx_word(uint16_t word) {
+    set_RELAY_STROBE_PIN(0);
+
+    // the transmit FIFO is two bytes deep, so both bytes go in at once
+    SPI1TXB = (uint8_t)(word >> 8);
+    SPI1TXB = (uint8_t)word;
+    while (SPI1CON2bits.BUSY) {
+        // wait for the last bit to leave
+    }
+
+    set_RELAY_STROBE_PIN(1);
+    delay_us(1);
+    set_RELAY_STROBE_PIN(0);
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
 
 void relay_driver_init(void) {
+    relaysAreSettling = false;
+
     // set bitbang spi relay pins to default values
     set_RELAY_CLOCK_PIN(1);
     set_RELAY_DATA_PIN(1);
     set_RELAY_STROBE_PIN(1);
 
+#ifdef RELAY_SPI_ENABLED
+    // has to happen before pps_lock()
+    relay_spi_init();
+#endif
+
     log_register();
 }
 
@@ -40,11 +141,64 @@ static void relay_spi_bitbang_tx_word(uint16_t word) {
     delay_us(10);
 }
 
-void publish_relays(relay_bits_t relayBits) {
+/* -------------------------------------------------------------------------- */
+
+void start_publish_relays(relay_bits_t relayBits) {
+#ifdef RELAY_SPI_ENABLED
+    relay_spi_tx_word(relayBits.bits);
+#else
     relay_spi_bitbang_tx_word(relayBits.bits);
+#endif
+
+    // every relay that changed state wore its contacts a little
+    count_relay_toggles(publishedBits ^ relayBits.bits);
+    publishedBits = relayBits.bits;
+
+    // the relays start bouncing as soon as the strobe goes out
+    settleStartTime = get_current_time();
+    relaysAreSettling = true;
+}
+
+bool relays_are_settled(void) {
+    if (relaysAreSettling && time_since(settleStartTime) >= RELAY_COIL_DELAY) {
+        relaysAreSettling = false;
+    }
+    return !relaysAreSettling;
+}
 
-    // wait for the relay to stop bouncing
-    delay_ms(RELAY_COIL_DELAY);
+uint8_t relay_settle_time_remaining(void) {
+    if (relays_are_settled()) {
+        return 0;
+    }
+
+    // read the time once, a tick between two reads could wrap the result
+    system_time_t elapsed = time_since(settleStartTime);
+    if (elapsed >= RELAY_COIL_DELAY) {
+        return 0;
+    }
+    return RELAY_COIL_DELAY - elapsed;
+}
+
+void set_relay_settle_callback(void (*callback)(void)) {
+    settleCallback = callback;
+}
+
+void wait_for_relays_to_settle(void) {
+    static bool inCallback = false;
+
+    while (!relays_are_settled()) {
+        // a callback that ends up back in here just waits
+        if (settleCallback && !inCallback) {
+            inCallback = true;
+            settleCallback();
+            inCallback = false;
+        }
+    }
+}
+
+void publish_relays(relay_bits_t relayBits) {
+    start_publish_relays(relayBits);
+    wait_for_relays_to_settle();
 }
 
 /* ************************************************************************** */
@@ -1,6 +1,7 @@
 #ifndef _RELAY_DRIVER_H_
 #define _RELAY_DRIVER_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /* ************************************************************************** */
@@ -50,15 +51,31 @@ typedef union {
 // setup
 extern void relay_driver_init(void);
 
-/*  publish_relays() writes a packed relay object out to the hardware
+/*  start_publish_relays() writes a packed relay object out to the hardware
 
     This sends a bit pattern representing the desired relays to the relay driver
-    shift registers via bitbang SPI.
+    shift registers, via SPI1 if RELAY_SPI_ENABLED is defined, or bitbang SPI
+    otherwise.
 
-    Additionally, are unstable for a certain period of time. This function has
-    a blocking delay that prevents the rest of the system from doing things
-    during that debounce time.
+    The relays are unstable for RELAY_COIL_DELAY after this returns. Use
+    relays_are_settled() or wait_for_relays_to_settle() before measuring RF.
 */
+extern void start_publish_relays(relay_bits_t relayBits);
+
+// true once the most recently published relays have stopped bouncing
+extern bool relays_are_settled(void);
+
+// mS until the relays are settled, 0 if they already are
+extern uint8_t relay_settle_time_remaining(void);
+
+// called repeatedly while wait_for_relays_to_settle() is waiting
+// the callback must not publish relays
+extern void set_relay_settle_callback(void (*callback)(void));
+
+// block until the relays are settled, running the settle callback meanwhile
+extern void wait_for_relays_to_settle(void);
+
+// start_publish_relays() followed by wait_for_relays_to_settle()
 extern void publish_relays(relay_bits_t relayBits);
 
 /* ************************************************************************** */
@@ -0,0 +1,262 @@
+#include "relay_wear.h"
+#include "crc.h"
+#include "os/logging.h"
+#include "os/system_time.h"
+#include "peripherals/nonvolatile_memory.h"
+#include "relay_driver.h"
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on relay wear
+
+    The relay contacts are the part of the tuner that wears out, so every relay
+    gets a lifetime toggle counter. publish_relays() XORs the outgoing bits
+    against the previous ones and hands the difference to count_relay_toggles().
+    The coils are non-latching, so every relay starts at 0 after power-up.
+
+    A full tune can toggle relays a few thousand times, which would wear out
+    the EEPROM long before the relays if every toggle was written. Instead the
+    counts build up in RAM, and the idle loop saves them once there are
+    WEAR_SAVE_THRESHOLD of them, or once the oldest one is WEAR_SAVE_PERIOD old.
+    A power loss forgets at most that many toggles.
+
+    The EEPROM copy uses the same rotating wear-leveling idea as the flag
+    records, sitting after them at RELAY_WEAR_ADDRESS. Each record carries a
+    sequence number and a CRC, and the valid record with the newest sequence
+    wins. A record is only valid once its CRC is written, so losing power in
+    the middle of a save leaves the previous record in charge.
+
+    Each EEPROM byte takes ~4mS to write, so a whole 72 byte record would hold
+    up the idle loop for ~300mS. Instead, a save takes a snapshot of the
+    counters into savingRecord and continue_relay_wear_save() writes it a few
+    bytes at a time, WEAR_BYTES_PER_PASS per idle pass. Bytes that already
+    hold the right value are skipped without counting against that budget,
+    which catches most of the high bytes of the counters since the slot was
+    last used. The CRC is the last thing in the record, so it's still the last
+    thing written, and the slot doesn't become current until it is.
+
+    Toggles that arrive while a save is in progress are counted towards the
+    next save, since the snapshot has already been taken. save_relay_wear()
+    still exists for the shell and reset_relay_wear(), which need the record
+    written before they return. It takes a fresh snapshot and finishes the
+    save in one go.
+*/
+
+#define RELAY_WEAR_ADDRESS 0x100
+#define NUMBER_OF_WEAR_SLOTS 8
+
+#define WEAR_SAVE_THRESHOLD 256
+#define WEAR_SAVE_PERIOD 600000 // 10 minutes in mS
+
+#define WEAR_BYTES_PER_PASS 4 // ~16mS of EEPROM writes
+
+typedef struct {
+    uint16_t sequence;
+    relay_wear_t wear;
+    uint16_t crc;
+} wear_record_t;
+
+#define WEAR_RECORD_SIZE (uint8_t)sizeof(wear_record_t)
+#define WEAR_RECORD_CRC_LENGTH (WEAR_RECORD_SIZE - sizeof(uint16_t))
+
+relay_wear_t relayWear;
+
+static uint8_t currentSlot;
+static uint16_t currentSequence;
+
+static uint16_t unsavedCounts;
+static system_time_t firstUnsavedTime;
+
+// the record being written by continue_relay_wear_save()
+static wear_record_t savingRecord;
+static uint8_t savingSlot;
+static uint8_t savingPosition;
+static bool saveInProgress;
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t slot_address(uint8_t slot) {
+    return RELAY_WEAR_ADDRESS + (uint16_t)slot * WEAR_RECORD_SIZE;
+}
+
+static void read_wear_record(uint8_t slot, wear_record_t *record) {
+    uint8_t *bytes = (uint8_t *)record;
+    uint16_t address = slot_address(slot);
+
+    for (uint8_t i = 0; i < WEAR_RECORD_SIZE; i++) {
+        bytes[i] = internal_eeprom_read(address + i);
+    }
+}
+
+static bool wear_record_is_valid(wear_record_t *record) {
+    return record->crc == crc16(record, WEAR_RECORD_CRC_LENGTH);
+}
+
+// finds the newest valid record and loads it into relayWear
+static void load_relay_wear(void) {
+    wear_record_t record;
+    bool foundRecord = false;
+
+    for (uint8_t slot = 0; slot < NUMBER_OF_WEAR_SLOTS; slot++) {
+        read_wear_record(slot, &record);
+        if (!wear_record_is_valid(&record)) {
+            continue;
+        }
+
+        // compare sequence numbers in a way that survives wrapping
+        if (foundRecord && (int16_t)(record.sequence - currentSequence) <= 0) {
+            continue;
+        }
+
+        foundRecord = true;
+        currentSlot = slot;
+        currentSequence = record.sequence;
+        relayWear = record.wear;
+    }
+
+    LOG_INFO({
+        if (foundRecord) {
+            printf("found wear record %u in slot %u\r\n", currentSequence, currentSlot);
+        } else {
+            println("no wear record");
+        }
+    });
+}
+
+void relay_wear_init(void) {
+    for (uint8_t i = 0; i < NUM_OF_RELAY_COUNTERS; i++) {
+        relayWear.toggles[i] = 0;
+    }
+    relayWear.blockedHotSwitches = 0;
+
+    // the first save goes to slot 0
+    currentSlot = NUMBER_OF_WEAR_SLOTS - 1;
+    currentSequence = 0;
+    unsavedCounts = 0;
+    saveInProgress = false;
+
+    log_register();
+
+    load_relay_wear();
+}
+
+/* ************************************************************************** */
+
+static void count_unsaved(void) {
+    if (unsavedCounts == 0) {
+        firstUnsavedTime = get_current_time();
+    }
+    if (unsavedCounts < UINT16_MAX) {
+        unsavedCounts++;
+    }
+}
+
+void count_relay_toggles(uint16_t changedBits) {
+    for (uint8_t i = 0; changedBits; i++) {
+        if (changedBits & 1) {
+            relayWear.toggles[i]++;
+            count_unsaved();
+        }
+        changedBits >>= 1;
+    }
+}
+
+void count_blocked_hot_switch(void) {
+    relayWear.blockedHotSwitches++;
+    count_unsaved();
+}
+
+/* ************************************************************************** */
+
+bool relay_wear_needs_saving(void) {
+    if (saveInProgress) {
+        return true;
+    }
+    if (unsavedCounts == 0) {
+        return false;
+    }
+    if (unsavedCounts >= WEAR_SAVE_THRESHOLD) {
+        return true;
+    }
+    return time_since(firstUnsavedTime) >= WEAR_SAVE_PERIOD;
+}
+
+// snapshot the counters into savingRecord, aimed at the next slot
+static void start_relay_wear_save(void) {
+    savingRecord.sequence = currentSequence + 1;
+    savingRecord.wear = relayWear;
+    savingRecord.crc = crc16(&savingRecord, WEAR_RECORD_CRC_LENGTH);
+
+    savingSlot = currentSlot + 1;
+    if (savingSlot >= NUMBER_OF_WEAR_SLOTS) {
+        savingSlot = 0;
+    }
+
+    savingPosition = 0;
+    saveInProgress = true;
+    unsavedCounts = 0;
+}
+
+// write up to <budget> changed bytes of savingRecord, true once it's complete
+static bool write_saving_record(uint8_t budget) {
+    uint8_t *bytes = (uint8_t *)&savingRecord;
+    uint16_t address = slot_address(savingSlot);
+
+    // the CRC is written last, so the record isn't valid until it's complete
+    while (savingPosition < WEAR_RECORD_SIZE) {
+        uint16_t byteAddress = address + savingPosition;
+        if (internal_eeprom_read(byteAddress) != bytes[savingPosition]) {
+            if (budget == 0) {
+                return false;
+            }
+            internal_eeprom_write(byteAddress, bytes[savingPosition]);
+            budget--;
+        }
+        savingPosition++;
+    }
+
+    LOG_INFO({ printf("saved wear record %u to slot %u\r\n", savingRecord.sequence, savingSlot); });
+
+    currentSlot = savingSlot;
+    currentSequence = savingRecord.sequence;
+    saveInProgress = false;
+    return true;
+}
+
+void continue_relay_wear_save(void) {
+    if (!saveInProgress) {
+        start_relay_wear_save();
+    }
+    write_saving_record(WEAR_BYTES_PER_PASS);
+}
+
+void save_relay_wear(void) {
+    // restarting reuses the same slot, whose CRC hasn't been written yet
+    start_relay_wear_save();
+    write_saving_record(WEAR_RECORD_SIZE);
+}
+
+void reset_relay_wear(void) {
+    for (uint8_t i = 0; i < NUM_OF_RELAY_COUNTERS; i++) {
+        relayWear.toggles[i] = 0;
+    }
+    relayWear.blockedHotSwitches = 0;
+
+    // newer than every old record, so none of them come back after a reset
+    save_relay_wear();
+}
+
+/* ************************************************************************** */
+
+// names of the relays, in relay_bits_t order
+static const char *const relayNames[NUM_OF_RELAY_COUNTERS] = {
+    "C0", "C1", "C2", "C3", "C4", "C5", "C6", "Z", //
+    "L0", "L1", "L2", "L3", "L4", "L5", "L6", "A", //
+};
+
+void print_relay_wear(void) {
+    for (uint8_t i = 0; i < NUM_OF_RELAY_COUNTERS; i++) {
+        printf("%s: %lu, ", relayNames[i], relayWear.toggles[i]);
+    }
+    printf("blocked: %lu", relayWear.blockedHotSwitches);
+}
\ No newline at end of file
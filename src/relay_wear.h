@@ -0,0 +1,51 @@
+#ifndef _RELAY_WEAR_H_
+#define _RELAY_WEAR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+
+// one counter for every bit in relay_bits_t
+#define NUM_OF_RELAY_COUNTERS 16
+
+typedef struct {
+    uint32_t toggles[NUM_OF_RELAY_COUNTERS]; // indexed by relay_bits_t bit
+    uint32_t blockedHotSwitches;             // put_relays() refused by check_if_safe()
+} relay_wear_t;
+
+// read-only: lifetime totals, including anything that hasn't been saved yet
+extern relay_wear_t relayWear;
+
+/* ************************************************************************** */
+
+// setup, loads the saved counters from EEPROM
+extern void relay_wear_init(void);
+
+// count every relay whose bit is set in <changedBits>
+extern void count_relay_toggles(uint16_t changedBits);
+
+// count an actuation that was refused because of forward power
+extern void count_blocked_hot_switch(void);
+
+/* ************************************************************************** */
+
+// true once enough counts have built up in RAM to be worth an EEPROM write, or
+// while a save is still being written
+extern bool relay_wear_needs_saving(void);
+
+// write the next few bytes of a save, starting one if needed, takes <20mS
+extern void continue_relay_wear_save(void);
+
+// write the counters to the next EEPROM slot all at once, takes up to ~300mS
+extern void save_relay_wear(void);
+
+// zero every counter, for when the relay board is replaced
+extern void reset_relay_wear(void);
+
+/* ************************************************************************** */
+
+// Prints the counters as "C1: <n>, ... A: <n>, blocked: <n>"
+extern void print_relay_wear(void);
+
+#endif // _RELAY_WEAR_H_
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "relays.h"
+#include "calibration.h"
 #include "display.h"
 #include "flags.h"
+#include "relay_wear.h"
 #include "os/logging.h"
 #include "os/system_time.h"
 #include "rf_sensor.h"
@@ -28,6 +30,7 @@ void relays_init(void) {
     preBypassRelays[1].ant = 1;
 
     relay_driver_init();
+    relay_wear_init();
 
     log_register();
 }
@@ -57,18 +60,22 @@ relays_t unpack_relays(relay_bits_t relayBits) {
 }
 
 /* -------------------------------------------------------------------------- */
-/*  check_if_safe() takes an SWR measurement and determines if it's too
-    dangerous to switch relays. Relays should not be touched above 100W or 125W.
+/*  check_if_safe() takes a short forward power burst and determines if it's
+    too dangerous to switch relays. Relays should not be touched above 100W or
+    125W, see HOT_SWITCH_WATTS.
+
+    The limit is precalculated in ADC counts for each calibration band, so this
+    costs a few conversions instead of a full measurement and watt calculation.
 
     If it's not safe to switch relays, the current operation should be halted
     immediately, and the 'railroad crossing lights' animation should be played
     on the front panel.
 */
 int8_t check_if_safe(void) {
-    measure_RF();
-    calculate_watts_and_swr();
+    uint16_t peak = read_forward_peak();
 
-    if (currentRF.forwardWatts > 125) {
+    if (peak > get_hot_switch_limit(currentRF.frequency)) {
+        LOG_WARN({ printf("forward peak: %u\r\n", peak); });
         return -1;
     }
 
@@ -84,12 +91,14 @@ void update_bypass_status(relays_t relays) {
     update_status_LEDs();
 }
 
-/*  put_relays() takes a pointer to a relay struct and attempts to publish that
-    struct to the physical relays.
+/*  start_put_relays() takes a relay struct and attempts to publish that struct
+    to the physical relays.
 
+    It returns as soon as the relay driver has the new bits, while the relays
+    are still bouncing. See wait_for_relays_to_settle().
 */
-int8_t put_relays(relays_t relays) {
-    LOG_TRACE({ println("put_relays"); });
+int8_t start_put_relays(relays_t relays) {
+    LOG_TRACE({ println("start_put_relays"); });
 
     // overwrite the antenna setting just in case it got clobbered by something
     relays.ant = systemFlags.antenna;
@@ -106,6 +115,7 @@ int8_t put_relays(relays_t relays) {
     // this is EXTRA important on >100W tuners
     if (check_if_safe() == -1) {
         LOG_ERROR({ println("not safe to switch relays"); });
+        count_blocked_hot_switch();
         return (-1);
     }
 
@@ -114,7 +124,7 @@ int8_t put_relays(relays_t relays) {
 
     // pass off the new relays to the relay driver
     relay_bits_t relayBits = pack_relays(relays);
-    publish_relays(relayBits);
+    start_publish_relays(relayBits);
 
     // Update the global bulletin board
     currentRelays[systemFlags.antenna] = relays;
@@ -122,6 +132,18 @@ int8_t put_relays(relays_t relays) {
     return 0;
 }
 
+/*  put_relays() is the blocking version of start_put_relays(), it returns once
+    the new relays have settled.
+*/
+int8_t put_relays(relays_t relays) {
+    if (start_put_relays(relays) == -1) {
+        return (-1);
+    }
+
+    wait_for_relays_to_settle();
+    return 0;
+}
+
 /* ************************************************************************** */
 
 /*  print_relays prints the contents of a relays_t struct
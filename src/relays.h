@@ -48,7 +48,10 @@ extern void relays_init(void);
 extern relay_bits_t pack_relays(relays_t relays);
 extern relays_t unpack_relays(relay_bits_t relayBits);
 
-// publish new relays
+// publish new relays and return while they're still settling
+extern int8_t start_put_relays(relays_t relays);
+
+// publish new relays and wait for them to settle
 extern int8_t put_relays(relays_t relays);
 
 /* ************************************************************************** */
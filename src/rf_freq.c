@@ -1,9 +1,12 @@
 #include "os/logging.h"
 #include "os/system_time.h"
 #include "peripherals/adc.h"
+#include "peripherals/nonvolatile_memory.h"
+#include "peripherals/pic_header.h"
 #include "peripherals/timer.h"
 #include "pins.h"
 #include "rf_sensor.h"
+#include "tuning/band_plan.h"
 
 static uint8_t LOG_LEVEL = L_SILENT;
 
@@ -21,6 +24,8 @@ void RF_freq_init(void) {
     timer4_period_set(0xFF);
 
     log_register(); //
+
+    load_frequency_calibration();
 }
 
 /* ************************************************************************** */
@@ -160,9 +165,9 @@ uint32_t get_period(void) {
 
 /*  Notes on Frequency Measurement
 
-    Frequency is computed by averaging 4 period measurements and performing a
-    big honking integer division. The MAGIC_FREQUENCY_NUMBER is derived from the
-    following calculation:
+    Frequency is computed by averaging several period measurements and
+    performing a big honking integer division. The MAGIC_FREQUENCY_NUMBER is
+    derived from the following calculation:
 
     The incoming signal is divided by 32,768
     Divide this by 2 because we're measuring a half-cycle
@@ -184,27 +189,377 @@ uint32_t get_period(void) {
 */
 
 #define MAGIC_FREQUENCY_NUMBER 1057000000
-#define NUM_OF_PERIOD_SAMPLES 4
-void measure_frequency(void) {
-    LOG_TRACE({ println("measure_frequency"); });
 
-    uint32_t tempPeriod = 0;
+/*  Notes on adaptive sample counts
+
+    A single period measurement is good to within a few dozen timer ticks. The
+    software edge alignment loops in get_period() are the main source of that
+    jitter, not the timer itself. At 1.8 MHz a half period is ~586,000 ticks, so
+    a couple dozen ticks don't matter. At 50 MHz a half period is only ~21,000
+    ticks, and the same jitter is a much larger fraction of the result.
+
+    The band plan in band_plan.c doesn't care about absolute accuracy,
+    only about landing in the correct slot. Using the first good sample,
+    measure_frequency() asks how wide the slot at that frequency is, and
+    estimates how many samples it needs to average to shrink the jitter below
+    half a slot:
+
+        error(KHz) ~= F * jitter / period = F^2 * jitter / MAGIC
+        samples    ~= (2 * error / slotWidth)^2
+
+    This means low frequencies, where every sample is slow, finish after
+    MIN_PERIOD_SAMPLES, and high frequencies, where every sample is fast, take
+    as many as they need to pin down a narrow slot.
+
+    Once the samples are collected, any sample that is too far away from the
+    median is thrown out. The ratio of accepted samples to attempted samples is
+    published as frequencyConfidence.
+*/
+
+#define PERIOD_JITTER_TICKS 32
+#define MIN_PERIOD_SAMPLES 2
+#define MAX_PERIOD_SAMPLES 16
+#define MAX_PERIOD_RETRIES 4
+
+// passing this to measure_period() lets it pick its own sample count
+#define ADAPTIVE_PERIOD_SAMPLES 0
+
+// samples more than median/32 (~3%) away from the median are rejected
+#define OUTLIER_SHIFT 5
+
+static uint8_t calculate_period_samples(uint32_t period, uint32_t magicNumber) {
+    uint16_t frequency = (uint16_t)(magicNumber / period);
+    uint16_t slotWidth = find_slot_width(frequency);
+
+    // expected error, measured in units of half slots
+    uint32_t ratio = ((uint32_t)frequency * frequency / slotWidth);
+    ratio /= (magicNumber / (2 * PERIOD_JITTER_TICKS));
+    ratio += 1;
+
+    if (ratio * ratio > MAX_PERIOD_SAMPLES) {
+        return MAX_PERIOD_SAMPLES;
+    }
+    if (ratio * ratio < MIN_PERIOD_SAMPLES) {
+        return MIN_PERIOD_SAMPLES;
+    }
+    return (uint8_t)(ratio * ratio);
+}
+
+// insertion sort, the array is tiny
+static void sort_periods(uint32_t *periods, uint8_t length) {
+    for (uint8_t i = 1; i < length; i++) {
+        uint32_t temp = periods[i];
+        uint8_t k = i;
+        while (k > 0 && periods[k - 1] > temp) {
+            periods[k] = periods[k - 1];
+            k--;
+        }
+        periods[k] = temp;
+    }
+}
+
+/*  measure_period() collects period samples, rejects outliers, and returns the
+    averaged period. Returns 0 if too many samples time out or get rejected.
+
+    <confidence> is filled with the percentage of attempts that were accepted.
+*/
+static uint32_t measure_period(uint8_t targetSamples, uint32_t magicNumber, uint8_t *confidence) {
+    uint32_t periods[MAX_PERIOD_SAMPLES];
+    uint8_t samples = 0;
+    uint8_t failures = 0;
+
+    *confidence = 0;
+
+    if (targetSamples > MAX_PERIOD_SAMPLES) {
+        targetSamples = MAX_PERIOD_SAMPLES;
+    }
+    bool adaptive = (targetSamples == ADAPTIVE_PERIOD_SAMPLES);
+    if (adaptive) {
+        targetSamples = MIN_PERIOD_SAMPLES;
+    }
 
     // collect period measurements
-    for (uint8_t i = 0; i < NUM_OF_PERIOD_SAMPLES; i++) {
+    while (samples < targetSamples) {
         uint32_t result = get_period();
         if (result == 0) {
-            currentRF.lastFrequencyTime = get_current_time();
-            currentRF.frequency = UINT16_MAX;
-            return;
+            if (++failures >= MAX_PERIOD_RETRIES) {
+                LOG_ERROR({ printf("gave up after %u timeouts\r\n", failures); });
+                return 0;
+            }
+            continue;
+        }
+
+        // the first good sample tells us how hard we need to work
+        if (adaptive && samples == 0) {
+            targetSamples = calculate_period_samples(result, magicNumber);
         }
-        tempPeriod += result;
+        periods[samples++] = result;
     }
 
-    tempPeriod /= NUM_OF_PERIOD_SAMPLES;
+    // throw out anything too far from the median
+    sort_periods(periods, samples);
+    uint32_t median = periods[samples / 2];
+    uint32_t tolerance = median >> OUTLIER_SHIFT;
 
+    uint32_t tempPeriod = 0;
+    uint8_t accepted = 0;
+    for (uint8_t i = 0; i < samples; i++) {
+        if ((periods[i] + tolerance >= median) && (periods[i] <= median + tolerance)) {
+            tempPeriod += periods[i];
+            accepted++;
+        }
+    }
+
+    if (accepted < MIN_PERIOD_SAMPLES) {
+        LOG_ERROR({ printf("only %u of %u samples accepted\r\n", accepted, samples); });
+        return 0;
+    }
+
+    *confidence = (uint8_t)((accepted * 100U) / (samples + failures));
+    LOG_DEBUG({ printf("samples: %u/%u\r\n", accepted, samples); });
+
+    return tempPeriod / accepted;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void publish_bad_frequency(void) {
     currentRF.lastFrequencyTime = get_current_time();
-    currentRF.frequency = (uint16_t)(MAGIC_FREQUENCY_NUMBER / tempPeriod);
+    currentRF.frequency = UINT16_MAX;
+    currentRF.frequencyConfidence = 0;
+}
+
+bool measure_frequency(void) {
+    LOG_TRACE({ println("measure_frequency"); });
+
+    uint32_t magicNumber = get_frequency_magic_number();
+    uint8_t confidence;
+
+    uint32_t period = measure_period(ADAPTIVE_PERIOD_SAMPLES, magicNumber, &confidence);
+    if (period == 0) {
+        publish_bad_frequency();
+        return false;
+    }
+
+    currentRF.lastFrequencyTime = get_current_time();
+    currentRF.frequency = (uint16_t)(magicNumber / period);
+    currentRF.frequencyConfidence = confidence;
+
+    LOG_INFO({
+        printf("frequency: %u, ", currentRF.frequency);
+        printf("confidence: %u%%\r\n", currentRF.frequencyConfidence);
+    });
+    return true;
+}
+
+/* ************************************************************************** */
+/*  Notes on frequency counter calibration
+
+    MAGIC_FREQUENCY_NUMBER was found by hand, on one unit, at room temperature.
+    The timer runs from HFINTOSC, which is only trimmed to about 1% at the
+    factory and drifts with temperature, so every unit is a little different.
+
+    Calibration replaces the magic number with one derived from a known input:
+    feed the tuner a reference carrier, average a lot of periods, and then
+
+        magicNumber = referenceFrequency * period
+
+    The reading from the device's temperature indicator is saved alongside it.
+
+    Running the calibration a second time at a different temperature gives a
+    second magic number, and the slope between the two points is saved as
+    tempco, in parts-per-million of magicNumber per temperature count. At
+    measurement time, the magic number is corrected by:
+
+        magicNumber * (1 + tempco * (temperature - referenceTemp) / 1000000)
+
+    The temperature indicator isn't calibrated in degrees. That's fine, because
+    the only thing that matters is how far it has moved since calibration.
+
+    Reading the indicator means 16 conversions and two ADC range switches, which
+    is too much to do on every measure_frequency(). The die temperature moves
+    slowly, so get_frequency_magic_number() uses a cached reading that's only
+    refreshed every TEMPERATURE_REFRESH_PERIOD.
+
+    The tempco is a slope away from the first calibration point, so it can only
+    be measured once calibrate_frequency() has run. An uncalibrated unit has a
+    referenceTemp of 0, which no real indicator reading produces, and
+    calibrate_frequency_tempco() refuses to run against it.
+
+    The calibration lives in EEPROM, far away from the flag records in flags.c.
+*/
+
+frequency_calibration_t frequencyCalibration;
+
+#define FREQ_CAL_ADDRESS 0x380
+#define FREQ_CAL_MARKER 0xA5
+#define NUM_OF_CAL_PERIOD_SAMPLES 16
+#define NUM_OF_TEMPERATURE_SAMPLES 16
+#define TEMPERATURE_REFRESH_PERIOD 5000 // mS
+
+// the K42 temperature indicator is an internal ADC channel
+#define ADC_TEMPERATURE_CHANNEL 0b111100
+
+uint16_t read_temperature_indicator(void) {
+    FVRCONbits.TSRNG = 0; // low range, works down to 1.8v
+    FVRCONbits.TSEN = 1;
+
+    // the tempco was measured against the high range ADC reference
+    adc_range_t previousRange = currentRF.range;
+    set_ADC_range(RANGE_HIGH);
+
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < NUM_OF_TEMPERATURE_SAMPLES; i++) {
+        sum += adc_read(ADC_TEMPERATURE_CHANNEL);
+    }
+
+    set_ADC_range(previousRange);
+
+    return (uint16_t)(sum / NUM_OF_TEMPERATURE_SAMPLES);
+}
+
+// the indicator reading, refreshed at most every TEMPERATURE_REFRESH_PERIOD
+static uint16_t get_cached_temperature(void) {
+    static uint16_t temperature = 0;
+    static system_time_t lastReading = 0;
+
+    if (temperature == 0 || time_since(lastReading) >= TEMPERATURE_REFRESH_PERIOD) {
+        temperature = read_temperature_indicator();
+        lastReading = get_current_time();
+    }
+    return temperature;
+}
+
+uint32_t get_frequency_magic_number(void) {
+    if (frequencyCalibration.tempco == 0) {
+        return frequencyCalibration.magicNumber;
+    }
+
+    int16_t deltaTemp = (int16_t)get_cached_temperature() - (int16_t)frequencyCalibration.referenceTemp;
+    float correction = (float)frequencyCalibration.tempco * deltaTemp * 1e-6f;
+
+    return (uint32_t)((float)frequencyCalibration.magicNumber * (1.0f + correction));
+}
+
+void print_frequency_calibration(void) {
+    printf("magic: %lu, ", frequencyCalibration.magicNumber);
+    printf("refTemp: %u, ", frequencyCalibration.referenceTemp);
+    printf("tempco: %d ppm/count", frequencyCalibration.tempco);
+}
+
+/* -------------------------------------------------------------------------- */
+
+// used as a simple checksum on the EEPROM copy of the calibration
+static uint8_t calibration_checksum(frequency_calibration_t *calibration) {
+    uint8_t *bytes = (uint8_t *)calibration;
+    uint8_t sum = FREQ_CAL_MARKER;
+
+    for (uint8_t i = 0; i < sizeof(frequency_calibration_t); i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+void reset_frequency_calibration(void) {
+    frequencyCalibration.magicNumber = MAGIC_FREQUENCY_NUMBER;
+    frequencyCalibration.referenceTemp = 0;
+    frequencyCalibration.tempco = 0;
+}
+
+void load_frequency_calibration(void) {
+    reset_frequency_calibration();
+
+    if (internal_eeprom_read(FREQ_CAL_ADDRESS) != FREQ_CAL_MARKER) {
+        LOG_INFO({ println("no saved frequency calibration"); });
+        return;
+    }
+
+    frequency_calibration_t calibration;
+    uint8_t *bytes = (uint8_t *)&calibration;
+    for (uint8_t i = 0; i < sizeof(frequency_calibration_t); i++) {
+        bytes[i] = internal_eeprom_read(FREQ_CAL_ADDRESS + 1 + i);
+    }
+
+    uint8_t checksum = internal_eeprom_read(FREQ_CAL_ADDRESS + 1 + sizeof(frequency_calibration_t));
+    if (checksum != calibration_checksum(&calibration)) {
+        LOG_ERROR({ println("frequency calibration failed checksum"); });
+        return;
+    }
+
+    frequencyCalibration = calibration;
+    LOG_INFO({
+        print_frequency_calibration();
+        println("");
+    });
+}
+
+void save_frequency_calibration(void) {
+    uint8_t *bytes = (uint8_t *)&frequencyCalibration;
+
+    // invalidate the old copy first, in case we lose power halfway through
+    internal_eeprom_write(FREQ_CAL_ADDRESS, 0xff);
+    for (uint8_t i = 0; i < sizeof(frequency_calibration_t); i++) {
+        internal_eeprom_write(FREQ_CAL_ADDRESS + 1 + i, bytes[i]);
+    }
+    internal_eeprom_write(FREQ_CAL_ADDRESS + 1 + sizeof(frequency_calibration_t),
+                          calibration_checksum(&frequencyCalibration));
+    internal_eeprom_write(FREQ_CAL_ADDRESS, FREQ_CAL_MARKER);
+}
+
+/* -------------------------------------------------------------------------- */
+
+// measures the magic number implied by a known reference frequency
+static uint32_t measure_magic_number(uint16_t referenceFrequency) {
+    uint8_t confidence;
+    uint32_t period = measure_period(NUM_OF_CAL_PERIOD_SAMPLES, frequencyCalibration.magicNumber, &confidence);
+    if (period == 0) {
+        return 0;
+    }
+
+    LOG_INFO({ printf("period: %lu, confidence: %u%%\r\n", period, confidence); });
+    return (uint32_t)referenceFrequency * period;
+}
+
+bool calibrate_frequency(uint16_t referenceFrequency) {
+    LOG_TRACE({ println("calibrate_frequency"); });
+
+    uint32_t magicNumber = measure_magic_number(referenceFrequency);
+    if (magicNumber == 0) {
+        return false;
+    }
+
+    frequencyCalibration.magicNumber = magicNumber;
+    frequencyCalibration.referenceTemp = read_temperature_indicator();
+    save_frequency_calibration();
+
+    return true;
+}
+
+bool calibrate_frequency_tempco(uint16_t referenceFrequency) {
+    LOG_TRACE({ println("calibrate_frequency_tempco"); });
+
+    // the slope needs a first point to be measured from
+    if (frequencyCalibration.referenceTemp == 0) {
+        LOG_ERROR({ println("no frequency calibration to measure the tempco from"); });
+        return false;
+    }
+
+    int16_t deltaTemp = (int16_t)read_temperature_indicator() - (int16_t)frequencyCalibration.referenceTemp;
+    if (deltaTemp == 0) {
+        LOG_ERROR({ println("temperature hasn't changed since calibration"); });
+        return false;
+    }
+
+    uint32_t magicNumber = measure_magic_number(referenceFrequency);
+    if (magicNumber == 0) {
+        return false;
+    }
+
+    float drift = ((float)magicNumber - (float)frequencyCalibration.magicNumber);
+    drift /= (float)frequencyCalibration.magicNumber;
+
+    frequencyCalibration.tempco = (int16_t)((drift * 1e6f) / deltaTemp);
+    save_frequency_calibration();
 
-    LOG_INFO({ printf("frequency: %u\r\n", currentRF.frequency); });
+    return true;
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "rf_sensor.h"
 #include "calibration.h"
+#include "calibration_sweep.h"
+#include "hot_switch.h"
 #include "os/logging.h"
 #include "os/system_time.h"
 #include "peripherals/adc.h"
+#include "peripherals/pic_header.h"
 #include "peripherals/timer.h"
 #include "pins.h"
 #include <math.h>
@@ -24,6 +27,17 @@ static void clear_currentRF(void) {
     currentRF.reverseVolts = 0;
     currentRF.matchQuality = 0.0;
 
+    // measurement quality
+    currentRF.forwardVariance = 0.0;
+    currentRF.reverseVariance = 0.0;
+    currentRF.forwardMin = 0;
+    currentRF.forwardMax = 0;
+    currentRF.reverseMin = 0;
+    currentRF.reverseMax = 0;
+    currentRF.saturatedSamples = 0;
+    currentRF.sampleCount = 0;
+    currentRF.measurementQuality = 0;
+
     // calculated values
     currentRF.forwardWatts = 0.0;
     currentRF.reverseWatts = 0.0;
@@ -35,14 +49,18 @@ static void clear_currentRF(void) {
 // re_freq.c has no header so declare init here
 extern void RF_freq_init(void);
 
+static void ADC_range_init(void);
+
 void RF_sensor_init(void) {
     adc_init();
+    ADC_range_init();
+    hot_switch_init();
 
     // Initialize the Global RF Readings
     clear_currentRF();
     currentRF.frequency = 0;
-    currentRF.history = 0;
-    currentRF.isPresent = false;
+    currentRF.frequencyConfidence = 0;
+    reset_RF_presence();
 
     // clear timestamps
     currentRF.lastMeasurementTime = 0;
@@ -50,6 +68,8 @@ void RF_sensor_init(void) {
     currentRF.lastFrequencyTime = 0;
 
     RF_freq_init();
+    calibration_init();
+    calibration_sweep_init();
 
     log_register();
 }
@@ -70,39 +90,330 @@ void SWR_threshold_increment(void) {
 }
 
 /* ************************************************************************** */
+/*  Notes on ADC ranges
+
+    The ADC uses the Fixed Voltage Reference as its positive reference. The
+    calibration tables were made with whatever reference adc_init() sets up,
+    and that's the high range. At low power the forward voltage only uses
+    the bottom few bits of the ADC, so QRP readings are coarse and noisy.
+
+    If the FVR has a smaller setting available, that's the low range. Each
+    step down halves the reference, which multiplies the reading by two. The
+    lowest setting is 1.024v, so a 4.096v high range gets a 4x low range.
+
+    Readings from either range are published in high range counts, so
+    forwardVolts, reverseVolts, and the calibration tables don't know the
+    difference. The FVR gain is only accurate to a few percent, so the real
+    ratio between the ranges is learned every time measure_RF() switches
+    down, by measuring the same carrier in both ranges.
+
+    measure_RF() switches down when the forward and reverse averages both fit
+    comfortably in the low range, and switches up as soon as any low range
+    sample on either channel gets close to full scale. The reverse detector
+    gives about 2.5x the counts per watt of the forward one, so at a bad match,
+    like the start of a tune, it's the reverse channel that clips first. A
+    clipped measurement is thrown away and taken again in the high range. SSB
+    peaks would make it hunt between ranges, so after switching up, it stays up
+    for RANGE_HOLD_TIME.
+
+    While there's no RF, the ADC is parked in the low range. The presence
+    detector's noise floor, envelope, and thresholds, including the
+    LOW_POWER_CUTOFF minimum, are all kept in low range counts, so poll_RF()
+    hears a QRP carrier that used to be lost under the cutoff.
+
+    The high power path never pays for any of this. It only costs an extra
+    measurement when switching, and switching up only happens on a keydown.
+*/
+
+#define NUM_OF_SWR_SAMPLES 32
+
+#define FVR_1_024V 0b01
+
+// uS, on top of waiting for FVRCONbits.RDY
+#define FVR_SETTLE_TIME 25
+
+// switch down below this many low range counts, ~73% of full scale
+#define RANGE_DOWN_THRESHOLD 3000
+
+// switch up when any sample reaches this many low range counts, ~95%
+#define RANGE_UP_THRESHOLD 3900
+
+// don't switch back down for this many mS after switching up
+#define RANGE_HOLD_TIME 1000
+
+// only learn the gain from readings that have enough bits to compare
+#define RANGE_LEARNING_THRESHOLD 256
+
+// how quickly the learned range gain follows new measurements
+#define RANGE_GAIN_BETA 0.125f
+
+static uint8_t highRangeFVR;
+static uint8_t rangeShift; // 0 means there's no low range
+static float nominalRangeGain;
+static float rangeGain; // low range counts per high range count
+static system_time_t lastRangeUp;
+
+static void ADC_range_init(void) {
+    highRangeFVR = FVRCONbits.ADFVR;
+    rangeShift = 0;
+    if (highRangeFVR > FVR_1_024V) {
+        rangeShift = highRangeFVR - FVR_1_024V;
+    }
+
+    nominalRangeGain = (float)(1 << rangeShift);
+    rangeGain = nominalRangeGain;
+    lastRangeUp = 0;
+
+    currentRF.range = RANGE_HIGH;
+}
+
+void set_ADC_range(adc_range_t range) {
+    if (range == currentRF.range || rangeShift == 0) {
+        return;
+    }
+
+    if (range == RANGE_LOW) {
+        FVRCONbits.ADFVR = FVR_1_024V;
+    } else {
+        FVRCONbits.ADFVR = highRangeFVR;
+    }
+    currentRF.range = range;
+
+    // the FVR buffer needs a moment to settle after a gain change
+    while (!FVRCONbits.RDY) {
+        // wait
+    }
+    delay_us(FVR_SETTLE_TIME);
+
+    LOG_DEBUG({ printf("range: %u\r\n", range); });
+}
+
+float get_ADC_range_gain(void) {
+    if (currentRF.range == RANGE_LOW) {
+        return rangeGain;
+    }
+    return 1.0f;
+}
+
+bool fits_in_low_range(uint16_t forward, uint16_t reverse) {
+    if (rangeShift == 0) {
+        return false;
+    }
+    uint16_t limit = RANGE_DOWN_THRESHOLD >> rangeShift;
+    return (forward < limit) && (reverse < limit);
+}
+
+// both arguments are averages, in their own range's counts
+static void learn_range_gain(float highForward, float lowForward) {
+    if (highForward < RANGE_LEARNING_THRESHOLD) {
+        return;
+    }
+
+    float measured = lowForward / highForward;
+
+    // anything too far from the nominal gain means the carrier changed
+    float limit = nominalRangeGain / 8;
+    if (fabs(measured - nominalRangeGain) > limit) {
+        return;
+    }
+
+    rangeGain += RANGE_GAIN_BETA * (measured - rangeGain);
+}
+
+/* ************************************************************************** */
+/*  Notes on RF presence detection
+
+    poll_RF() is called every 5mS. It used to shift one present/absent bit per
+    poll into an 8 bit history, so keying took 40mS to be noticed, and any
+    single poll below the cutoff wiped the published readings.
+
+    Now each poll feeds an averaged forward reading, in low range counts, into
+    three streaming statistics:
+    - the noise floor, the average level while there's no RF
+    - the noise deviation, the average distance from the noise floor
+    - the envelope, which jumps up to any new peak and decays exponentially
+
+    RF becomes present after attackPolls consecutive readings above the attack
+    threshold. It becomes absent when the envelope decays below the release
+    threshold. The release threshold sits well below the attack threshold, and
+    the envelope rides over the gaps between CW elements and SSB syllables, so
+    the bargraphs and auto tune don't flicker.
+
+    Both thresholds float a number of deviations above the noise floor, but
+    never closer to zero than LOW_POWER_CUTOFF and half of it. The noise floor
+    only learns while RF is absent, from readings below the attack threshold.
+
+    The published readings are only cleared when RF is released. The presence
+    callback is told about every transition.
+*/
+
 #define NUMBER_OF_SAMPLES 8
 #define LOW_POWER_CUTOFF 15
 
-// TODO: get a 1W transmitter(FT-817?)
-bool check_for_RF(void) {
+// noise statistics are kept in 1/16ths of a count
+#define NOISE_FRACTION_BITS 4
+
+// the noise floor time constant, in polls, as a power of two
+#define NOISE_SHIFT 5
+
+// ignore RF leakage beyond this, something is wrong with the station
+#define MAX_NOISE_FLOOR (256 << NOISE_FRACTION_BITS)
+
+// keeps the attack threshold within MAX_NOISE_FLOOR + 8 * 32 counts
+#define MAX_NOISE_DEVIATION (32 << NOISE_FRACTION_BITS)
+
+RF_presence_config_t presenceConfig = {
+    .attackPolls = 2,       // 10mS
+    .releaseShift = 3,      // ~40mS time constant
+    .attackDeviations = 8,  //
+    .releaseDeviations = 4, //
+};
+
+static uint16_t noiseFloor;     // fixed point, see NOISE_FRACTION_BITS
+static uint16_t noiseDeviation; // fixed point, see NOISE_FRACTION_BITS
+static uint8_t attackCount;
+static void (*presenceCallback)(bool isPresent);
+
+void set_RF_presence_callback(void (*callback)(bool isPresent)) {
+    presenceCallback = callback;
+}
+
+void reset_RF_presence(void) {
+    noiseFloor = 0;
+    noiseDeviation = 0;
+    attackCount = 0;
+    currentRF.envelope = 0;
+    currentRF.isPresent = false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// the ADC range also moves the cutoff, so compare in low range counts
+static uint16_t low_range_counts(uint16_t counts) {
+    if (currentRF.range == RANGE_HIGH) {
+        return counts << rangeShift;
+    }
+    return counts;
+}
+
+static uint16_t calculate_threshold(uint8_t deviations, uint16_t minimum) {
+    uint32_t threshold = noiseFloor + (uint32_t)deviations * noiseDeviation;
+    threshold >>= NOISE_FRACTION_BITS;
+
+    if (threshold < minimum) {
+        return minimum;
+    }
+    return threshold;
+}
+
+uint16_t get_RF_attack_threshold(void) {
+    return calculate_threshold(presenceConfig.attackDeviations, LOW_POWER_CUTOFF);
+}
+
+uint16_t get_RF_release_threshold(void) {
+    return calculate_threshold(presenceConfig.releaseDeviations, LOW_POWER_CUTOFF / 2);
+}
+
+static uint16_t read_RF_level(void) {
     uint16_t sum = 0;
     for (uint8_t i = 0; i < NUMBER_OF_SAMPLES; i++) {
         sum += adc_read(ADC_FWD_PIN);
     }
 
-    uint16_t average = sum / NUMBER_OF_SAMPLES;
+    return low_range_counts(sum / NUMBER_OF_SAMPLES);
+}
+
+static void update_noise_floor(uint16_t level) {
+    // high range levels go up to 16380, which would wrap when shifted
+    if (level > (MAX_NOISE_FLOOR >> NOISE_FRACTION_BITS)) {
+        level = MAX_NOISE_FLOOR >> NOISE_FRACTION_BITS;
+    }
 
-    // enable this for reverse power calibration
-    // return true;
+    uint16_t sample = level << NOISE_FRACTION_BITS;
+    uint16_t deviation;
 
-    if (average >= LOW_POWER_CUTOFF) {
-        return true;
+    if (sample > noiseFloor) {
+        deviation = sample - noiseFloor;
+        noiseFloor += deviation >> NOISE_SHIFT;
+    } else {
+        deviation = noiseFloor - sample;
+        noiseFloor -= deviation >> NOISE_SHIFT;
     }
 
-    clear_currentRF();
-    return false;
+    if (noiseFloor > MAX_NOISE_FLOOR) {
+        noiseFloor = MAX_NOISE_FLOOR;
+    }
+
+    if (deviation > noiseDeviation) {
+        noiseDeviation += (deviation - noiseDeviation) >> NOISE_SHIFT;
+    } else {
+        noiseDeviation -= (noiseDeviation - deviation) >> NOISE_SHIFT;
+    }
+
+    if (noiseDeviation > MAX_NOISE_DEVIATION) {
+        noiseDeviation = MAX_NOISE_DEVIATION;
+    }
+}
+
+static void update_envelope(uint16_t level) {
+    if (level >= currentRF.envelope) {
+        currentRF.envelope = level;
+        return;
+    }
+
+    // always take at least one step, or small envelopes would never decay
+    uint16_t step = (currentRF.envelope - level) >> presenceConfig.releaseShift;
+    if (step == 0) {
+        step = 1;
+    }
+    currentRF.envelope -= step;
+}
+
+static void set_RF_presence(bool isPresent) {
+    currentRF.isPresent = isPresent;
+
+    if (!isPresent) {
+        clear_currentRF();
+
+        // listen for the next keydown with the most sensitive range
+        set_ADC_range(RANGE_LOW);
+    }
+
+    if (presenceCallback) {
+        presenceCallback(isPresent);
+    }
 }
 
+/* -------------------------------------------------------------------------- */
+
 void poll_RF(void) {
-    currentRF.history <<= 1;
-    currentRF.history |= check_for_RF();
+    uint16_t level = read_RF_level();
+    uint16_t attackThreshold = get_RF_attack_threshold();
+
+    update_envelope(level);
+
+    if (level >= attackThreshold) {
+        if (attackCount < presenceConfig.attackPolls) {
+            attackCount++;
+        }
+    } else {
+        attackCount = 0;
+    }
+
+    if (!currentRF.isPresent) {
+        // keep the noise statistics clear of anything that looks like a keydown
+        if (attackCount == 0) {
+            update_noise_floor(level);
+        }
 
-    if (currentRF.history == 0b11111111) {
-        currentRF.isPresent = true;
+        if (attackCount >= presenceConfig.attackPolls) {
+            set_RF_presence(true);
+        }
+        return;
     }
 
-    if (currentRF.history == 0b00000000) {
-        currentRF.isPresent = false;
+    if (currentRF.envelope < get_RF_release_threshold()) {
+        set_RF_presence(false);
     }
 }
 
@@ -179,24 +490,198 @@ bool wait_for_stable_RF_IIR(uint16_t timeoutDuration) {
 
 /* ************************************************************************** */
 
-#define NUM_OF_SWR_SAMPLES 32
+#define FORWARD_BURST_SAMPLES 4
+
+static uint16_t read_forward_burst(void) {
+    uint16_t peak = 0;
+    for (uint8_t i = 0; i < FORWARD_BURST_SAMPLES; i++) {
+        uint16_t sample = adc_read(ADC_FWD_PIN);
+        if (sample > peak) {
+            peak = sample;
+        }
+    }
+    return peak;
+}
+
+/*  A low range reading that's close to full scale might be hiding anything, so
+    the burst is repeated in the high range. An unclipped low range reading is
+    scaled by the nominal gain, which is within 1/8th of the real one.
+*/
+uint16_t read_forward_peak(void) {
+    uint16_t peak = read_forward_burst();
+
+    if (currentRF.range == RANGE_HIGH) {
+        return peak;
+    }
+    if (peak < RANGE_UP_THRESHOLD) {
+        return peak >> rangeShift;
+    }
+
+    // once is enough, the high range is as far as it goes
+    set_ADC_range(RANGE_HIGH);
+    lastRangeUp = get_current_time();
+    return read_forward_burst();
+}
+
+/* ************************************************************************** */
+/*  Notes on ADC sample statistics
+
+    Averages hide a lot. A measurement that was clipped at full scale, or taken
+    while the radio was still ramping up, has a perfectly reasonable looking
+    mean. adc_stats_t collects the mean, variance, extremes, and how many
+    samples were at full scale, in a single pass and with integer math.
+
+    The squares are taken relative to the first sample, the pilot, which keeps
+    them small enough to fit in 32 bits for any reasonably steady carrier. They
+    saturate instead of wrapping if the carrier is anything but steady.
+*/
+
+// samples at or above this are treated as clipped
+#define ADC_SATURATION_COUNTS 4088
+
+void reset_adc_stats(adc_stats_t *stats) {
+    stats->pilot = 0;
+    stats->sum = 0;
+    stats->sumOfSquares = 0;
+    stats->min = UINT16_MAX;
+    stats->max = 0;
+    stats->count = 0;
+    stats->saturated = 0;
+}
+
+void add_adc_sample(adc_stats_t *stats, uint16_t sample) {
+    if (stats->count == 0) {
+        stats->pilot = sample;
+    }
+    stats->count++;
+
+    if (sample < stats->min) {
+        stats->min = sample;
+    }
+    if (sample > stats->max) {
+        stats->max = sample;
+    }
+    if (sample >= ADC_SATURATION_COUNTS) {
+        stats->saturated++;
+    }
+
+    int16_t deviation = (int16_t)sample - stats->pilot;
+    uint32_t square = (int32_t)deviation * deviation;
+
+    stats->sum += deviation;
+    if (stats->sumOfSquares > UINT32_MAX - square) {
+        stats->sumOfSquares = UINT32_MAX;
+    } else {
+        stats->sumOfSquares += square;
+    }
+}
+
+uint32_t adc_stats_total(adc_stats_t *stats) {
+    return (int32_t)stats->pilot * stats->count + stats->sum;
+}
+
+float adc_stats_mean(adc_stats_t *stats) {
+    if (stats->count == 0) {
+        return 0.0f;
+    }
+    return stats->pilot + (float)stats->sum / stats->count;
+}
+
+float adc_stats_variance(adc_stats_t *stats) {
+    if (stats->count < 2) {
+        return 0.0f;
+    }
+
+    float sum = stats->sum;
+    float variance = ((float)stats->sumOfSquares - (sum * sum / stats->count)) / (stats->count - 1);
+
+    // rounding can leave a tiny negative on a perfectly steady input
+    if (variance < 0.0f) {
+        return 0.0f;
+    }
+    return variance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void sample_RF(adc_stats_t *forward, adc_stats_t *reverse) {
+    reset_adc_stats(forward);
+    reset_adc_stats(reverse);
+
+    for (uint8_t i = 0; i < NUM_OF_SWR_SAMPLES; i++) {
+        add_adc_sample(forward, adc_read(ADC_FWD_PIN));
+        add_adc_sample(reverse, adc_read(ADC_REV_PIN));
+    }
+}
+
+/*  Measurement quality is a rough 0-100 score of how much a measurement can be
+    trusted. Any clipped sample makes it 0. Otherwise it falls with the forward
+    channel's variance relative to its mean, and a carrier that's ramping or
+    fading during the measurement shows up the same way as noise does.
+
+    The reverse channel is left out, at a good match it's mostly noise anyway.
+*/
+
+// a 5% forward standard deviation halves the quality
+#define QUALITY_SCALE 400.0f
+
+static uint8_t calculate_measurement_quality(adc_stats_t *forward, adc_stats_t *reverse) {
+    if (forward->saturated || reverse->saturated) {
+        return 0;
+    }
+
+    float mean = adc_stats_mean(forward);
+    if (mean <= 0.0f) {
+        return 0;
+    }
+
+    float relativeVariance = adc_stats_variance(forward) / (mean * mean);
+    return (uint8_t)(100.0f / (1.0f + (relativeVariance * QUALITY_SCALE)));
+}
+
 void measure_RF(void) {
     currentRF.lastMeasurementTime = get_current_time();
-    uint32_t tempForward = 0;
-    uint32_t tempReverse = 0;
+    adc_stats_t forward;
+    adc_stats_t reverse;
 
     // Collect measurements
-    for (uint8_t i = 0; i < NUM_OF_SWR_SAMPLES; i++) {
-        tempForward += adc_read(ADC_FWD_PIN);
-        tempReverse += adc_read(ADC_REV_PIN);
+    sample_RF(&forward, &reverse);
+
+    if (currentRF.range == RANGE_LOW) {
+        // the low range clipped, measure again in the high range
+        if (forward.max >= RANGE_UP_THRESHOLD || reverse.max >= RANGE_UP_THRESHOLD) {
+            set_ADC_range(RANGE_HIGH);
+            lastRangeUp = get_current_time();
+            sample_RF(&forward, &reverse);
+        }
+    } else if (time_since(lastRangeUp) > RANGE_HOLD_TIME) {
+        float highForward = adc_stats_mean(&forward);
+        if (fits_in_low_range((uint16_t)highForward, (uint16_t)adc_stats_mean(&reverse))) {
+            set_ADC_range(RANGE_LOW);
+            sample_RF(&forward, &reverse);
+            learn_range_gain(highForward, adc_stats_mean(&forward));
+        }
     }
 
-    // publish the averaged forward and reverse
-    currentRF.forwardVolts = (float)tempForward / NUM_OF_SWR_SAMPLES;
-    currentRF.reverseVolts = (float)tempReverse / NUM_OF_SWR_SAMPLES;
+    // publish the averaged forward and reverse, in high range counts
+    float gain = get_ADC_range_gain();
+    currentRF.forwardVolts = adc_stats_mean(&forward) / gain;
+    currentRF.reverseVolts = adc_stats_mean(&reverse) / gain;
+
+    // publish the measurement quality
+    currentRF.forwardVariance = adc_stats_variance(&forward) / (gain * gain);
+    currentRF.reverseVariance = adc_stats_variance(&reverse) / (gain * gain);
+    currentRF.forwardMin = (uint16_t)(forward.min / gain);
+    currentRF.forwardMax = (uint16_t)(forward.max / gain);
+    currentRF.reverseMin = (uint16_t)(reverse.min / gain);
+    currentRF.reverseMax = (uint16_t)(reverse.max / gain);
+    currentRF.saturatedSamples = forward.saturated + reverse.saturated;
+    currentRF.sampleCount = forward.count;
+    currentRF.measurementQuality = calculate_measurement_quality(&forward, &reverse);
 
     // this bitshift improves the precision of the following integer division
-    tempReverse <<= 12;
+    uint32_t tempForward = adc_stats_total(&forward);
+    uint32_t tempReverse = adc_stats_total(&reverse) << 12;
     currentRF.matchQuality = (float)tempReverse / (float)tempForward;
 }
 
@@ -14,17 +14,31 @@ typedef struct {
     float reverseVolts; // reverse power in millivolts
     float matchQuality; // psuedo-SWR, calcuated from from raw forward/reverse
     system_time_t lastMeasurementTime;
+    // measurement quality
+    float forwardVariance; // in high range counts squared
+    float reverseVariance; // in high range counts squared
+    // sample extremes, in high range counts like the averages
+    uint16_t forwardMin;
+    uint16_t forwardMax;
+    uint16_t reverseMin;
+    uint16_t reverseMax;
+    uint8_t saturatedSamples;   // samples at ADC full scale, both channels
+    uint8_t sampleCount;        // samples per channel
+    uint8_t measurementQuality; // 0-100, see rf_sensor.c
     // calculated values
     float forwardWatts; // forward power in watts
     float reverseWatts; // reverse power in watts
     float swr;          // SWR, calculated from corrected wattages
     system_time_t lastCalculationTime;
     //
-    uint16_t frequency; // frequency in KHz
+    uint16_t frequency;          // frequency in KHz
+    uint8_t frequencyConfidence; // 0-100, percentage of accepted samples
     system_time_t lastFrequencyTime;
     //
     bool isPresent;
-    uint8_t history;
+    uint16_t envelope; // decaying peak forward level, in low range counts
+    //
+    uint8_t range; // adc_range_t, which ADC range the last measurement used
 } RF_power_t;
 
 // read-only: contains the most recent RF measurements
@@ -32,9 +46,8 @@ extern RF_power_t currentRF;
 
 /* ************************************************************************** */
 
-#define clear_RF_history() (currentRF.history = 0)
-#define RF_is_present() (currentRF.history == 0b11111111)
-#define RF_is_absent() (currentRF.history == 0b00000000)
+#define RF_is_present() (currentRF.isPresent)
+#define RF_is_absent() (!currentRF.isPresent)
 
 /* ************************************************************************** */
 
@@ -55,11 +68,30 @@ extern void SWR_threshold_increment(void);
 
 /* -------------------------------------------------------------------------- */
 
-// Call this periodically to update currentRF
-extern void poll_RF(void);
+// RF presence detection, see rf_sensor.c for details
+
+typedef struct {
+    uint8_t attackPolls;       // polls above the attack threshold to become present
+    uint8_t releaseShift;      // envelope decay time constant, in polls, as a power of two
+    uint8_t attackDeviations;  // attack threshold, in noise deviations above the floor
+    uint8_t releaseDeviations; // release threshold, in noise deviations above the floor
+} RF_presence_config_t;
+
+// the detector reads this on every poll, so it can be changed at any time
+extern RF_presence_config_t presenceConfig;
 
-// returns true is RF is detected, false if not
-extern bool check_for_RF(void);
+// <callback> is called with the new state every time RF appears or disappears
+extern void set_RF_presence_callback(void (*callback)(bool isPresent));
+
+// forget the noise statistics, and declare RF absent without a callback
+extern void reset_RF_presence(void);
+
+// current thresholds, in low range counts
+extern uint16_t get_RF_attack_threshold(void);
+extern uint16_t get_RF_release_threshold(void);
+
+// Call this every 5mS to update currentRF.isPresent
+extern void poll_RF(void);
 
 // tries to detect RF for timeoutDuration mS
 extern bool wait_for_stable_RF(uint16_t timeoutDuration);
@@ -67,12 +99,92 @@ extern bool wait_for_stable_RF(uint16_t timeoutDuration);
 // measures forward & reverse, and calculates matchQuality
 extern void measure_RF(void);
 
+/* -------------------------------------------------------------------------- */
+// ADC sample statistics, see rf_sensor.c for details
+
+typedef struct {
+    int16_t pilot;         // the first sample, deviations are relative to it
+    int32_t sum;           // sum of deviations from the pilot
+    uint32_t sumOfSquares; // sum of squared deviations, saturates
+    uint16_t min;
+    uint16_t max;
+    uint16_t count;
+    uint16_t saturated; // samples at or near ADC full scale
+} adc_stats_t;
+
+extern void reset_adc_stats(adc_stats_t *stats);
+extern void add_adc_sample(adc_stats_t *stats, uint16_t sample);
+
+// returns the plain sum of every sample
+extern uint32_t adc_stats_total(adc_stats_t *stats);
+
+extern float adc_stats_mean(adc_stats_t *stats);
+extern float adc_stats_variance(adc_stats_t *stats);
+
+/* -------------------------------------------------------------------------- */
+// ADC ranges, see rf_sensor.c for details
+
+typedef enum {
+    RANGE_HIGH, // the reference the calibration tables were made with
+    RANGE_LOW,  // a smaller reference, for more resolution at QRP levels
+} adc_range_t;
+
+// switch the ADC reference, does nothing if there's no low range
+extern void set_ADC_range(adc_range_t range);
+
+// returns how many current range counts make up one high range count
+extern float get_ADC_range_gain(void);
+
+// true if <forward> and <reverse>, in high range counts, both fit comfortably
+// in the low range
+extern bool fits_in_low_range(uint16_t forward, uint16_t reverse);
+
+// returns the peak of a short forward burst, in high range counts
+extern uint16_t read_forward_peak(void);
+
 // calculates forwardWatts & reverseWatts, and uses those to calculate SWR
 extern bool calculate_watts_and_swr(void);
 
 /* -------------------------------------------------------------------------- */
 
-// measures frequency
-extern void measure_frequency(void);
+// measures frequency, returns false if a valid frequency couldn't be found
+extern bool measure_frequency(void);
+
+/* -------------------------------------------------------------------------- */
+// Frequency counter calibration, see rf_freq.c for details
+
+typedef struct {
+    uint32_t magicNumber;   // reference frequency * measured period
+    uint16_t referenceTemp; // temperature indicator reading at calibration
+    int16_t tempco;         // ppm of magicNumber per temperature count
+} frequency_calibration_t;
+
+// read-only: the active frequency counter calibration
+extern frequency_calibration_t frequencyCalibration;
+
+// returns the temperature compensated period to frequency conversion factor
+extern uint32_t get_frequency_magic_number(void);
+
+// returns the averaged reading of the internal temperature indicator
+extern uint16_t read_temperature_indicator(void);
+
+// restore the calibration from EEPROM, or the default if none is saved
+extern void load_frequency_calibration(void);
+
+// commit the active calibration to EEPROM
+extern void save_frequency_calibration(void);
+
+// replace the active calibration with the hard coded default
+extern void reset_frequency_calibration(void);
+
+// derive and save the magic number from a carrier at referenceFrequency KHz
+extern bool calibrate_frequency(uint16_t referenceFrequency);
+
+// derive and save the temperature coefficient from a second calibration point,
+// fails unless calibrate_frequency() has already run
+extern bool calibrate_frequency_tempco(uint16_t referenceFrequency);
+
+// Prints the active calibration as "magic: <A>, refTemp: <B>, tempco: <C>"
+extern void print_frequency_calibration(void);
 
 #endif // _RF_SENSOR_H_
\ No newline at end of file
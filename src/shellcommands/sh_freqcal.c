@@ -0,0 +1,65 @@
+#include "os/serial_port.h"
+#include "os/shell/shell_command_processor.h"
+#include "rf_sensor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ************************************************************************** */
+
+static void print_calibration_result(bool success) {
+    if (!success) {
+        println("calibration failed");
+        return;
+    }
+
+    print_frequency_calibration();
+    println("");
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sh_freqcal(int argc, char **argv) {
+    switch (argc) {
+    case 1: // usage
+        print("usage: ");
+        println("\tfreqcal read");
+        println("\tfreqcal reset");
+        println("\tfreqcal run <KHz>");
+        println("\tfreqcal tempco <KHz>");
+        println("\t<KHz> is the frequency of the reference carrier.");
+        println("\trun tempco after run, once the unit has changed temperature.");
+        return;
+    case 2:
+        if (!strcmp(argv[1], "read")) { // freqcal read
+            print_frequency_calibration();
+            printf(", temp: %u\r\n", read_temperature_indicator());
+            return;
+        } else if (!strcmp(argv[1], "reset")) { // freqcal reset
+            reset_frequency_calibration();
+            save_frequency_calibration();
+            print_frequency_calibration();
+            println("");
+            return;
+        }
+        break;
+    case 3: {
+        uint16_t frequency = atoi(argv[2]);
+        if (frequency == 0) {
+            break;
+        }
+
+        if (!strcmp(argv[1], "run")) { // freqcal run <KHz>
+            print_calibration_result(calibrate_frequency(frequency));
+            return;
+        } else if (!strcmp(argv[1], "tempco")) { // freqcal tempco <KHz>
+            print_calibration_result(calibrate_frequency_tempco(frequency));
+            return;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    println("invalid arguments");
+    return;
+}
\ No newline at end of file
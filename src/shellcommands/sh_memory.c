@@ -1,6 +1,8 @@
+#include "nvm_log.h"
 #include "nvm_table.h"
 #include "os/serial_port.h"
 #include "shell_command_processor.h"
+#include "tuning_memories.h"
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -41,11 +43,55 @@ void sh_memory(int argc, char **argv) {
     case 1:
         println("usage: \tmemory write <slot> <data>");
         println("\tmemory read <slot>");
+        println("\tmemory stats");
+        println("\tmemory flush");
+        println("\tmemory plan [reset]");
         return;
+    case 2:
+        if (!strcmp(argv[1], "stats")) {
+            printf("cache: %lu hits / %lu reads\r\n", nvmTableStats.hits, nvmTableStats.reads);
+            printf("writes: %lu, block writes: %lu, erases: %lu\r\n", nvmTableStats.writes,
+                   nvmTableStats.blockWrites, nvmTableStats.erases);
+            printf("flush: %u mS last, %u mS max, %s\r\n", nvmTableStats.lastFlushTime,
+                   nvmTableStats.maxFlushTime, nvm_table_is_dirty() ? "dirty" : "clean");
+            printf("table: %u / %u slots used\r\n", count_used_memory_slots(),
+                   NUMBER_OF_TABLE_ENTRIES);
+            // systemFlags.antenna is 1 for ANT1, 0 for ANT2
+            printf("ANT1: %u hits / %u memory tunes\r\n", memoryHitStats[1].hits,
+                   memoryHitStats[1].attempts);
+            printf("ANT2: %u hits / %u memory tunes\r\n", memoryHitStats[0].hits,
+                   memoryHitStats[0].attempts);
+            printf("scrub: %u passes, %u repairs\r\n", memoryScrubStats.passes,
+                   memoryScrubStats.repairs);
+#ifdef MEMORY_LOG_ENABLED
+            printf("log: %u / %u records, %u compactions, %u forced\r\n", memory_log_length(),
+                   memory_log_capacity(), nvmTableStats.compactions,
+                   nvmTableStats.forcedCompactions);
+#endif
+            return;
+        }
+        if (!strcmp(argv[1], "flush")) {
+            nvm_table_flush();
+            return;
+        }
+        if (!strcmp(argv[1], "plan")) {
+            print_band_plan();
+            return;
+        }
+        break;
     case 3:
+        if (!strcmp(argv[1], "plan") && !strcmp(argv[2], "reset")) {
+            reset_band_plan();
+            printf("moved %u memories\r\n", bandPlanInfo.migrated);
+            return;
+        }
         if (!strcmp(argv[1], "read")) {
             // parse address
             uint16_t slot = atoi(argv[2]);
+            if (slot >= NUMBER_OF_TABLE_ENTRIES) {
+                println("invalid slot");
+                return;
+            }
 
             // read the memory at that address
             print_table_entry(nvm_table_read(slot));
@@ -58,6 +104,10 @@ void sh_memory(int argc, char **argv) {
         if (!strcmp(argv[1], "write")) {
             // parse address
             uint16_t slot = atoi(argv[2]);
+            if (slot >= NUMBER_OF_TABLE_ENTRIES) {
+                println("invalid slot");
+                return;
+            }
 
             // parse data
             int16_t data = decode_data(argv[3]);
@@ -71,7 +121,8 @@ void sh_memory(int argc, char **argv) {
             entry.contents[0] = data;
             entry.contents[1] = data;
 
-            nvm_table_write(slot, entry);
+            // keeps the occupancy map current
+            write_memory_entry(slot, entry);
 
             return;
         }
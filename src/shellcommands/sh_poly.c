@@ -11,20 +11,29 @@ void sh_poly(int argc, char **argv) {
     switch (argc) {
     case 1: // usage
         print("usage: ");
-        println("\tpoly write");
+        println("\tpoly write <serial>");
+        println("\tpoly info");
         println("\tpoly read <fwd|rev> <band>");
         println("\tpoly read all");
         println("\tpoly load <fwd|rev> <band> <A> <B> <C>");
         println("\t<A>, <B>, and <C> are IEEE 754 single precision floats.");
         return;
-    case 2: // poly write
-        if (!strcmp(argv[1], "write")) {
-            // TODO: commit uploaded polys to ROM?
-            // this requires additional work in calibration.c
+    case 2: // poly info
+        if (!strcmp(argv[1], "info")) {
+            if (calibrationInfo.isLoaded) {
+                printf("serial: %u, revision: %u\r\n", calibrationInfo.serial, calibrationInfo.revision);
+            } else {
+                println("using compiled defaults");
+            }
             return;
         }
         break;
-    case 3: // poly read all
+    case 3: // poly write <serial>, poly read all
+        if (!strcmp(argv[1], "write")) {
+            save_calibration(atoi(argv[2]));
+            printf("saved serial: %u, revision: %u\r\n", calibrationInfo.serial, calibrationInfo.revision);
+            return;
+        }
         if ((!strcmp(argv[1], "read")) && (!strcmp(argv[2], "all"))) {
             println("forwardCalibrationTable:");
             for (uint8_t band = 0; band < NUM_OF_BANDS; band++) {
@@ -82,6 +91,7 @@ void sh_poly(int argc, char **argv) {
             } else {
                 break;
             }
+            invalidate_calibration_cache();
 
             return;
         }
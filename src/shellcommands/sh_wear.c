@@ -0,0 +1,35 @@
+#include "os/serial_port.h"
+#include "os/shell/shell_command_processor.h"
+#include "relay_wear.h"
+#include <string.h>
+
+/* ************************************************************************** */
+
+void sh_wear(int argc, char **argv) {
+    switch (argc) {
+    case 1: // wear
+        print_relay_wear();
+        println("");
+        return;
+    case 2: // wear <save|reset>
+        if (!strcmp(argv[1], "save")) {
+            save_relay_wear();
+        } else if (!strcmp(argv[1], "reset")) {
+            reset_relay_wear();
+        } else {
+            break;
+        }
+
+        print_relay_wear();
+        println("");
+        return;
+
+    default:
+        break;
+    }
+
+    println("usage: \twear");
+    println("\twear save");
+    println("\twear reset");
+    return;
+}
\ No newline at end of file
@@ -58,6 +58,7 @@ extern void sh_adc(int argc, char **argv);
 extern void sh_bar(int argc, char **argv);
 extern void sh_eeprom(int argc, char **argv);
 extern void sh_flash(int argc, char **argv);
+extern void sh_freqcal(int argc, char **argv);
 extern void sh_memory(int argc, char **argv);
 extern void sh_poly(int argc, char **argv);
 extern void sh_relays(int argc, char **argv);
@@ -65,6 +66,7 @@ extern void sh_rfmon(int argc, char **argv);
 extern void sh_romedit(int argc, char **argv);
 extern void sh_tune(int argc, char **argv);
 extern void sh_usb(int argc, char **argv);
+extern void sh_wear(int argc, char **argv);
 #endif
 
 static void OS_init(void) {
@@ -82,6 +84,7 @@ static void OS_init(void) {
     shell_register_command(sh_bar, "bar");
     shell_register_command(sh_eeprom, "eeprom");
     shell_register_command(sh_flash, "flash");
+    shell_register_command(sh_freqcal, "freqcal");
     shell_register_command(sh_memory, "memory");
     shell_register_command(sh_poly, "poly");
     shell_register_command(sh_relays, "relays");
@@ -89,6 +92,7 @@ static void OS_init(void) {
     shell_register_command(sh_romedit, "romedit");
     shell_register_command(sh_tune, "tune");
     shell_register_command(sh_usb, "usb");
+    shell_register_command(sh_wear, "wear");
 #endif
 
     buttons_init(NUMBER_OF_BUTTONS, buttonFunctions);
@@ -0,0 +1,650 @@
+#include "band_plan.h"
+#include "crc.h"
+#include "nvm_log.h"
+#include "nvm_table.h"
+#include "os/logging.h"
+#include "peripherals/nonvolatile_memory.h"
+#include "tuning_memories.h"
+#include <stddef.h>
+#include <string.h>
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on the band plan
+
+    The memory table is split into frequency groups: by default one for each
+    Ham Band, widened by 200 KHz on each side to leave some wiggle room, and
+    one for each gap between them. Each group spreads its slots evenly across
+    its frequencies, so the bands get much finer slots than the gaps.
+
+    That's no good for commercial and MARS users, who operate in the gaps. So
+    the plan can be replaced at runtime with the set_band_plan JUDI command.
+    A plan is just a list of (end, slots) pairs. Each group starts where the
+    previous one ended, the first one starts at FREQ_MIN, the last one has to
+    end at FREQ_MAX, and the slots have to add up to NUMBER_OF_TABLE_ENTRIES.
+
+    A custom plan is kept in flash with a magic number, a version and a CRC,
+    right below the memory log. If it's missing or broken, the compiled
+    default is used. The default plan lives in bandplan.py, and cog compiles
+    it into defaultGroups[] below.
+
+    Installing a plan saves it first, then moves every stored memory to the
+    slot its frequency has under the new plan. See migrate_memories(). A
+    power loss in the middle of that leaves some memories in their old slots,
+    where the neighbor search in memory_tune() can still find most of them.
+*/
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on the slot lookup
+
+    find_memory_slot() used to walk the groups until it found the right one,
+    and then do a 32 bit multiply and divide to place the frequency inside it.
+    Now the frequency is split into 256 KHz buckets, and a bucket table holds
+    the group at the bottom of each bucket. A bucket rarely holds the start of
+    another group, so that's usually the right group, or the next one.
+
+    Inside the group, the divide is replaced by a Q24 scale factor that's
+    rounded up. For the default plan that gives exactly the same answer as the
+    division for every frequency. Very wide groups with very few slots can come
+    out one slot high at the top of the group, so the slot is clamped to the
+    group.
+
+    Neither table is kept in RAM, together they'd take 567 bytes. The default
+    plan's tables are compiled in by cog, from bandplan.py. A custom plan's
+    tables are built once by build_slot_tables(), into the flash blocks right
+    after its record. Lookups read whichever set is active with
+    flash_read_byte(), which is about 15 table reads instead of a divide. The
+    active plan itself is read back from flash with read_band_plan() when it's
+    needed, only bandPlanInfo stays in RAM.
+
+    calibration/check_slot_map.py mirrors build_slot_tables(), checks every
+    frequency from 1 to 55000 KHz against the plain division, and checks that
+    the generated tables match bandplan.py.
+*/
+
+#define BUCKET_SHIFT 8
+#define NUMBER_OF_BUCKETS ((FREQ_MAX >> BUCKET_SHIFT) + 1)
+
+#define SCALE_SHIFT 24
+
+// the field order is the flash layout, bandplan.py generates it the same way
+typedef struct {
+    uint16_t start;
+    uint16_t firstSlot;
+    uint16_t lastSlot;
+    uint32_t scale;
+    uint8_t slotWidth; // KHz
+} slot_group_t;
+
+band_plan_info_t bandPlanInfo;
+
+/* -------------------------------------------------------------------------- */
+
+/* [[[cog
+    import bandplan
+    cog.outl(bandplan.default_plan())
+]]] */
+#define NUMBER_OF_DEFAULT_GROUPS 21
+
+const band_plan_group_t defaultGroups[NUMBER_OF_DEFAULT_GROUPS] = {
+    // {end, number of slots}
+    {1600, 200},  // (00001 KHz -> 01600 KHz)
+    {2200, 100},  // (01600 KHz -> 02200 KHz)
+    {3300, 200},  // (02200 KHz -> 03300 KHz)
+    {4200, 200},  // (03300 KHz -> 04200 KHz)
+    {6800, 200},  // (04200 KHz -> 06800 KHz)
+    {7500, 100},  // (06800 KHz -> 07500 KHz)
+    {9810, 200},  // (07500 KHz -> 09810 KHz)
+    {10350, 100}, // (09810 KHz -> 10350 KHz)
+    {13800, 200}, // (10350 KHz -> 13800 KHz)
+    {14550, 100}, // (13800 KHz -> 14550 KHz)
+    {17868, 200}, // (14550 KHz -> 17868 KHz)
+    {18368, 100}, // (17868 KHz -> 18368 KHz)
+    {20800, 200}, // (18368 KHz -> 20800 KHz)
+    {21650, 200}, // (20800 KHz -> 21650 KHz)
+    {24690, 200}, // (21650 KHz -> 24690 KHz)
+    {25190, 100}, // (24690 KHz -> 25190 KHz)
+    {27800, 200}, // (25190 KHz -> 27800 KHz)
+    {29900, 200}, // (27800 KHz -> 29900 KHz)
+    {49800, 200}, // (29900 KHz -> 49800 KHz)
+    {54200, 200}, // (49800 KHz -> 54200 KHz)
+    {55000, 100}, // (54200 KHz -> 55000 KHz)
+};
+// [[[end]]]
+
+/* [[[cog
+    import bandplan
+    cog.outl(bandplan.default_slot_tables())
+]]] */
+const slot_group_t defaultSlotGroups[NUMBER_OF_DEFAULT_GROUPS] = {
+    // {start, firstSlot, lastSlot, scale, slotWidth}
+    {1, 0, 199, 2098464UL, 7},
+    {1600, 200, 299, 2796203UL, 6},
+    {2200, 300, 499, 3050403UL, 5},
+    {3300, 500, 699, 3728271UL, 4},
+    {4200, 700, 899, 1290556UL, 13},
+    {6800, 900, 999, 2396746UL, 7},
+    {7500, 1000, 1199, 1452573UL, 11},
+    {9810, 1200, 1299, 3106892UL, 5},
+    {10350, 1300, 1499, 972593UL, 17},
+    {13800, 1500, 1599, 2236963UL, 7},
+    {14550, 1600, 1799, 1011285UL, 16},
+    {17868, 1800, 1899, 3355444UL, 5},
+    {18368, 1900, 2099, 1379706UL, 12},
+    {20800, 2100, 2299, 3947581UL, 4},
+    {21650, 2300, 2499, 1103765UL, 15},
+    {24690, 2500, 2599, 3355444UL, 5},
+    {25190, 2600, 2799, 1285611UL, 13},
+    {27800, 2800, 2999, 1597831UL, 10},
+    {29900, 3000, 3199, 168616UL, 99},
+    {49800, 3200, 3399, 762601UL, 22},
+    {54200, 3400, 3499, 2097152UL, 8},
+};
+
+const uint8_t defaultSlotBuckets[NUMBER_OF_BUCKETS] = {
+    0, 0, 0, 0, 0, 0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3,
+    3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 7, 7, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 9, 9, 9, 10, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 10, 10, 10, 11, 11, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 13, 13, 13, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 15, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17,
+    17, 17, 17, 17, 17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19,
+    19, 19, 19, 19, 20, 20, 20,
+};
+// [[[end]]]
+
+/* -------------------------------------------------------------------------- */
+
+#define BAND_PLAN_MAGIC 0xBA7D
+#define BAND_PLAN_FORMAT_VERSION 1
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    band_plan_t plan;
+    uint16_t tablesCrc; // crc16 of the slot tables that follow the record
+    uint16_t crc;       // must be last, covers everything above it
+} band_plan_record_t;
+
+#define BAND_PLAN_CRC_LENGTH (sizeof(band_plan_record_t) - sizeof(uint16_t))
+
+// the record gets the first block, the slot tables start on the next one
+#define SLOT_GROUPS_OFFSET FLASH_ERASE_BLOCKSIZE
+#define SLOT_BUCKETS_OFFSET (SLOT_GROUPS_OFFSET + MAX_BAND_PLAN_GROUPS * sizeof(slot_group_t))
+#define SLOT_TABLES_LENGTH (MAX_BAND_PLAN_GROUPS * sizeof(slot_group_t) + NUMBER_OF_BUCKETS)
+
+// one block for the record, five for 32 groups of 11 bytes and 215 buckets
+#define BAND_PLAN_BLOCKS 6
+#define BAND_PLAN_SIZE (BAND_PLAN_BLOCKS * FLASH_ERASE_BLOCKSIZE)
+
+// below the memory log, which is below calibration.c's region
+#define BAND_PLAN_LOCATION (MEMORY_LOG_LOCATION - BAND_PLAN_SIZE)
+
+// reserve the region, same as nvmTable[]
+const uint8_t bandPlanRegion[BAND_PLAN_SIZE] __at(BAND_PLAN_LOCATION) = {};
+
+/* ************************************************************************** */
+
+static void read_flash(NVM_address_t address, void *destination, uint8_t length) {
+    uint8_t *bytes = (uint8_t *)destination;
+
+    for (uint8_t i = 0; i < length; i++) {
+        bytes[i] = flash_read_byte(address + i);
+    }
+}
+
+static NVM_address_t slot_group_address(uint8_t group) {
+    if (bandPlanInfo.isCustom) {
+        return (NVM_address_t)&bandPlanRegion[SLOT_GROUPS_OFFSET] + group * sizeof(slot_group_t);
+    }
+    return (NVM_address_t)&defaultSlotGroups[group];
+}
+
+static NVM_address_t slot_bucket_address(uint8_t bucket) {
+    if (bandPlanInfo.isCustom) {
+        return (NVM_address_t)&bandPlanRegion[SLOT_BUCKETS_OFFSET] + bucket;
+    }
+    return (NVM_address_t)&defaultSlotBuckets[bucket];
+}
+
+static uint16_t read_group_start(uint8_t group) {
+    uint16_t start;
+    read_flash(slot_group_address(group), &start, sizeof(uint16_t));
+    return start;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// fills the erase blocks after the plan record one buffer at a time
+typedef struct {
+    NVM_address_t address; // of the block being filled
+    uint8_t length;        // bytes in the buffer so far
+    uint16_t crc;          // of everything appended so far
+    uint8_t buffer[FLASH_BUFFER_SIZE];
+} table_writer_t;
+
+static void flush_table_writer(table_writer_t *writer) {
+    memset(&writer->buffer[writer->length], 0xff, FLASH_BUFFER_SIZE - writer->length);
+
+    flash_erase_block(writer->address);
+    flash_write_block(writer->address, writer->buffer);
+
+    writer->address += FLASH_BUFFER_SIZE;
+    writer->length = 0;
+}
+
+static void append_to_tables(table_writer_t *writer, void *data, uint8_t length) {
+    uint8_t *bytes = (uint8_t *)data;
+
+    for (uint8_t i = 0; i < length; i++) {
+        writer->crc = crc16_update(writer->crc, bytes[i]);
+        writer->buffer[writer->length++] = bytes[i];
+
+        if (writer->length == FLASH_BUFFER_SIZE) {
+            flush_table_writer(writer);
+        }
+    }
+}
+
+// writes the slot tables for <plan> into flash, using writer->buffer
+static void build_slot_tables(table_writer_t *writer, band_plan_t *plan) {
+    writer->address = (NVM_address_t)&bandPlanRegion[SLOT_GROUPS_OFFSET];
+    writer->length = 0;
+    writer->crc = CRC16_INITIAL_VALUE;
+
+    uint16_t start = FREQ_MIN;
+    uint16_t firstSlot = 0;
+
+    // unused groups are written as zeros, so the buckets have a fixed offset
+    for (uint8_t i = 0; i < MAX_BAND_PLAN_GROUPS; i++) {
+        slot_group_t slotGroup;
+        memset(&slotGroup, 0, sizeof(slot_group_t));
+
+        if (i < plan->numOfGroups) {
+            band_plan_group_t *group = &plan->groups[i];
+            uint16_t width = group->end - start;
+
+            slotGroup.start = start;
+            slotGroup.firstSlot = firstSlot;
+            slotGroup.lastSlot = firstSlot + group->slots - 1;
+
+            // rounded up, see the notes above
+            slotGroup.scale = (((uint32_t)group->slots << SCALE_SHIFT) + width - 1) / width;
+
+            uint16_t slotWidth = width / group->slots;
+            if (slotWidth == 0) {
+                slotWidth = 1;
+            }
+            if (slotWidth > UINT8_MAX) {
+                slotWidth = UINT8_MAX;
+            }
+            slotGroup.slotWidth = slotWidth;
+
+            start = group->end;
+            firstSlot += group->slots;
+        }
+
+        append_to_tables(writer, &slotGroup, sizeof(slot_group_t));
+    }
+
+    // the next group starts where this one ends
+    uint8_t group = 0;
+    for (uint16_t bucket = 0; bucket < NUMBER_OF_BUCKETS; bucket++) {
+        uint16_t bottom = bucket << BUCKET_SHIFT;
+        while (group + 1 < plan->numOfGroups && bottom >= plan->groups[group].end) {
+            group++;
+        }
+        append_to_tables(writer, &group, sizeof(uint8_t));
+    }
+
+    if (writer->length) {
+        flush_table_writer(writer);
+    }
+}
+
+static uint16_t saved_tables_crc(void) {
+    NVM_address_t address = (NVM_address_t)&bandPlanRegion[SLOT_GROUPS_OFFSET];
+    uint16_t crc = CRC16_INITIAL_VALUE;
+
+    for (uint16_t i = 0; i < SLOT_TABLES_LENGTH; i++) {
+        crc = crc16_update(crc, flash_read_byte(address + i));
+    }
+
+    return crc;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void read_default_plan(band_plan_t *plan) {
+    memset(plan, 0, sizeof(band_plan_t));
+    plan->numOfGroups = NUMBER_OF_DEFAULT_GROUPS;
+    memcpy(plan->groups, defaultGroups, sizeof(defaultGroups));
+}
+
+static void activate_plan(band_plan_t *plan, bool isCustom) {
+    bandPlanInfo.numOfGroups = plan->numOfGroups;
+    bandPlanInfo.isCustom = isCustom;
+    bandPlanInfo.crc = crc16(plan, sizeof(band_plan_t));
+}
+
+static bool load_saved_plan(void) {
+    band_plan_record_t record;
+    read_flash((NVM_address_t)&bandPlanRegion[0], &record, sizeof(band_plan_record_t));
+
+    if (record.magic != BAND_PLAN_MAGIC || record.version != BAND_PLAN_FORMAT_VERSION) {
+        LOG_INFO({ println("no saved band plan, using the default"); });
+        return false;
+    }
+
+    if (record.crc != crc16(&record, BAND_PLAN_CRC_LENGTH) || !band_plan_is_valid(&record.plan)) {
+        LOG_ERROR({ println("saved band plan is broken, using the default"); });
+        return false;
+    }
+
+    if (record.tablesCrc != saved_tables_crc()) {
+        LOG_ERROR({ println("saved slot tables are broken, using the default"); });
+        return false;
+    }
+
+    activate_plan(&record.plan, true);
+
+    LOG_INFO({ printf("loaded a %u group band plan\r\n", record.plan.numOfGroups); });
+    return true;
+}
+
+void band_plan_init(void) {
+    bandPlanInfo.migrated = 0;
+
+    log_register();
+
+    if (!load_saved_plan()) {
+        band_plan_t plan;
+        read_default_plan(&plan);
+        activate_plan(&plan, false);
+    }
+}
+
+void read_band_plan(band_plan_t *plan) {
+    if (bandPlanInfo.isCustom) {
+        NVM_address_t address = (NVM_address_t)&bandPlanRegion[0];
+        read_flash(address + offsetof(band_plan_record_t, plan), plan, sizeof(band_plan_t));
+    } else {
+        read_default_plan(plan);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool band_plan_is_valid(band_plan_t *plan) {
+    if (plan->numOfGroups == 0 || plan->numOfGroups > MAX_BAND_PLAN_GROUPS) {
+        return false;
+    }
+
+    uint16_t start = FREQ_MIN;
+    uint16_t totalSlots = 0;
+    for (uint8_t i = 0; i < plan->numOfGroups; i++) {
+        band_plan_group_t *group = &plan->groups[i];
+        if (group->end <= start || group->slots == 0) {
+            return false;
+        }
+        start = group->end;
+        totalSlots += group->slots;
+    }
+
+    return (start == FREQ_MAX) && (totalSlots == NUMBER_OF_TABLE_ENTRIES);
+}
+
+/*  The record is erased first and written last, so a power loss part way
+    through leaves no saved plan at all, instead of a plan whose tables are
+    half built. The default plan just erases the record.
+*/
+static void save_plan(band_plan_t *plan, bool isCustom) {
+    NVM_address_t address = (NVM_address_t)&bandPlanRegion[0];
+    flash_erase_block(address);
+
+    if (!isCustom) {
+        return;
+    }
+
+    // the writer's buffer is reused for the record, to keep the stack small
+    table_writer_t writer;
+    build_slot_tables(&writer, plan);
+
+    band_plan_record_t *record = (band_plan_record_t *)writer.buffer;
+    memset(writer.buffer, 0xff, FLASH_BUFFER_SIZE);
+    record->magic = BAND_PLAN_MAGIC;
+    record->version = BAND_PLAN_FORMAT_VERSION;
+    record->plan = *plan;
+    record->tablesCrc = writer.crc;
+    record->crc = crc16(record, BAND_PLAN_CRC_LENGTH);
+
+    flash_write_block(address, writer.buffer);
+}
+
+static void change_plan(band_plan_t *plan, bool isCustom) {
+    // the old plan is needed to find where the old slots were
+    band_plan_t oldPlan;
+    read_band_plan(&oldPlan);
+
+    save_plan(plan, isCustom);
+    activate_plan(plan, isCustom);
+
+    bandPlanInfo.migrated = migrate_memories(&oldPlan);
+    flush_memories();
+
+    LOG_INFO({
+        printf("installed a %u group band plan, moved %u memories\r\n", plan->numOfGroups,
+               bandPlanInfo.migrated);
+    });
+}
+
+bool install_band_plan(band_plan_t *plan) {
+    if (!band_plan_is_valid(plan)) {
+        LOG_WARN({ println("rejected band plan"); });
+        return false;
+    }
+
+    // unused groups are cleared so the crc only depends on the plan
+    for (uint8_t i = plan->numOfGroups; i < MAX_BAND_PLAN_GROUPS; i++) {
+        plan->groups[i].end = 0;
+        plan->groups[i].slots = 0;
+    }
+
+    change_plan(plan, true);
+    return true;
+}
+
+void reset_band_plan(void) {
+    band_plan_t plan;
+    read_default_plan(&plan);
+
+    change_plan(&plan, false);
+}
+
+/* ************************************************************************** */
+
+static uint8_t find_group(uint16_t frequency) {
+    uint8_t group = flash_read_byte(slot_bucket_address(frequency >> BUCKET_SHIFT));
+    while (group + 1 < bandPlanInfo.numOfGroups && frequency >= read_group_start(group + 1)) {
+        group++;
+    }
+    return group;
+}
+
+// convert a frequency into a valid memory slot
+uint16_t find_memory_slot(uint16_t frequency) {
+    LOG_TRACE({ println("find_memory_slot"); });
+
+    LOG_DEBUG({ printf("frequency: %u KHz\r\n", frequency); });
+    if (frequency == UINT16_MAX || frequency == 0) {
+        LOG_ERROR({ println("invalid frequency"); });
+        return 0;
+    }
+
+    // frequency is off the top of the map, so use the last slot
+    if (frequency >= FREQ_MAX) {
+        return NUMBER_OF_TABLE_ENTRIES - 1;
+    }
+
+    slot_group_t slotGroup;
+    read_flash(slot_group_address(find_group(frequency)), &slotGroup, sizeof(slot_group_t));
+
+    uint32_t offset = (uint32_t)(frequency - slotGroup.start) * slotGroup.scale;
+    uint16_t slot = slotGroup.firstSlot + (uint16_t)(offset >> SCALE_SHIFT);
+
+    if (slot > slotGroup.lastSlot) {
+        slot = slotGroup.lastSlot;
+    }
+
+    LOG_DEBUG({ printf("slot: %u\r\n", slot); });
+
+    return slot;
+}
+
+// return the width, in KHz, of the memory slot that contains frequency
+uint16_t find_slot_width(uint16_t frequency) {
+    // frequency is off the top of the map, so be as picky as possible
+    if (frequency >= FREQ_MAX || frequency == 0) {
+        return 1;
+    }
+
+    NVM_address_t address = slot_group_address(find_group(frequency));
+    return flash_read_byte(address + offsetof(slot_group_t, slotWidth));
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on the original mapping
+
+    Firmware from before the band plan used the same groups as the default
+    plan, but it spread each group's frequencies across the slot count of the
+    group after it. A group with 200 slots followed by one with 100 only used
+    its first 100 slots. A group with 100 slots followed by one with 200 ran
+    100 slots into the next group's slots. The last group read its slot count
+    from past the end of the table.
+
+    So 600 slots were written by two groups: the top of a band, and the
+    bottom of the gap above it. Nothing in a memory from back then says which
+    one it came from, so those slots are taken as the band's, the lower group,
+    because that's where most of these memories get made. A gap memory taken
+    for a band memory is tested, fails, and gets replaced by the full tune
+    that follows. The other 800 slots, the last group's among them, were
+    never used, or can't be traced back, and those give 0.
+
+    calibration/check_slot_map.py checks that every slot the original mapping
+    used gives back a frequency that maps to that slot again.
+*/
+
+static uint16_t find_original_slot_frequency(uint16_t slot) {
+    uint16_t start = FREQ_MIN;
+    uint16_t firstSlot = 0;
+
+    for (uint8_t i = 0; i + 1 < NUMBER_OF_DEFAULT_GROUPS; i++) {
+        // the next group's slot count, see the notes above
+        uint8_t slots = defaultGroups[i + 1].slots;
+
+        if (slot >= firstSlot && slot < firstSlot + slots) {
+            uint32_t width = defaultGroups[i].end - start;
+            uint32_t offset = ((uint32_t)(slot - firstSlot) * 2 + 1) * width;
+            return start + (uint16_t)(offset / (2 * slots));
+        }
+
+        start = defaultGroups[i].end;
+        firstSlot += defaultGroups[i].slots;
+    }
+
+    return 0;
+}
+
+// this walks the groups, it's only used when migrating memories
+uint16_t find_slot_frequency(band_plan_t *plan, uint16_t slot) {
+    if (!plan) {
+        return find_original_slot_frequency(slot);
+    }
+
+    uint16_t start = FREQ_MIN;
+    uint16_t firstSlot = 0;
+
+    for (uint8_t i = 0; i < plan->numOfGroups; i++) {
+        band_plan_group_t *group = &plan->groups[i];
+
+        if (slot < firstSlot + group->slots) {
+            uint32_t width = group->end - start;
+            uint32_t offset = ((uint32_t)(slot - firstSlot) * 2 + 1) * width;
+            return start + (uint16_t)(offset / (2 * group->slots));
+        }
+
+        start = group->end;
+        firstSlot += group->slots;
+    }
+
+    return FREQ_MAX - 1;
+}
+
+/* ************************************************************************** */
+
+void print_band_plan(void) {
+    band_plan_t plan;
+    read_band_plan(&plan);
+
+    uint16_t start = FREQ_MIN;
+    uint16_t totalSlots = 0;
+
+    println("---------------------------------------------------------------");
+    println("## | (start freq -> end freq) | width     | slots | width/slot");
+    println("---|--------------------------|-----------|-------|------------");
+
+    for (uint8_t i = 0; i < plan.numOfGroups; i++) {
+        band_plan_group_t *group = &plan.groups[i];
+        uint16_t groupWidth = group->end - start;
+        totalSlots += group->slots;
+
+        printf("%02u", i);
+        printf(" | (%05u KHz -> %05u KHz)", start, group->end);
+        printf(" | %05u KHz", groupWidth);
+        printf(" |  %u ", group->slots);
+        printf(" | %2u KHz/slot", (groupWidth / group->slots));
+        println("");
+
+        start = group->end;
+    }
+
+    println("---------------------------------------------------------------");
+    printf("totalSlots: %u, %s plan\r\n", totalSlots, bandPlanInfo.isCustom ? "custom" : "default");
+    println("---------------------------------------------------------------");
+}
+
+/* print_band_plan() outputs, with the default plan:
+---------------------------------------------------------------
+## | (start freq -> end freq) | width     | slots | width/slot
+---|--------------------------|-----------|-------|------------
+00 | (00001 KHz -> 01600 KHz) | 01599 KHz |  200  |  7 KHz/slot
+01 | (01600 KHz -> 02200 KHz) | 00600 KHz |  100  |  6 KHz/slot
+02 | (02200 KHz -> 03300 KHz) | 01100 KHz |  200  |  5 KHz/slot
+03 | (03300 KHz -> 04200 KHz) | 00900 KHz |  200  |  4 KHz/slot
+04 | (04200 KHz -> 06800 KHz) | 02600 KHz |  200  | 13 KHz/slot
+05 | (06800 KHz -> 07500 KHz) | 00700 KHz |  100  |  7 KHz/slot
+06 | (07500 KHz -> 09810 KHz) | 02310 KHz |  200  | 11 KHz/slot
+07 | (09810 KHz -> 10350 KHz) | 00540 KHz |  100  |  5 KHz/slot
+08 | (10350 KHz -> 13800 KHz) | 03450 KHz |  200  | 17 KHz/slot
+09 | (13800 KHz -> 14550 KHz) | 00750 KHz |  100  |  7 KHz/slot
+10 | (14550 KHz -> 17868 KHz) | 03318 KHz |  200  | 16 KHz/slot
+11 | (17868 KHz -> 18368 KHz) | 00500 KHz |  100  |  5 KHz/slot
+12 | (18368 KHz -> 20800 KHz) | 02432 KHz |  200  | 12 KHz/slot
+13 | (20800 KHz -> 21650 KHz) | 00850 KHz |  200  |  4 KHz/slot
+14 | (21650 KHz -> 24690 KHz) | 03040 KHz |  200  | 15 KHz/slot
+15 | (24690 KHz -> 25190 KHz) | 00500 KHz |  100  |  5 KHz/slot
+16 | (25190 KHz -> 27800 KHz) | 02610 KHz |  200  | 13 KHz/slot
+17 | (27800 KHz -> 29900 KHz) | 02100 KHz |  200  | 10 KHz/slot
+18 | (29900 KHz -> 49800 KHz) | 19900 KHz |  200  | 99 KHz/slot
+19 | (49800 KHz -> 54200 KHz) | 04400 KHz |  200  | 22 KHz/slot
+20 | (54200 KHz -> 55000 KHz) | 00800 KHz |  100  |  8 KHz/slot
+---------------------------------------------------------------
+totalSlots: 3500, default plan
+---------------------------------------------------------------
+*/
\ No newline at end of file
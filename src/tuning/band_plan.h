@@ -0,0 +1,78 @@
+#ifndef _BAND_PLAN_H_
+#define _BAND_PLAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+/*  Memory table band plan
+
+    The band plan splits the frequency range into groups, and gives each group
+    a number of memory slots. See the notes in band_plan.c.
+
+    //! Watch out!
+    These frequency numbers are in KHz instead of Hz or MHz!
+*/
+
+#define FREQ_MIN 1U
+#define FREQ_MAX 55000U
+
+#define MAX_BAND_PLAN_GROUPS 32
+
+typedef struct {
+    uint16_t end;  // exclusive, the next group starts here
+    uint8_t slots; // at least 1, and the plan has to add up to 3500
+} band_plan_group_t;
+
+typedef struct {
+    uint8_t numOfGroups;
+    band_plan_group_t groups[MAX_BAND_PLAN_GROUPS];
+} band_plan_t;
+
+typedef struct {
+    uint8_t numOfGroups; // in the active plan
+    bool isCustom;       // false if the active plan is the compiled default
+    uint16_t crc;        // crc16 of the active plan, so a host can check its upload
+    uint16_t migrated;   // memories moved by the last plan change
+} band_plan_info_t;
+
+// read-only
+extern band_plan_info_t bandPlanInfo;
+
+/* ************************************************************************** */
+
+// setup, loads the saved plan or falls back to the default
+extern void band_plan_init(void);
+
+// true if <plan> covers FREQ_MIN to FREQ_MAX with exactly 3500 slots
+extern bool band_plan_is_valid(band_plan_t *plan);
+
+// saves <plan> to flash and moves the stored memories to match it
+// returns false, and changes nothing, if the plan isn't valid
+extern bool install_band_plan(band_plan_t *plan);
+
+// goes back to the compiled default plan
+extern void reset_band_plan(void);
+
+// copies the active plan out of flash into <plan>
+extern void read_band_plan(band_plan_t *plan);
+
+/* -------------------------------------------------------------------------- */
+
+// Return the memory slot associated with the given frequency
+extern uint16_t find_memory_slot(uint16_t frequency);
+
+// Return the width, in KHz, of the memory slot associated with the frequency
+extern uint16_t find_slot_width(uint16_t frequency);
+
+// Return the center frequency of <slot> under <plan>
+// a NULL <plan> is the mapping from before the band plan, which gives 0 for
+// the slots it never used, see band_plan.c
+extern uint16_t find_slot_frequency(band_plan_t *plan, uint16_t slot);
+
+/* -------------------------------------------------------------------------- */
+
+// Prints the active plan as a table, one group per row
+extern void print_band_plan(void);
+
+#endif // _BAND_PLAN_H_
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "frequency_tracker.h"
+#include "flags.h"
+#include "os/logging.h"
+#include "relays.h"
+#include "rf_sensor.h"
+#include "tuning_memories.h"
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on frequency tracking
+
+    Auto mode normally waits for the SWR to cross the threshold before it does
+    anything. After a QSY, that means the operator is transmitting into a bad
+    match until the next bargraph update notices.
+
+    The frequency tracker remembers which memory slot the current frequency
+    belongs to. When an idle frequency measurement lands in a different slot,
+    and a second measurement confirms it, the tracker recalls the closest
+    memory for the new slot and publishes it right away. If there's no memory
+    nearby, it does nothing and the SWR based auto tune gets its turn.
+
+    Measuring frequency is expensive, up to ~60mS at 1.8MHz. While the
+    frequency stays put, the tracker doubles the time between measurements, up
+    to MAX_TRACKING_PERIOD. Any change, or losing RF, drops it back to
+    MIN_TRACKING_PERIOD.
+*/
+
+#define MIN_TRACKING_PERIOD 250
+#define MAX_TRACKING_PERIOD 4000
+
+// measurements below this confidence are ignored
+#define MIN_TRACKING_CONFIDENCE 75
+
+// how far away from the new slot to look for a memory
+#define PRESTAGE_SEARCH_RADIUS 2
+
+#define NO_SLOT UINT16_MAX
+
+static uint16_t trackingPeriod;
+static uint16_t trackedSlot;
+static uint16_t candidateSlot;
+
+/* -------------------------------------------------------------------------- */
+
+void frequency_tracker_init(void) {
+    trackingPeriod = MIN_TRACKING_PERIOD;
+    trackedSlot = NO_SLOT;
+    candidateSlot = NO_SLOT;
+
+    log_register();
+}
+
+/* ************************************************************************** */
+
+uint16_t get_frequency_tracking_period(void) { return trackingPeriod; }
+
+void reset_frequency_tracker(void) {
+    trackingPeriod = MIN_TRACKING_PERIOD;
+    candidateSlot = NO_SLOT;
+}
+
+static void slow_down(void) {
+    if (trackingPeriod < MAX_TRACKING_PERIOD) {
+        trackingPeriod <<= 1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+// publish the closest memory to <slot>, returns true if one was found
+static bool prestage_memory(uint16_t slot) {
+    relays_t relays = recall_memory(slot);
+
+    // empty slots are skipped without reading them
+    for (uint8_t offset = 1; (relays.all == 0) && (offset <= PRESTAGE_SEARCH_RADIUS); offset++) {
+        if (memory_slot_is_used(slot + offset)) {
+            relays = recall_memory(slot + offset);
+        }
+        if (relays.all == 0 && slot >= offset && memory_slot_is_used(slot - offset)) {
+            relays = recall_memory(slot - offset);
+        }
+    }
+
+    if (relays.all == 0) {
+        LOG_DEBUG({ printf("no memory near slot %u\r\n", slot); });
+        return false;
+    }
+
+    LOG_INFO({
+        print("prestaging ");
+        print_relays(relays);
+        printf(" for slot %u\r\n", slot);
+    });
+
+    return (put_relays(relays) != -1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool update_frequency_tracker(bool measurementIsValid) {
+    if (!measurementIsValid || currentRF.frequencyConfidence < MIN_TRACKING_CONFIDENCE) {
+        reset_frequency_tracker();
+        return false;
+    }
+
+    uint16_t slot = find_memory_slot(currentRF.frequency);
+
+    // the first good measurement just tells us where we are
+    if (trackedSlot == NO_SLOT) {
+        trackedSlot = slot;
+    }
+
+    if (slot == trackedSlot) {
+        candidateSlot = NO_SLOT;
+        slow_down();
+        return false;
+    }
+
+    // a single measurement could be noise, so wait for a second opinion
+    if (slot != candidateSlot) {
+        LOG_DEBUG({ printf("slot %u -> %u?\r\n", trackedSlot, slot); });
+        candidateSlot = slot;
+        trackingPeriod = MIN_TRACKING_PERIOD;
+        return false;
+    }
+
+    LOG_INFO({ printf("slot %u -> %u\r\n", trackedSlot, slot); });
+    trackedSlot = slot;
+    candidateSlot = NO_SLOT;
+
+    if (!systemFlags.autoMode) {
+        return false;
+    }
+
+    return prestage_memory(slot);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef _FREQUENCY_TRACKER_H_
+#define _FREQUENCY_TRACKER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+
+// setup
+extern void frequency_tracker_init(void);
+
+/* ************************************************************************** */
+
+// returns how long, in mS, to wait before the next idle frequency measurement
+extern uint16_t get_frequency_tracking_period(void);
+
+// forget the measurement history, call this when RF goes away
+extern void reset_frequency_tracker(void);
+
+// feed the most recent frequency measurement into the tracker
+// returns true if the tracker published new relays
+extern bool update_frequency_tracker(bool measurementIsValid);
+
+#endif // _FREQUENCY_TRACKER_H_
\ No newline at end of file
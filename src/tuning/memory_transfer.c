@@ -0,0 +1,360 @@
+#include "memory_transfer.h"
+#include "band_plan.h"
+#include "crc.h"
+#include "nvm_table.h"
+#include "os/logging.h"
+#include "tuning_memories.h"
+#include <string.h>
+static uint8_t LOG_LEVEL = L_SILENT;
+
+/* ************************************************************************** */
+/*  Notes on memory transfer
+
+    Backing up or cloning a unit used to mean `memory read <slot>` for every
+    one of the 3500 slots. Now the host sends one memory_export command, and
+    the idle loop streams the table back as a series of chunks, one chunk per
+    pass, so the rest of the tuner keeps running.
+
+    A chunk is a run-length encoding of a range of slots. Each header byte is
+    followed by its payload:
+
+        0x80 | (n - 1): n empty slots, no payload
+        0x00 | (n - 1): n memories, followed by n * TABLE_ENTRY_SIZE bytes
+
+    An empty slot is one whose entry is all zeros. A chunk holds up to
+    MEMORY_CHUNK_SIZE encoded bytes, and covers at most MAX_CHUNK_SLOTS slots
+    to keep each idle pass short. calibration/check_memory_transfer.py round
+    trips some tables through a model of the encoder and decoder.
+
+    The chunk bytes go over JUDI as base64, 4 characters for every 3 bytes.
+    Hex would be 2 characters per byte. A memory_import command has to fit
+    in JUDI's receive buffer, so 120 bytes is 160 characters of base64 and
+    the whole command stays under 256 characters.
+
+    On the wire, including the JSON around each chunk:
+
+        empty table:        14 chunks,  1.3 KB
+        a few dozen slots:  14 chunks,  1.8 KB
+        full table:        250 chunks, 60.0 KB, for 28 KB of entries
+
+    Each chunk carries a CRC of its start slot and its bytes, so a chunk that
+    got damaged, or applied to the wrong slots, is caught. A chunk only
+    depends on the slots it covers, so an export can be restarted from the
+    start of any chunk. An import is one memory_import command per chunk, and
+    each reply says which slot the host should send next. A damaged chunk
+    replies with its own start slot and IMPORT_BAD_CHUNK, and the host sends
+    it again.
+
+    summarize_memory_table() gives the host a CRC of the whole table, to check
+    a finished transfer.
+
+    A slot only means something under the band plan it was stored under, so
+    every chunk and the summary carry the active plan's crc. An import has to
+    send back the crc its chunks were exported under, and if that's not the
+    active plan, the chunk is rejected with IMPORT_WRONG_PLAN. The host has to
+    install the same plan first, or export again. Every memory_import reply
+    says whether the chunk was taken, and why not.
+*/
+
+// caps the flash reads per chunk at 16 blocks, ~1mS
+#define MAX_CHUNK_SLOTS 256
+
+#define EMPTY_RUN 0x80
+#define RUN_LENGTH_MASK 0x7F
+#define MAX_RUN_LENGTH (RUN_LENGTH_MASK + 1)
+
+memory_chunk_t memoryChunk;
+memory_table_summary_t memoryTableSummary;
+memory_import_status_t memoryImportStatus;
+
+static bool exportIsRunning;
+static uint16_t exportSlot;
+
+/* -------------------------------------------------------------------------- */
+
+void memory_transfer_init(void) {
+    exportIsRunning = false;
+    exportSlot = 0;
+
+    log_register();
+}
+
+/* ************************************************************************** */
+
+static bool entry_is_empty(table_entry_t *entry) {
+    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+        if (entry->contents[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint16_t chunk_crc(uint16_t start, uint8_t *data, uint8_t length) {
+    uint16_t crc = CRC16_INITIAL_VALUE;
+    crc = crc16_update(crc, start & 0xff);
+    crc = crc16_update(crc, start >> 8);
+    for (uint8_t i = 0; i < length; i++) {
+        crc = crc16_update(crc, data[i]);
+    }
+    return crc;
+}
+
+// packs as many slots from <slot> onward as will fit into memoryChunk
+static void encode_chunk(uint16_t slot) {
+    memoryChunk.start = slot;
+    memoryChunk.length = 0;
+
+    uint8_t header = 0;
+    uint8_t runLength = 0;
+    bool runIsEmpty = false;
+
+    while (slot < NUMBER_OF_TABLE_ENTRIES && (slot - memoryChunk.start) < MAX_CHUNK_SLOTS) {
+        table_entry_t entry = nvm_table_read(slot);
+        bool isEmpty = entry_is_empty(&entry);
+
+        bool extendsRun = (runLength > 0) && (isEmpty == runIsEmpty) && (runLength < MAX_RUN_LENGTH);
+        uint8_t needed = (extendsRun ? 0 : 1) + (isEmpty ? 0 : TABLE_ENTRY_SIZE);
+        if (memoryChunk.length + needed > MEMORY_CHUNK_SIZE) {
+            break;
+        }
+
+        if (!extendsRun) {
+            header = memoryChunk.length++;
+            runLength = 0;
+            runIsEmpty = isEmpty;
+        }
+
+        runLength++;
+        memoryChunk.data[header] = (runIsEmpty ? EMPTY_RUN : 0) | (runLength - 1);
+
+        if (!isEmpty) {
+            memcpy(&memoryChunk.data[memoryChunk.length], entry.contents, TABLE_ENTRY_SIZE);
+            memoryChunk.length += TABLE_ENTRY_SIZE;
+        }
+
+        slot++;
+    }
+
+    memoryChunk.next = slot;
+    memoryChunk.plan = bandPlanInfo.crc;
+    memoryChunk.crc = chunk_crc(memoryChunk.start, memoryChunk.data, memoryChunk.length);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void start_memory_export(uint16_t slot) {
+    LOG_INFO({ printf("exporting from slot %u\r\n", slot); });
+
+    // the chunks are raw entries, so the hits have to be in them
+    save_memory_hits();
+
+    exportSlot = slot;
+    exportIsRunning = (slot < NUMBER_OF_TABLE_ENTRIES);
+}
+
+void abort_memory_export(void) {
+    LOG_INFO({ printf("aborted export at slot %u\r\n", exportSlot); });
+
+    exportIsRunning = false;
+}
+
+bool memory_export_is_running(void) { return exportIsRunning; }
+
+bool memory_export_update(void) {
+    if (!exportIsRunning) {
+        return false;
+    }
+
+    encode_chunk(exportSlot);
+    exportSlot = memoryChunk.next;
+
+    if (exportSlot >= NUMBER_OF_TABLE_ENTRIES) {
+        LOG_INFO({ println("export finished"); });
+        exportIsRunning = false;
+    }
+    return true;
+}
+
+/* ************************************************************************** */
+
+static const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void encode_base64_group(char *text, const uint8_t *data, uint8_t length) {
+    uint8_t a = data[0];
+    uint8_t b = (length > 1) ? data[1] : 0;
+    uint8_t c = (length > 2) ? data[2] : 0;
+
+    text[0] = base64Digits[a >> 2];
+    text[1] = base64Digits[((a & 0x03) << 4) | (b >> 4)];
+    text[2] = (length > 1) ? base64Digits[((b & 0x0f) << 2) | (c >> 6)] : '=';
+    text[3] = (length > 2) ? base64Digits[c & 0x3f] : '=';
+    text[4] = 0;
+}
+
+static int8_t base64_digit(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    }
+    if (c == '+') {
+        return 62;
+    }
+    if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+// returns the number of bytes decoded, or -1 if <text> isn't valid
+static int16_t decode_base64(const char *text, uint8_t *data, uint8_t maxLength) {
+    uint8_t length = 0;
+
+    while (text[0]) {
+        // every group is 4 characters, only the last one can be padded
+        if (!text[1] || !text[2] || !text[3]) {
+            return -1;
+        }
+
+        int8_t digits[4];
+        uint8_t count = 3;
+        for (uint8_t i = 0; i < 4; i++) {
+            if (i >= 2 && text[i] == '=') {
+                digits[i] = 0;
+                if (count == 3) {
+                    count = i - 1;
+                }
+            } else {
+                digits[i] = base64_digit(text[i]);
+                if (digits[i] < 0 || count < 3) {
+                    return -1;
+                }
+            }
+        }
+        if ((count < 3 && text[4]) || length + count > maxLength) {
+            return -1;
+        }
+
+        data[length++] = (digits[0] << 2) | (digits[1] >> 4);
+        if (count > 1) {
+            data[length++] = (digits[1] << 4) | (digits[2] >> 2);
+        }
+        if (count > 2) {
+            data[length++] = (digits[2] << 6) | digits[3];
+        }
+        text += 4;
+    }
+    return length;
+}
+
+// walks the chunk without writing anything, returns false if it's malformed
+static bool chunk_is_valid(uint16_t start, uint8_t *data, uint8_t length) {
+    uint16_t slot = start;
+    uint8_t i = 0;
+
+    while (i < length) {
+        uint8_t header = data[i++];
+        uint8_t runLength = (header & RUN_LENGTH_MASK) + 1;
+
+        if (!(header & EMPTY_RUN)) {
+            if (i + (uint16_t)runLength * TABLE_ENTRY_SIZE > length) {
+                return false;
+            }
+            i += runLength * TABLE_ENTRY_SIZE;
+        }
+
+        slot += runLength;
+        if (slot > NUMBER_OF_TABLE_ENTRIES) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void reject_memory_import(uint16_t start) {
+    LOG_WARN({ printf("incomplete import at slot %u\r\n", start); });
+
+    memoryImportStatus.next = start;
+    memoryImportStatus.error = IMPORT_INCOMPLETE;
+}
+
+void import_memory_chunk(uint16_t start, const char *text, uint16_t crc, uint16_t plan) {
+    uint8_t data[MEMORY_CHUNK_SIZE];
+
+    memoryImportStatus.next = start;
+
+    if (plan != bandPlanInfo.crc) {
+        LOG_WARN({ printf("chunk at slot %u is for band plan %u\r\n", start, plan); });
+        memoryImportStatus.error = IMPORT_WRONG_PLAN;
+        return;
+    }
+
+    memoryImportStatus.error = IMPORT_BAD_CHUNK;
+
+    int16_t length = decode_base64(text, data, MEMORY_CHUNK_SIZE);
+    if (length < 0 || start >= NUMBER_OF_TABLE_ENTRIES) {
+        LOG_WARN({ printf("bad chunk at slot %u\r\n", start); });
+        return;
+    }
+    if (chunk_crc(start, data, length) != crc || !chunk_is_valid(start, data, length)) {
+        LOG_WARN({ printf("chunk at slot %u failed its crc\r\n", start); });
+        return;
+    }
+
+    uint16_t slot = start;
+    uint8_t i = 0;
+    while (i < length) {
+        uint8_t header = data[i++];
+        uint8_t runLength = (header & RUN_LENGTH_MASK) + 1;
+
+        for (uint8_t j = 0; j < runLength; j++) {
+            table_entry_t entry = new_table_entry();
+            if (!(header & EMPTY_RUN)) {
+                memcpy(entry.contents, &data[i], TABLE_ENTRY_SIZE);
+                i += TABLE_ENTRY_SIZE;
+            }
+
+            // unchanged slots are skipped by nvm_table_write()
+            write_memory_entry(slot++, entry);
+        }
+    }
+
+    LOG_DEBUG({ printf("imported slots %u to %u\r\n", start, slot - 1); });
+
+    // the last chunk makes the new table durable, and current
+    if (slot >= NUMBER_OF_TABLE_ENTRIES) {
+        flush_memories();
+        reload_memories();
+    }
+
+    memoryImportStatus.next = slot;
+    memoryImportStatus.error = IMPORT_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void summarize_memory_table(void) {
+    save_memory_hits();
+
+    uint16_t crc = CRC16_INITIAL_VALUE;
+    uint16_t used = 0;
+
+    for (uint16_t slot = 0; slot < NUMBER_OF_TABLE_ENTRIES; slot++) {
+        table_entry_t entry = nvm_table_read(slot);
+        if (!entry_is_empty(&entry)) {
+            used++;
+        }
+        for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+            crc = crc16_update(crc, entry.contents[i]);
+        }
+    }
+
+    memoryTableSummary.used = used;
+    memoryTableSummary.crc = crc;
+    memoryTableSummary.plan = bandPlanInfo.crc;
+}
\ No newline at end of file
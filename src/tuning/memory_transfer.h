@@ -0,0 +1,85 @@
+#ifndef _MEMORY_TRANSFER_H_
+#define _MEMORY_TRANSFER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+/*  Bulk export and import of the memory table
+
+    The table is sent in chunks of run-length encoded slots, each with its own
+    CRC, as base64 text. See the notes in memory_transfer.c.
+*/
+
+// 160 characters of base64, see the notes on the import size
+#define MEMORY_CHUNK_SIZE 120
+
+typedef struct {
+    uint16_t start; // first slot in the chunk
+    uint16_t next;  // first slot after the chunk
+    uint16_t plan;  // crc of the band plan the slots belong to
+    uint8_t length; // bytes used in data[]
+    uint8_t data[MEMORY_CHUNK_SIZE];
+    uint16_t crc; // see chunk_crc()
+} memory_chunk_t;
+
+// read-only: the most recently exported chunk
+extern memory_chunk_t memoryChunk;
+
+typedef struct {
+    uint16_t used; // slots that hold a memory
+    uint16_t crc;  // crc16 of every entry in the table, in slot order
+    uint16_t plan; // crc of the band plan the slots belong to
+} memory_table_summary_t;
+
+// read-only: filled in by summarize_memory_table()
+extern memory_table_summary_t memoryTableSummary;
+
+// why the last memory_import was rejected
+#define IMPORT_OK 0
+#define IMPORT_INCOMPLETE 1 // the command was missing start, crc, data or plan
+#define IMPORT_BAD_CHUNK 2  // damaged on the way, send it again
+#define IMPORT_WRONG_PLAN 3 // exported under a different band plan
+
+typedef struct {
+    uint16_t next; // the slot the host should send next
+    uint8_t error; // IMPORT_OK, or why the chunk was rejected
+} memory_import_status_t;
+
+// read-only: the result of the last memory_import
+extern memory_import_status_t memoryImportStatus;
+
+/* ************************************************************************** */
+
+// setup
+extern void memory_transfer_init(void);
+
+// start streaming the table from <slot>, to start over or to resume
+extern void start_memory_export(uint16_t slot);
+
+// stop an export before it's finished
+extern void abort_memory_export(void);
+
+extern bool memory_export_is_running(void);
+
+// call this from the idle loop while an export is running
+// returns true when memoryChunk holds a new chunk
+extern bool memory_export_update(void);
+
+/* -------------------------------------------------------------------------- */
+
+// writes up to 3 bytes from <data> into <text> as 4 base64 characters
+// <text> needs room for 5 characters, it's null terminated
+extern void encode_base64_group(char *text, const uint8_t *data, uint8_t length);
+
+// decodes <text> into slots starting at <start>, if it matches <crc> and
+// <plan> is the active band plan's crc, the result goes in memoryImportStatus
+extern void import_memory_chunk(uint16_t start, const char *text, uint16_t crc, uint16_t plan);
+
+// rejects a memory_import that was missing a field
+extern void reject_memory_import(uint16_t start);
+
+// reads the whole table into memoryTableSummary, takes ~200mS, mostly crc
+extern void summarize_memory_table(void);
+
+#endif // _MEMORY_TRANSFER_H_
\ No newline at end of file
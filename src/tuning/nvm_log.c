@@ -0,0 +1,166 @@
+#include "nvm_log.h"
+#include "os/logging.h"
+#include "peripherals/nonvolatile_memory.h"
+#include <string.h>
+static uint8_t LOG_LEVEL = L_SILENT;
+
+#ifdef MEMORY_LOG_ENABLED
+
+/* ************************************************************************** */
+/*  Notes on the memory log
+
+    The memory table is a fixed array, so every store erases the block that
+    holds its slot. Slots in the popular bands get erased over and over, while
+    most of the table is never touched.
+
+    With MEMORY_LOG_ENABLED, a store appends a (slot, entry) record to this log
+    instead. An append only programs erased bytes, so it never erases anything.
+    When the log is full, nvm_table.c merges it into the table one table block
+    at a time: every table block that the log touched is erased and written
+    once, no matter how many records it had. Then the log blocks are erased,
+    and the log starts over.
+
+    That spreads the erases over the log blocks and the touched table blocks,
+    at one erase per block per MEMORY_LOG_BLOCKS * LOG_RECORDS_PER_BLOCK
+    stores, instead of one erase per store on the busiest block.
+    calibration/check_memory_log.py simulates a year of stores on both
+    engines.
+
+    Both builds in project.yaml define MEMORY_LOG_ENABLED. The log costs
+    MEMORY_LOG_BLOCKS erase blocks of flash (1KB) below the calibration region,
+    and two bytes of RAM per record for the index (176 bytes), which both the
+    57K42 and the 26K42 can spare. Without it, the simulation has the busiest
+    table block reaching 10000 erases in under three years.
+
+    The RAM index is just the slot of every record, in log order. It's rebuilt
+    at boot by scanning the record markers, and a lookup searches it from the
+    newest record back.
+
+    The log array is initialized to 0 like nvmTable[], so a freshly programmed
+    unit has 0 markers, which aren't valid or free. Anything after a record
+    that isn't valid or free is treated as damaged, and the log is compacted
+    and erased at boot.
+*/
+
+#define LOG_RECORD_FREE 0xFF
+#define LOG_RECORD_VALID 0xA5
+
+typedef struct {
+    uint8_t marker;
+    uint16_t slot;
+    table_entry_t entry;
+} log_record_t;
+
+#define LOG_RECORD_SIZE sizeof(log_record_t)
+#define LOG_RECORDS_PER_BLOCK (FLASH_ERASE_BLOCKSIZE / LOG_RECORD_SIZE)
+#define LOG_CAPACITY (MEMORY_LOG_BLOCKS * LOG_RECORDS_PER_BLOCK)
+
+// reserve the region, same as nvmTable[]
+const uint8_t memoryLog[MEMORY_LOG_SIZE] __at(MEMORY_LOG_LOCATION) = {};
+
+static uint16_t logSlots[LOG_CAPACITY];
+static uint8_t logLength;
+
+/* -------------------------------------------------------------------------- */
+
+static NVM_address_t record_address(uint8_t index) {
+    uint8_t block = index / LOG_RECORDS_PER_BLOCK;
+    uint8_t offset = (index % LOG_RECORDS_PER_BLOCK) * LOG_RECORD_SIZE;
+
+    return (NVM_address_t)&memoryLog[0] + (uint16_t)block * FLASH_ERASE_BLOCKSIZE + offset;
+}
+
+static void read_record(uint8_t index, log_record_t *record) {
+    NVM_address_t address = record_address(index);
+    uint8_t *bytes = (uint8_t *)record;
+
+    for (uint8_t i = 0; i < LOG_RECORD_SIZE; i++) {
+        bytes[i] = flash_read_byte(address + i);
+    }
+}
+
+bool memory_log_init(void) {
+    log_record_t record;
+
+    log_register();
+
+    logLength = 0;
+    while (logLength < LOG_CAPACITY) {
+        read_record(logLength, &record);
+
+        if (record.marker == LOG_RECORD_FREE) {
+            break;
+        }
+        if (record.marker != LOG_RECORD_VALID) {
+            LOG_WARN({ printf("damaged log record at %u\r\n", logLength); });
+            return false;
+        }
+
+        logSlots[logLength++] = record.slot;
+    }
+
+    LOG_INFO({ printf("%u log records\r\n", logLength); });
+    return true;
+}
+
+/* ************************************************************************** */
+
+bool memory_log_read(uint16_t slot, table_entry_t *entry) {
+    // newest first, so the last store to a slot wins
+    for (uint8_t i = logLength; i > 0; i--) {
+        if (logSlots[i - 1] == slot) {
+            *entry = memory_log_entry(i - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool memory_log_append(uint16_t slot, table_entry_t *entry) {
+    if (logLength >= LOG_CAPACITY) {
+        return false;
+    }
+
+    log_record_t record;
+    record.marker = LOG_RECORD_VALID;
+    record.slot = slot;
+    record.entry = *entry;
+
+    // the record's bytes are still erased, so this only programs them
+    NVM_address_t address = record_address(logLength);
+    uint8_t buffer[FLASH_BUFFER_SIZE];
+    flash_read_block(address, buffer);
+    memcpy(&buffer[address & FLASH_ELEMENT_MASK], &record, LOG_RECORD_SIZE);
+    flash_write_block(address, buffer);
+
+    LOG_DEBUG({ printf("logged slot %u as record %u\r\n", slot, logLength); });
+
+    logSlots[logLength++] = slot;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint8_t memory_log_length(void) { return logLength; }
+
+uint8_t memory_log_capacity(void) { return LOG_CAPACITY; }
+
+uint16_t memory_log_slot(uint8_t index) { return logSlots[index]; }
+
+table_entry_t memory_log_entry(uint8_t index) {
+    log_record_t record;
+    read_record(index, &record);
+    return record.entry;
+}
+
+void memory_log_erase(void) {
+    NVM_address_t address = (NVM_address_t)&memoryLog[0];
+
+    for (uint8_t i = 0; i < MEMORY_LOG_BLOCKS; i++) {
+        flash_erase_block(address + (uint16_t)i * FLASH_ERASE_BLOCKSIZE);
+    }
+
+    logLength = 0;
+}
+
+#endif
\ No newline at end of file
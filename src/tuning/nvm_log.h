@@ -0,0 +1,51 @@
+#ifndef _NVM_LOG_H_
+#define _NVM_LOG_H_
+
+#include "nvm_table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ************************************************************************** */
+/*  Tuning memory log, used by nvm_table.c when MEMORY_LOG_ENABLED is defined
+
+    Stores are appended to a small flash log instead of going straight into the
+    table. When the log fills up, nvm_table.c merges it into the table and
+    erases it. See the notes in nvm_log.c.
+*/
+
+#define MEMORY_LOG_BLOCKS 8
+#define MEMORY_LOG_SIZE (MEMORY_LOG_BLOCKS * FLASH_ERASE_BLOCKSIZE)
+
+// calibration.c keeps the two erase blocks right below the table
+#define MEMORY_LOG_LOCATION (TABLE_LOCATION - (2 * FLASH_ERASE_BLOCKSIZE) - MEMORY_LOG_SIZE)
+
+/* ************************************************************************** */
+
+// setup, scans the log and rebuilds the RAM index
+// returns false if the log was damaged and needs to be compacted
+extern bool memory_log_init(void);
+
+// looks for the newest logged entry for <slot>, returns true if there is one
+extern bool memory_log_read(uint16_t slot, table_entry_t *entry);
+
+// adds a record to the log, returns false if the log is full
+extern bool memory_log_append(uint16_t slot, table_entry_t *entry);
+
+/* -------------------------------------------------------------------------- */
+
+// number of records currently in the log
+extern uint8_t memory_log_length(void);
+
+// maximum number of records the log can hold
+extern uint8_t memory_log_capacity(void);
+
+// the slot of log record <index>, straight from the RAM index
+extern uint16_t memory_log_slot(uint8_t index);
+
+// reads the entry of log record <index>
+extern table_entry_t memory_log_entry(uint8_t index);
+
+// erases the whole log, only once every record has been merged into the table
+extern void memory_log_erase(void);
+
+#endif // _NVM_LOG_H_
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "nvm_table.h"
 #include "flags.h"
+#include "nvm_log.h"
 #include "os/logging.h"
+#include "os/system_time.h"
 #include "peripherals/nonvolatile_memory.h"
 #include <stdbool.h>
 #include <string.h>
@@ -26,6 +28,264 @@ void print_table_entry(table_entry_t entry) {
 // define a giant array in ROM to reserve space for saving tune memories
 const table_entry_t nvmTable[NUMBER_OF_TABLE_ENTRIES] __at(TABLE_LOCATION) = {};
 
+/* ************************************************************************** */
+/*  Notes on the block cache
+
+    The table keeps the last few blocks it wrote in RAM, see the notes on
+    write-back. A write that misses reads the whole block with one
+    flash_read_block(), and evicts the least recently used block.
+
+    Reads don't fill the cache. memory_tune() only recalls the slots that the
+    occupancy map says are used, at most NUM_OF_MEMORIES of them, and on a
+    sparse table they're spread over as many blocks. Reading a whole block
+    for each of them cost more than reading the entries one byte at a time,
+    up to 232 uS a tune instead of 180. Tables a fifth full or more did a
+    little better with whole blocks, but never worse than 180 uS either way.
+    So a read that finds its block in the cache, because it's being written,
+    takes the entry from there, and any other read takes its 8 bytes straight
+    from flash. calibration/check_memory_cache.py compares the two.
+*/
+
+/*  Notes on write-back
+
+    Every nvm_table_write() used to read, erase, and rewrite a whole block on
+    the spot, and the erase stalls the CPU for a few mS. A manual store and a
+    full_tune() result in the same band usually land in the same block.
+
+    Writes now only change the cached copy of the block and mark it dirty. Any
+    number of writes to the same block are merged into one erase and one block
+    write, when the block is flushed. A block is flushed when:
+        - it's evicted to make room for another block, clean blocks go first
+        - the idle loop sees that RF is gone, via nvm_table_flush()
+        - it's been dirty for NVM_FLUSH_DELAY, via nvm_table_flush_is_due()
+        - the unit is turned off, see set_power_off()
+
+    The block is only erased if one of the writes needs to turn a 0 into a 1,
+    compared to what's actually in flash.
+*/
+
+#define NVM_CACHE_BLOCKS 3
+
+#define NVM_FLUSH_DELAY 10000 // mS
+
+typedef struct {
+    NVM_address_t address; // start of the block
+    uint8_t age;           // 0 is the most recently used
+    bool isValid;
+    bool isDirty;   // the cached copy is newer than flash
+    bool mustErase; // at least one write can't be programmed over flash
+    system_time_t dirtyTime;
+    uint8_t data[FLASH_BUFFER_SIZE];
+} cache_block_t;
+
+static cache_block_t cache[NVM_CACHE_BLOCKS];
+
+nvm_table_stats_t nvmTableStats;
+
+static void invalidate_cache(void) {
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        cache[i].isValid = false;
+        cache[i].isDirty = false;
+        cache[i].mustErase = false;
+        cache[i].age = i;
+    }
+}
+
+// writes a dirty block back to flash
+static void flush_block(cache_block_t *block) {
+    if (!block->isDirty) {
+        return;
+    }
+
+    system_time_t startTime = get_current_time();
+
+    if (block->mustErase) {
+        LOG_INFO({ println("Erasing block"); });
+        flash_erase_block(block->address);
+        nvmTableStats.erases++;
+    }
+
+    LOG_INFO({ println("Writing new block"); });
+    flash_write_block(block->address, block->data);
+    nvmTableStats.blockWrites++;
+
+    block->isDirty = false;
+    block->mustErase = false;
+
+    uint16_t latency = time_since(startTime);
+    nvmTableStats.lastFlushTime = latency;
+    if (latency > nvmTableStats.maxFlushTime) {
+        nvmTableStats.maxFlushTime = latency;
+    }
+}
+
+// marks <block> as the most recently used
+static void touch_block(cache_block_t *block) {
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        if (cache[i].age < block->age) {
+            cache[i].age++;
+        }
+    }
+    block->age = 0;
+}
+
+// returns the cached copy of the block that contains <address>, if there is one
+static cache_block_t *find_cached_block(NVM_address_t address) {
+    NVM_address_t blockAddress = address & FLASH_BLOCK_MASK;
+
+    nvmTableStats.reads++;
+
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        if (cache[i].isValid && cache[i].address == blockAddress) {
+            nvmTableStats.hits++;
+            touch_block(&cache[i]);
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// returns the cached copy of the block that contains <address>, reading it
+// into the cache if it has to
+static cache_block_t *get_cached_block(NVM_address_t address) {
+    NVM_address_t blockAddress = address & FLASH_BLOCK_MASK;
+    cache_block_t *block = find_cached_block(address);
+    if (block) {
+        return block;
+    }
+
+    // evict the least recently used clean block, so a miss doesn't stall
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        if (!cache[i].isDirty && (!block || cache[i].age > block->age)) {
+            block = &cache[i];
+        }
+    }
+
+    // everything is dirty, so the least recently used block has to go
+    if (!block) {
+        block = &cache[0];
+        for (uint8_t i = 1; i < NVM_CACHE_BLOCKS; i++) {
+            if (cache[i].age > block->age) {
+                block = &cache[i];
+            }
+        }
+        flush_block(block);
+    }
+
+    flash_read_block(blockAddress, block->data);
+    block->address = blockAddress;
+    block->isValid = true;
+    touch_block(block);
+
+    return block;
+}
+
+/* ************************************************************************** */
+
+static NVM_address_t resolve_table_address(uint16_t slot);
+
+// compare the two variables bit-by-bit, checking for 0->1 transitions
+static bool must_erase(table_entry_t new, table_entry_t old) {
+    // we have to compare every element of each entry
+    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+        // and every bit of each element
+        for (uint8_t k = 0; k < 8; k++) {
+            if (!(old.contents[i] & (1 << k)) && (new.contents[i] & (1 << k))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// writes an entry into its cached block, the block goes back to flash later
+static void stage_table_entry(uint16_t slot, table_entry_t newEntry) {
+    NVM_address_t address = resolve_table_address(slot);
+    cache_block_t *block = get_cached_block(address);
+
+    // the erase decision has to be made against flash, not the cached copy
+    if (!block->mustErase) {
+        table_entry_t flashEntry;
+        for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+            flashEntry.contents[i] = flash_read_byte(address + i);
+        }
+        block->mustErase = must_erase(newEntry, flashEntry);
+    }
+
+    // identify which element in the array corresponds to our address
+    uint8_t element = address & FLASH_ELEMENT_MASK;
+
+    // update the buffer with our new data
+    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+        block->data[element + i] = newEntry.contents[i];
+    }
+
+    // the block goes back to flash later, see the notes on write-back
+    if (!block->isDirty) {
+        block->isDirty = true;
+        block->dirtyTime = get_current_time();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+#ifdef MEMORY_LOG_ENABLED
+static uint16_t table_block(uint16_t slot) {
+    return slot / (FLASH_BUFFER_SIZE / TABLE_ENTRY_SIZE);
+}
+
+/*  compact_memory_log() merges the log into the table and erases it
+
+    The records are grouped by table block, so every touched block is erased
+    and written once. Within a block, the records are applied oldest first,
+    so the newest store to a slot wins.
+
+    The log isn't erased until every block has been written, so a power loss
+    part way through just means doing it again at the next boot.
+
+    A compaction erases and writes every touched block, hundreds of mS with a
+    full log. The idle loop compacts once the log passes LOG_HIGH_WATER_MARK,
+    while there's no RF, see nvm_table_needs_compaction(). Compacting inside
+    nvm_table_write() is only the last resort, for when the log fills up
+    before the idle loop gets a chance, and it's counted separately.
+*/
+
+// leaves a quarter of the log for stores that come in before the idle loop
+#define LOG_HIGH_WATER_MARK ((memory_log_capacity() / 4) * 3)
+static void compact_memory_log(void) {
+    uint8_t length = memory_log_length();
+
+    LOG_INFO({ printf("compacting %u log records\r\n", length); });
+
+    for (uint8_t i = 0; i < length; i++) {
+        uint16_t block = table_block(memory_log_slot(i));
+
+        // skip blocks that an earlier record already took care of
+        bool isDone = false;
+        for (uint8_t k = 0; k < i; k++) {
+            if (table_block(memory_log_slot(k)) == block) {
+                isDone = true;
+                break;
+            }
+        }
+        if (isDone) {
+            continue;
+        }
+
+        for (uint8_t k = i; k < length; k++) {
+            if (table_block(memory_log_slot(k)) == block) {
+                stage_table_entry(memory_log_slot(k), memory_log_entry(k));
+            }
+        }
+        nvm_table_flush();
+    }
+
+    memory_log_erase();
+    nvmTableStats.erases += MEMORY_LOG_BLOCKS;
+    nvmTableStats.compactions++;
+}
+#endif
+
 /* ************************************************************************** */
 
 static void print_configuration_data(void) {
@@ -42,11 +302,21 @@ void nvm_table_init(void) {
     //
     nonvolatile_memory_init();
 
+    invalidate_cache();
+    memset(&nvmTableStats, 0, sizeof(nvm_table_stats_t));
+
     // register with the logging subsystem
     log_register();
 
     //
     LOG_DEBUG({ print_configuration_data(); });
+
+#ifdef MEMORY_LOG_ENABLED
+    // finish whatever was interrupted, and clean up a damaged log
+    if (!memory_log_init()) {
+        compact_memory_log();
+    }
+#endif
 }
 
 /* ************************************************************************** */
@@ -72,11 +342,23 @@ table_entry_t nvm_table_read(uint16_t slot) {
     LOG_TRACE({ println("nvm_table_read"); });
 
     NVM_address_t address = resolve_table_address(slot);
-    table_entry_t entry = new_table_entry();
+    table_entry_t entry;
 
-    // copy the contents of flash at <address> into the table_entry_t object
-    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
-        entry.contents[i] = flash_read_byte(address + i);
+#ifdef MEMORY_LOG_ENABLED
+    // the log holds anything stored since the last compaction
+    if (memory_log_read(slot, &entry)) {
+        return entry;
+    }
+#endif
+
+    // a block that's being written is newer than flash
+    cache_block_t *block = find_cached_block(address);
+    if (block) {
+        memcpy(entry.contents, &block->data[address & FLASH_ELEMENT_MASK], TABLE_ENTRY_SIZE);
+    } else {
+        for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
+            entry.contents[i] = flash_read_byte(address + i);
+        }
     }
 
     LOG_INFO({
@@ -91,20 +373,6 @@ table_entry_t nvm_table_read(uint16_t slot) {
 
 /* -------------------------------------------------------------------------- */
 
-// compare the two variables bit-by-bit, checking for 0->1 transitions
-static bool must_erase(table_entry_t new, table_entry_t old) {
-    // we have to compare every element of each entry
-    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
-        // and every bit of each element
-        for (uint8_t k = 0; k < 8; k++) {
-            if (!(old.contents[i] & (1 << k)) && (new.contents[i] & (1 << k))) {
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
 // Store the provided entry object in the specified slot
 void nvm_table_write(uint16_t slot, table_entry_t newEntry) {
     LOG_TRACE({ println("nvm_table_write"); });
@@ -138,26 +406,59 @@ void nvm_table_write(uint16_t slot, table_entry_t newEntry) {
         return;
     }
 
-    // Fill the buffer with the current flash contents
-    LOG_INFO({ println("Reading existing block"); });
-    uint8_t buffer[FLASH_BUFFER_SIZE];
-    flash_read_block(address, buffer);
+    nvmTableStats.writes++;
 
-    // identify which element in the array corresponds to our address
-    uint8_t element = address & FLASH_ELEMENT_MASK;
+#ifdef MEMORY_LOG_ENABLED
+    // the log is durable right away, so it doesn't need flushing
+    if (!memory_log_append(slot, &newEntry)) {
+        LOG_WARN({ println("log full, compacting inline"); });
+        nvmTableStats.forcedCompactions++;
+        compact_memory_log();
+        memory_log_append(slot, &newEntry);
+    }
+#else
+    stage_table_entry(slot, newEntry);
+#endif
+}
 
-    // update the buffer with our new data
-    for (uint8_t i = 0; i < TABLE_ENTRY_SIZE; i++) {
-        buffer[element + i] = newEntry.contents[i];
+/* -------------------------------------------------------------------------- */
+
+bool nvm_table_is_dirty(void) {
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        if (cache[i].isDirty) {
+            return true;
+        }
     }
+    return false;
+}
 
-    // erase, but only if necessary
-    if (must_erase(newEntry, existingEntry)) {
-        LOG_INFO({ println("Erasing block"); });
-        flash_erase_block(address);
+bool nvm_table_flush_is_due(void) {
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        if (cache[i].isDirty && time_since(cache[i].dirtyTime) >= NVM_FLUSH_DELAY) {
+            return true;
+        }
     }
+    return false;
+}
 
-    // finally, we can write our modified block back into flash
-    LOG_INFO({ println("Writing new block"); });
-    flash_write_block(address, buffer);
+void nvm_table_flush(void) {
+    for (uint8_t i = 0; i < NVM_CACHE_BLOCKS; i++) {
+        flush_block(&cache[i]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool nvm_table_needs_compaction(void) {
+#ifdef MEMORY_LOG_ENABLED
+    return memory_log_length() >= LOG_HIGH_WATER_MARK;
+#else
+    return false;
+#endif
+}
+
+void nvm_table_compact(void) {
+#ifdef MEMORY_LOG_ENABLED
+    compact_memory_log();
+#endif
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef _NVM_TABLE_H_
 #define _NVM_TABLE_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /* ************************************************************************** */
@@ -24,7 +25,7 @@ extern void print_table_entry(table_entry_t entry);
 
 /* ************************************************************************** */
 
-// this was determined by running print_all_frequency_groups()
+// this was determined by running print_band_plan()
 #define NUMBER_OF_TABLE_ENTRIES 3500
 
 // I hope this is obvious
@@ -38,6 +39,23 @@ extern void print_table_entry(table_entry_t entry);
 
 /* ************************************************************************** */
 
+typedef struct {
+    uint32_t reads;             // table reads and writes that looked in the block cache
+    uint32_t hits;              // the ones that found their block there
+    uint32_t writes;            // entries changed by nvm_table_write()
+    uint32_t blockWrites;       // blocks written back to flash
+    uint32_t erases;            // blocks erased before being written back
+    uint16_t lastFlushTime;     // mS to write back the most recent block
+    uint16_t maxFlushTime;      // mS, worst block write back since boot
+    uint16_t compactions;       // memory log merges, with MEMORY_LOG_ENABLED
+    uint16_t forcedCompactions; // the ones that ran inline, from a full log
+} nvm_table_stats_t;
+
+// read-only: block cache statistics since boot
+extern nvm_table_stats_t nvmTableStats;
+
+/* ************************************************************************** */
+
 // setup
 extern void nvm_table_init(void);
 
@@ -45,6 +63,22 @@ extern void nvm_table_init(void);
 extern table_entry_t nvm_table_read(uint16_t slot);
 
 // Store the provided table_entry_t object in the specified slot
+// the write stays in RAM until the block is flushed
 extern void nvm_table_write(uint16_t slot, table_entry_t newEntry);
 
+// true if any writes haven't made it to flash yet
+extern bool nvm_table_is_dirty(void);
+
+// true if a write has been waiting in RAM for too long
+extern bool nvm_table_flush_is_due(void);
+
+// write every dirty block back to flash, each block takes a few mS
+extern void nvm_table_flush(void);
+
+// true if the memory log is getting full, always false without MEMORY_LOG_ENABLED
+extern bool nvm_table_needs_compaction(void);
+
+// merges the memory log into the table, up to a few hundred mS
+extern void nvm_table_compact(void);
+
 #endif // _NVM_TABLE_H_
\ No newline at end of file
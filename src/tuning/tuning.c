@@ -1,6 +1,10 @@
 #include "tuning.h"
+#include "calibration.h"
 #include "display.h"
 #include "flags.h"
+#include "frequency_tracker.h"
+#include "hot_switch.h"
+#include "memory_transfer.h"
 #include "os/logging.h"
 #include "os/system_time.h"
 #include "relays.h"
@@ -18,6 +22,8 @@ void tuning_init(void) {
     log_register();
 
     // init the other tuning files
+    frequency_tracker_init();
+    memory_transfer_init();
     tuning_memories_init();
     tuning_search_init();
     tuning_utils_init();
@@ -40,14 +46,16 @@ tuning_errors_t full_tune(void) {
     }
 
     measure_RF();
-    measure_frequency();
-    while (currentRF.frequency == 0) {
-        LOG_DEBUG({ println("bad frequency, retrying"); });
-        measure_frequency();
+    if (!measure_frequency()) {
+        // we can still tune without a frequency, we just can't save the result
+        LOG_WARN({ println("no frequency!"); });
     }
 
     LOG_DEBUG({ printf("frequency: %u KHz\r\n", currentRF.frequency); });
 
+    // abandon the tune if the power goes over the limit between comparisons
+    arm_hot_switch_trip(get_hot_switch_limit(currentRF.frequency));
+
     // prepare match objects
     match_t bestMatch = new_match();
     match_t bypassMatch = compare_matches(&errors, bypassRelays, new_match());
@@ -97,12 +105,10 @@ tuning_errors_t full_tune(void) {
     delay_ms(250);
 
     measure_RF();
-    measure_frequency();
-    if (currentRF.frequency == 0) {
-        LOG_DEBUG({ println("bad frequency, retrying"); });
-        measure_frequency();
+    if (!measure_frequency()) {
         errors.noFreq = 1;
         LOG_WARN({ println("no frequency!"); });
+        return errors;
     }
     calculate_watts_and_swr();
 
@@ -120,7 +126,7 @@ tuning_errors_t full_tune(void) {
             print_relays(bestMatch.relays);
             printf(" to slot %u \r\n", slot);
         });
-        store_memory(slot, bestMatch.relays);
+        store_memory(slot, bestMatch.relays, currentRF.frequency, bestMatch.swr);
     } else {
         errors.badMatch = 1;
     }
@@ -129,9 +135,97 @@ tuning_errors_t full_tune(void) {
 
 /* -------------------------------------------------------------------------- */
 
-//
+/*  Notes on memory ranking
+
+    memory_tune() used to test every memory it found, nearest slot first, and
+    then switch back to the best one. Memories now remember the SWR they
+    achieved, the frequency they were stored at, how many memory tunes they've
+    won, and how recently they were used, so the candidates are ranked first
+    and tested best first. The first one that's under the SWR threshold wins,
+    which is usually the first one tested.
+
+    Lower scores are better. A score adds up:
+        - the stored SWR code, 1 + (SWR - 1) * 50, or SWR 2.0 if it's unknown
+        - 4 points per 0.1% between the stored and measured frequency, or 2
+          points per slot of distance if the stored frequency is unknown
+        - 1 point per 2 generations since the memory was last used, up to 31,
+          see memory_age()
+    minus 1 point per hit, up to 30.
+
+    The search only recalls slots that the occupancy map says are used, so
+    empty slots cost no flash reads, and it can look further out than the old
+    20 slots each way.
+*/
+
 #define NUM_OF_MEMORIES 9
-#define MAXIMUM_ATTEMPTS 20
+
+// how far from the frequency's slot to look, in each direction
+#define MEMORY_SEARCH_RADIUS 64
+
+#define UNKNOWN_SWR_SCORE 51
+#define MAXIMUM_HIT_BONUS 30
+
+typedef struct {
+    relays_t relays;
+    uint16_t slot;
+    uint16_t score;
+} candidate_t;
+
+static uint16_t score_memory(memory_t *memory, uint16_t offset, uint16_t frequency) {
+    uint16_t score = UNKNOWN_SWR_SCORE;
+    if (memory->swr != 0.0) {
+        score = 1 + (uint16_t)((memory->swr - 1.0) * 50);
+    }
+
+    if (memory->frequency) {
+        uint16_t difference = frequency - memory->frequency;
+        if (memory->frequency > frequency) {
+            difference = memory->frequency - frequency;
+        }
+        // in tenths of a percent of the operating frequency
+        uint32_t perMille = ((uint32_t)difference * 1000) / frequency;
+        if (perMille > 1000) {
+            perMille = 1000;
+        }
+        score += 4 * (uint16_t)perMille;
+    } else {
+        score += 2 * offset;
+    }
+
+    score += memory_age(memory) / 2;
+
+    uint8_t bonus = memory->hits;
+    if (bonus > MAXIMUM_HIT_BONUS) {
+        bonus = MAXIMUM_HIT_BONUS;
+    }
+    if (score > bonus) {
+        return score - bonus;
+    }
+    return 0;
+}
+
+// recalls <slot>, and inserts it into the sorted <candidates> if it's not empty
+static uint8_t add_candidate(candidate_t *candidates, uint8_t count, uint16_t slot, uint16_t offset) {
+    memory_t memory = recall_memory_record(slot);
+    if (memory.relays.all == 0) {
+        return count;
+    }
+
+    candidate_t candidate;
+    candidate.relays = memory.relays;
+    candidate.slot = slot;
+    candidate.score = score_memory(&memory, offset, currentRF.frequency);
+
+    // insertion sort, ties go to the nearer slot, which was found first
+    uint8_t i = count;
+    while (i > 0 && candidates[i - 1].score > candidate.score) {
+        candidates[i] = candidates[i - 1];
+        i--;
+    }
+    candidates[i] = candidate;
+
+    return count + 1;
+}
 
 tuning_errors_t memory_tune(void) {
     LOG_TRACE({ println("memory_tune"); });
@@ -147,52 +241,42 @@ tuning_errors_t memory_tune(void) {
 
     // Hopefully RF is stable, so refresh our measurements
     measure_RF();
-    measure_frequency();
-    if (currentRF.frequency == 0) {
-        LOG_DEBUG({ println("bad frequency, retrying"); });
-        measure_frequency();
-        errors.noFreq = 1;
+    if (!measure_frequency()) {
+        // without a frequency there's no way to pick a memory slot, so let the
+        // caller fall back to a full tune
         LOG_WARN({ println("no frequency!"); });
+        errors.noMemory = 1;
+        return errors;
     }
 
     LOG_DEBUG({ printf("frequency: %u KHz\r\n", currentRF.frequency); });
+    count_memory_attempt();
 
-    // Create and initialize local storage for recalled memories
-    relays_t memoryBuffer[NUM_OF_MEMORIES];
-    for (uint8_t i = 0; i < NUM_OF_MEMORIES; i++) {
-        memoryBuffer[i].all = 0;
-    }
+    // abandon the tune if the power goes over the limit between comparisons
+    arm_hot_switch_trip(get_hot_switch_limit(currentRF.frequency));
+
+    // Local storage for recalled memories, kept sorted by score
+    candidate_t candidates[NUM_OF_MEMORIES];
 
     // Use this to count how many memories are recalled
     uint8_t memoriesFound = 0;
     uint16_t slot = find_memory_slot(currentRF.frequency);
 
-    relays_t tempRelays = recall_memory(slot);
-    if (tempRelays.all != 0) {
-        memoryBuffer[memoriesFound++] = tempRelays;
-    }
-
-    uint16_t offset = 0;
-
-    for (uint8_t attempts = 0; attempts < MAXIMUM_ATTEMPTS; attempts++) {
-        offset += 1;
-
-        tempRelays = recall_memory(slot + offset);
-        if (tempRelays.all != 0) {
-            memoryBuffer[memoriesFound++] = tempRelays;
-        }
-
-        if (memoriesFound == NUM_OF_MEMORIES) {
-            break;
-        }
+    memoriesFound = add_candidate(candidates, memoriesFound, slot, 0);
 
-        tempRelays = recall_memory(slot - offset);
-        if (tempRelays.all != 0) {
-            memoryBuffer[memoriesFound++] = tempRelays;
+    for (uint8_t offset = 1; offset <= MEMORY_SEARCH_RADIUS; offset++) {
+        if (memory_slot_is_used(slot + offset)) {
+            memoriesFound = add_candidate(candidates, memoriesFound, slot + offset, offset);
+            if (memoriesFound == NUM_OF_MEMORIES) {
+                break;
+            }
         }
 
-        if (memoriesFound == NUM_OF_MEMORIES) {
-            break;
+        if (slot >= offset && memory_slot_is_used(slot - offset)) {
+            memoriesFound = add_candidate(candidates, memoriesFound, slot - offset, offset);
+            if (memoriesFound == NUM_OF_MEMORIES) {
+                break;
+            }
         }
     }
 
@@ -207,24 +291,39 @@ tuning_errors_t memory_tune(void) {
         printf("recalled %u memories:\r\n", memoriesFound);
         for (uint8_t i = 0; i < memoriesFound; i++) {
             printf("\t# %u: ", i);
-            print_relays(memoryBuffer[i]);
-            println("");
+            print_relays(candidates[i].relays);
+            printf(" slot: %u, score: %u\r\n", candidates[i].slot, candidates[i].score);
         }
     });
 
-    // Let's test all the memories we recalled
+    // Test the memories best first, until one of them is good enough
     match_t bestMatch = new_match();
-    for (uint8_t i = 0; i < memoriesFound; i++) {
-        bestMatch = compare_matches(&errors, memoryBuffer[i], bestMatch);
+    uint16_t bestSlot = candidates[0].slot;
+    uint8_t tested = 0;
+    while (tested < memoriesFound) {
+        match_t previousBest = bestMatch;
+        bestMatch = compare_matches(&errors, candidates[tested].relays, bestMatch);
         if (errors.any) {
             return errors;
         }
+        if (bestMatch.relays.all != previousBest.relays.all) {
+            bestSlot = candidates[tested].slot;
+        }
+        tested++;
+
+        if (bestMatch.swr < get_SWR_threshold()) {
+            break;
+        }
     }
 
-    // re-publish the final results
-    if (put_relays(bestMatch.relays) == -1) {
-        errors.relayError = 1;
-        return errors;
+    LOG_INFO({ printf("tested %u of %u memories\r\n", tested, memoriesFound); });
+
+    // re-publish the final results, unless they're still on the relays
+    if (bestSlot != candidates[tested - 1].slot) {
+        if (put_relays(bestMatch.relays) == -1) {
+            errors.relayError = 1;
+            return errors;
+        }
     }
 
     // exit if there's no RF
@@ -246,6 +345,8 @@ tuning_errors_t memory_tune(void) {
             print_relays(currentRelays[systemFlags.antenna]);
             println("");
         });
+        count_memory_hit(bestSlot);
+
         // returning with no errors means success
         return errors;
     }
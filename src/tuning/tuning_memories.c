@@ -1,287 +1,793 @@
 #include "tuning_memories.h"
+#include "crc.h"
+#include "flags.h"
 #include "nvm_table.h"
 #include "os/logging.h"
+#include "peripherals/nonvolatile_memory.h"
 #include "relay_driver.h"
 #include "relays.h"
+#include "rf_sensor.h"
+#include <string.h>
 static uint8_t LOG_LEVEL = L_SILENT;
 
 /* ************************************************************************** */
-/*  Frequency Group definitions
-
-    These definitions contains the tops and bottoms of all the Ham Bands.
-
-    An up-to-date version of this information should be available at:
-    http://www.arrl.org/band-plan
-
-    160 Meters (1.8-2.0 MHz)
-    80 Meters (3.5-4.0 MHz)
-    60 Meters (5 MHz channels)
-    40 Meters (7.0-7.3 MHz)
-    30 Meters (10.1-10.15 MHz)
-    20 Meters (14.0-14.35 MHz)
-    17 Meters (18.068-18.168 MHz)
-    15 Meters (21.0-21.45 MHz)
-    12 Meters (24.89-24.99 MHz)
-    10 Meters (28-29.7 MHz)
-    6 Meters (50-54 MHz)
-
-    ** 60 Meters only contains 5 channels and isn't worth dedicating a group to.
+/*  Notes on memory records
+
+    A table entry is 8 bytes, but only the first two used to be used, for the
+    packed relays. The rest now describe how good the memory is:
+
+        [0] relayBits.bot
+        [1] relayBits.top
+        [2] frequency, KHz, low byte
+        [3] frequency, KHz, high byte
+        [4] achieved SWR, see encode_swr()
+        [5] hit count
+        [6] generation
+        [7] crc8 of [0] to [6]
+
+    Memories saved before this layout have zeros in [2] to [7], and every one
+    of those fields treats 0 as unknown.
+
+    A power loss between the erase and the write of a table block leaves the
+    whole block erased or half written. The crc catches that, and recall
+    treats a broken entry as empty instead of testing whatever relays the
+    garbage unpacks into. Old memories have no crc, so an entry with zeros in
+    [2] to [7] is taken as it is. Empty entries are all zeros, and so is
+    their crc.
+
+    The antenna port goes in relayBits.ant. It used to be stored too, but
+    put_relays() overrides it, so whatever the tuning code had lying around
+    ended up in there. store_memory() now always tags the memory with the
+    active port, and recall skips memories for the other one. Old memories
+    can't be trusted, so they're recalled on both ports, the same as before.
+    A store always records the SWR it measured, so a memory without one is
+    an old memory, even once a migration has given it a frequency. When an
+    old memory wins a memory tune, the frequency and SWR of that tune are
+    written into it, and it's tagged with the port it won on.
+
+    Both ports share one table. If a store lands on a slot that holds a memory
+    for the other port, it moves to the nearest empty slot within
+    ANTENNA_DISPLACEMENT instead, where the neighbor search in memory_tune()
+    will still find it. The stored frequency makes up for the slot being a
+    little off. A neighbor that holds a memory is only reused if it's this
+    port's memory for the same slot, from an earlier displaced store, so
+    storing the same frequency again doesn't leave a trail of copies. Only if
+    there's no room does the other port's memory get overwritten.
+
+    Storing the same relays again for a frequency in the same slot doesn't
+    rewrite the memory. It only gets younger, the same way a hit does.
+
+    The generation is a coarse stamp. It moves on once every
+    EVENTS_PER_GENERATION stores and hits, and memory_age() counts in those.
+    The stamp is 8 bits, so ages stop at MAXIMUM_AGE. Each time the
+    generation reaches a multiple of MAXIMUM_AGE + 1, and after the boot scan,
+    restamp_memories() rewrites the memories older than that as exactly
+    MAXIMUM_AGE. The stamps in use then never span more than 128 values, so
+    the biggest gap between them is always the one above the newest, and the
+    boot scan finds it after a wrap. A table with no gap at all, like one
+    stored by older firmware, is restamped as new. The old memories get
+    rewritten once every 2048 stores and hits, a couple of weeks of heavy use.
+    Hits don't go straight to the table, see the notes on pending hits.
 */
 
-/*  OVERLAP_MARGIN is used to enlarge the band boundarys, just to leave some
-    wiggle room.
-*/
-#define OVERLAP_MARGIN 200U
+// SWR is stored as 1 + (SWR - 1) * SWR_CODE_SCALE, up to SWR 6.08
+#define SWR_CODE_SCALE 50
 
-/*  //! Watch out!
-    These frequency numbers are in KHz instead of Hz or MHz!
+static uint8_t encode_swr(float swr) {
+    if (swr < 1.0) {
+        return 0;
+    }
 
-    If you're used to thinking in MHz(eg one-point-eight megahertz), don't
-    forget to mentally divide by 1000.
-*/
-#define _160M_BOT 1800U - OVERLAP_MARGIN
-#define _160M_TOP 2000U + OVERLAP_MARGIN
-#define _80M_BOT 3500U - OVERLAP_MARGIN
-#define _80M_TOP 4000U + OVERLAP_MARGIN
-#define _40M_BOT 7000U - OVERLAP_MARGIN
-#define _40M_TOP 7300U + OVERLAP_MARGIN
-#define _30M_BOT 10010U - OVERLAP_MARGIN
-#define _30M_TOP 10150U + OVERLAP_MARGIN
-#define _20M_BOT 14000U - OVERLAP_MARGIN
-#define _20M_TOP 14350U + OVERLAP_MARGIN
-#define _17M_BOT 18068U - OVERLAP_MARGIN
-#define _17M_TOP 18168U + OVERLAP_MARGIN
-#define _15M_BOT 21000U - OVERLAP_MARGIN
-#define _15M_TOP 21450U + OVERLAP_MARGIN
-#define _12M_BOT 24890U - OVERLAP_MARGIN
-#define _12M_TOP 24990U + OVERLAP_MARGIN
-#define _10M_BOT 28000U - OVERLAP_MARGIN
-#define _10M_TOP 29700U + OVERLAP_MARGIN
-#define _6M_BOT 50000U - OVERLAP_MARGIN
-#define _6M_TOP 54000U + OVERLAP_MARGIN
-
-#define FREQ_MIN 1U
-#define FREQ_MAX 55000U
+    float code = 1.0 + (swr - 1.0) * SWR_CODE_SCALE + 0.5;
+    if (code > UINT8_MAX) {
+        return UINT8_MAX;
+    }
+    return (uint8_t)code;
+}
+
+static float decode_swr(uint8_t code) {
+    if (code == 0) {
+        return 0.0;
+    }
+    return 1.0 + (float)(code - 1) / SWR_CODE_SCALE;
+}
+
+#define ENTRY_CRC_INDEX (TABLE_ENTRY_SIZE - 1)
+
+static bool entry_is_intact(table_entry_t *entry) {
+    if (crc8(entry->contents, ENTRY_CRC_INDEX) == entry->contents[ENTRY_CRC_INDEX]) {
+        return true;
+    }
+
+    // an old memory, from before the crc
+    for (uint8_t i = 2; i < TABLE_ENTRY_SIZE; i++) {
+        if (entry->contents[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static memory_t unpack_memory(table_entry_t *entry) {
+    memory_t memory;
+
+    relay_bits_t relayBits;
+    relayBits.bot = entry->contents[0];
+    relayBits.top = entry->contents[1];
+    memory.relays = unpack_relays(relayBits);
+
+    memory.frequency = entry->contents[2] | ((uint16_t)entry->contents[3] << 8);
+    memory.swr = decode_swr(entry->contents[4]);
+    memory.hits = entry->contents[5];
+    memory.generation = entry->contents[6];
+
+    return memory;
+}
+
+static table_entry_t pack_memory(memory_t *memory) {
+    table_entry_t entry = new_table_entry();
+
+    relay_bits_t relayBits = pack_relays(memory->relays);
+    entry.contents[0] = relayBits.bot;
+    entry.contents[1] = relayBits.top;
+
+    entry.contents[2] = memory->frequency & 0xff;
+    entry.contents[3] = memory->frequency >> 8;
+    entry.contents[4] = encode_swr(memory->swr);
+    entry.contents[5] = memory->hits;
+    entry.contents[6] = memory->generation;
+    entry.contents[ENTRY_CRC_INDEX] = crc8(entry.contents, ENTRY_CRC_INDEX);
+
+    return entry;
+}
 
 /* -------------------------------------------------------------------------- */
-/*  Each frequency_group_t object contains that groups start frequency, end
-    frequency, and the number of slots that in the memory map that should be
-    allocated to that group.
-*/
-typedef struct {
-    uint16_t start;
-    uint16_t end;
-    uint8_t slots;
-} frequency_group_t;
 
-// output: "(1800, 2000), 100 slots"
-void print_frequency_group(const frequency_group_t *group) {
-    printf("(%05u, %05u), %u slots", group->start, group->end, group->slots);
+// how far a store will move to avoid the other port's memory
+#define ANTENNA_DISPLACEMENT 2
+
+// saved before the antenna port was, see the notes above
+static bool is_legacy_memory(memory_t *memory) { return memory->swr == 0.0; }
+
+static bool belongs_to_antenna(memory_t *memory, uint8_t antenna) {
+    return is_legacy_memory(memory) || (memory->relays.ant == antenna);
 }
 
 /* -------------------------------------------------------------------------- */
+/*  Notes on pending hits
+
+    Every successful memory tune credits the winning memory with a hit and a
+    new generation, and storing a memory again makes it the newest. Writing that straight to the table cost a block erase per
+    memory tune, because the new generation and crc almost always turn a 0
+    into a 1, and memory tunes land on the busiest blocks in the table.
+
+    Hits are kept in RAM instead, in a small table of pending hits, and
+    read_memory() applies them, so the ranking sees them right away. They
+    reach flash when:
+        - the memory is written anyway, by a store, which keeps its hits,
+          or by restamp_memories()
+        - the pending table is full, the least recently hit one goes
+        - the unit is turned off, see set_power_off()
+        - the table is migrated or exported
+    That's one write per memory per session, instead of one per memory tune.
+    Hits since the last power off are lost if the power is cut, which only
+    costs a little ranking. calibration/check_memory_log.py simulates both.
+*/
 
-// This big table is used to define the boundaries between bands
-#define NUMBER_OF_GROUPS 21
-const frequency_group_t group_edges[NUMBER_OF_GROUPS] = {
-    // {Top frequency, Bottom Freq, number of slots}
-    {FREQ_MIN, _160M_BOT, 200},  // (0 - 1.8 MHz) 1.8 MHz
-    {_160M_BOT, _160M_TOP, 100}, // (1.8 - 2.0 MHz) 0.2 MHz
-    {_160M_TOP, _80M_BOT, 200},  // (2.0 - 3.5 MHz) 1.5 MHz
-    {_80M_BOT, _80M_TOP, 200},   // (3.5 - 4.0 MHz) 0.5 MHz
-    {_80M_TOP, _40M_BOT, 200},   // (4.0 - 7.0 MHz) 3.0 MHz
-    {_40M_BOT, _40M_TOP, 100},   // (7.0 - 7.3 MHz) 0.3 MHz
-    {_40M_TOP, _30M_BOT, 200},   // (7.3 - 10.1 MHz) 2.8 MHz
-    {_30M_BOT, _30M_TOP, 100},   // (10.1 - 10.15 MHz) 0.05 MHz
-    {_30M_TOP, _20M_BOT, 200},   // (10.15 - 14.0 MHz) 3.85 MHz
-    {_20M_BOT, _20M_TOP, 100},   // (14.0 - 14.35 MHz) 0.35 MHz
-    {_20M_TOP, _17M_BOT, 200},   // (14.35 - 18.068 MHz) 3.718 MHz
-    {_17M_BOT, _17M_TOP, 100},   // (18.068 - 18.168 MHz) 0.1 MHz
-    {_17M_TOP, _15M_BOT, 200},   // (18.168 - 21.0 MHz) 2.832 MHz
-    {_15M_BOT, _15M_TOP, 200},   // (21.0 - 21.45 MHz) 0.45 MHz
-    {_15M_TOP, _12M_BOT, 200},   // (21.45 - 24.89 MHz) 3.44 MHz
-    {_12M_BOT, _12M_TOP, 100},   // (24.89 - 24.99 MHz) 0.1 MHz
-    {_12M_TOP, _10M_BOT, 200},   // (24.99 - 28 MHz) 3.01 MHz
-    {_10M_BOT, _10M_TOP, 200},   // (28 - 29.7 MHz) 1.7 MHz
-    {_10M_TOP, _6M_BOT, 200},    // (29.7 - 50 MHz) 20.3 MHz
-    {_6M_BOT, _6M_TOP, 200},     // (50 - 54 MHz) 4 MHz
-    {_6M_TOP, FREQ_MAX, 100},    // (54 - 55 MHz) 1 MHz
-};
-
-void print_all_frequency_groups(void) {
-    uint16_t totalSlots = 0;
-
-    println("---------------------------------------------------------------");
-    println("## | (start freq -> end freq) | width     | slots | width/slot");
-    println("---|--------------------------|-----------|-------|------------");
-
-    for (uint8_t group = 0; group < NUMBER_OF_GROUPS; group++) {
-        totalSlots += group_edges[group].slots;
-        frequency_group_t tempGroup = group_edges[group];
-        uint16_t groupWidth = tempGroup.end - tempGroup.start;
-
-        printf("%02u", group);
-        printf(" | (%05u KHz -> %05u KHz)", tempGroup.start, tempGroup.end);
-        printf(" | %05u KHz", groupWidth);
-        printf(" |  %u ", tempGroup.slots);
-        printf(" | %2u KHz/slot", (groupWidth / tempGroup.slots));
-        println("");
+#define PENDING_HITS 16
+
+typedef struct {
+    uint16_t slot;
+    uint8_t hits;       // added to the stored hit count
+    uint8_t generation; // replaces the stored generation
+} pending_hit_t;
+
+static pending_hit_t pendingHits[PENDING_HITS];
+static uint8_t numOfPendingHits = 0;
+
+static pending_hit_t *find_pending_hit(uint16_t slot) {
+    for (uint8_t i = 0; i < numOfPendingHits; i++) {
+        if (pendingHits[i].slot == slot) {
+            return &pendingHits[i];
+        }
+    }
+    return NULL;
+}
+
+// forgets the pending hit for <slot>, if it has one
+static void drop_pending_hit(uint16_t slot) {
+    pending_hit_t *hit = find_pending_hit(slot);
+    if (hit) {
+        *hit = pendingHits[--numOfPendingHits];
+    }
+}
+
+static void apply_pending_hit(uint16_t slot, memory_t *memory) {
+    pending_hit_t *hit = find_pending_hit(slot);
+    if (!hit) {
+        return;
     }
 
-    println("---------------------------------------------------------------");
-    printf("totalSlots: %u\r\n", totalSlots);
-    println("---------------------------------------------------------------");
-}
-
-/* print_all_frequency_groups() outputs:
----------------------------------------------------------------
-## | (start freq -> end freq) | width     | slots | width/slot
----|--------------------------|-----------|-------|------------
-00 | (00001 KHz -> 01600 KHz) | 01599 KHz |  200  |  7 KHz/slot
-01 | (01600 KHz -> 02200 KHz) | 00600 KHz |  100  |  6 KHz/slot
-02 | (02200 KHz -> 03300 KHz) | 01100 KHz |  200  |  5 KHz/slot
-03 | (03300 KHz -> 04200 KHz) | 00900 KHz |  200  |  4 KHz/slot
-04 | (04200 KHz -> 06800 KHz) | 02600 KHz |  200  | 13 KHz/slot
-05 | (06800 KHz -> 07500 KHz) | 00700 KHz |  100  |  7 KHz/slot
-06 | (07500 KHz -> 09810 KHz) | 02310 KHz |  200  | 11 KHz/slot
-07 | (09810 KHz -> 10350 KHz) | 00540 KHz |  100  |  5 KHz/slot
-08 | (10350 KHz -> 13800 KHz) | 03450 KHz |  200  | 17 KHz/slot
-09 | (13800 KHz -> 14550 KHz) | 00750 KHz |  100  |  7 KHz/slot
-10 | (14550 KHz -> 17868 KHz) | 03318 KHz |  200  | 16 KHz/slot
-11 | (17868 KHz -> 18368 KHz) | 00500 KHz |  100  |  5 KHz/slot
-12 | (18368 KHz -> 20800 KHz) | 02432 KHz |  200  | 12 KHz/slot
-13 | (20800 KHz -> 21650 KHz) | 00850 KHz |  200  |  4 KHz/slot
-14 | (21650 KHz -> 24690 KHz) | 03040 KHz |  200  | 15 KHz/slot
-15 | (24690 KHz -> 25190 KHz) | 00500 KHz |  100  |  5 KHz/slot
-16 | (25190 KHz -> 27800 KHz) | 02610 KHz |  200  | 13 KHz/slot
-17 | (27800 KHz -> 29900 KHz) | 02100 KHz |  200  | 10 KHz/slot
-18 | (29900 KHz -> 49800 KHz) | 19900 KHz |  200  | 99 KHz/slot
-19 | (49800 KHz -> 54200 KHz) | 04400 KHz |  200  | 22 KHz/slot
-20 | (54200 KHz -> 55000 KHz) | 00800 KHz |  100  |  8 KHz/slot
----------------------------------------------------------------
-totalSlots: 3500
----------------------------------------------------------------
+    uint16_t hits = memory->hits + hit->hits;
+    memory->hits = (hits > UINT8_MAX) ? UINT8_MAX : hits;
+    memory->generation = hit->generation;
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on the occupancy map
+
+    Most of the table is empty, so most of the slots that memory_tune() and
+    the frequency tracker look at cost a flash read and find nothing. The
+    occupancy map is one bit per slot, 438 bytes of RAM, set if the slot holds
+    an intact memory for either port. A slot whose bit is clear is empty
+    without reading it.
+
+    The map is built by the same boot scan that finds the current generation,
+    and every write to the table from here goes through write_memory_entry()
+    to keep it current. memory_transfer.c imports through it too, so does the
+    shell's 'memory write', and the scrub clears the bits of the entries it
+    empties. A broken entry never gets a bit, so recall skips it without
+    reading it.
 */
 
-/* ************************************************************************** */
+static uint8_t occupancy[(NUMBER_OF_TABLE_ENTRIES + 7) / 8];
+static uint16_t usedSlots = 0;
 
-typedef struct {
-    uint16_t inMin;
-    uint16_t inMax;
-    uint16_t outMin;
-    uint16_t outMax;
-} map_parameters_t;
+static bool entry_is_used(table_entry_t *entry) {
+    return entry_is_intact(entry) && (entry->contents[0] || entry->contents[1]);
+}
 
-void print_map_parameters(map_parameters_t *map) {
-    printf("(%u,%u) -> (%u,%u)", map->inMin, map->inMax, map->outMin, map->outMax);
+bool memory_slot_is_used(uint16_t slot) {
+    if (slot >= NUMBER_OF_TABLE_ENTRIES) {
+        return false;
+    }
+    return occupancy[slot >> 3] & (1 << (slot & 7));
 }
 
-map_parameters_t look_up_map_parameters(uint16_t frequency) {
-    map_parameters_t map;
-    map.outMin = 0;
+uint16_t count_used_memory_slots(void) { return usedSlots; }
 
-    for (uint8_t group = 0; group < NUMBER_OF_GROUPS; group++) {
-        if (group_edges[group].end > frequency) {
-            map.inMin = group_edges[group].start;
-            map.inMax = group_edges[group].end;
-            map.outMax = map.outMin + group_edges[group + 1].slots;
-            break;
-        }
-        map.outMin += group_edges[group].slots;
+static void mark_memory_slot(uint16_t slot, bool isUsed) {
+    if (isUsed == memory_slot_is_used(slot)) {
+        return;
     }
 
-    return map;
+    occupancy[slot >> 3] ^= 1 << (slot & 7);
+    if (isUsed) {
+        usedSlots++;
+    } else {
+        usedSlots--;
+    }
 }
 
-// proportionally translates a number from range a to range b
-uint16_t map_range(int32_t x, int32_t a1, int32_t a2, int32_t b1, int32_t b2) {
-    return (uint16_t)(b1 + (x - a1) * (b2 - b1) / (a2 - a1));
+void write_memory_entry(uint16_t slot, table_entry_t entry) {
+    nvm_table_write(slot, entry);
+    mark_memory_slot(slot, entry_is_used(&entry));
+
+    // whoever wrote <entry> already read the pending hit, or replaced it
+    drop_pending_hit(slot);
 }
 
-/* ************************************************************************** */
+/* -------------------------------------------------------------------------- */
 
-// convert a frequency into a valid memory slot
-uint16_t find_memory_slot(uint16_t frequency) {
-    LOG_TRACE({ println("find_memory_slot"); });
+memory_scrub_stats_t memoryScrubStats;
 
-    LOG_DEBUG({ printf("frequency: %u KHz\r\n", frequency); });
-    if (frequency == UINT16_MAX || frequency == 0) {
-        LOG_ERROR({ println("invalid frequency"); });
-        return 0;
+// reads <slot>, whichever port it's for, a broken entry comes back empty
+static memory_t read_memory(uint16_t slot) {
+    table_entry_t entry = new_table_entry();
+
+    // empty slots don't need a flash read
+    if (!memory_slot_is_used(slot)) {
+        return unpack_memory(&entry);
     }
 
-    map_parameters_t map = look_up_map_parameters(frequency);
+    entry = nvm_table_read(slot);
+    if (!entry_is_intact(&entry)) {
+        LOG_WARN({ printf("slot %u is corrupted\r\n", slot); });
+        entry = new_table_entry();
+    }
 
-    uint16_t slot = map_range(frequency, map.inMin, map.inMax, map.outMin, map.outMax);
+    memory_t memory = unpack_memory(&entry);
+    apply_pending_hit(slot, &memory);
+    return memory;
+}
 
-    LOG_DEBUG({ printf("slot: %u\r\n", slot); });
+/* -------------------------------------------------------------------------- */
 
-    return slot;
+#define EVENTS_PER_GENERATION 32
+#define MAXIMUM_AGE 63
+
+// the generation of the newest memory in the table
+static uint8_t currentGeneration = 0;
+static uint8_t generationEvents = 0;
+
+uint8_t memory_age(memory_t *memory) {
+    return currentGeneration - memory->generation;
 }
 
-/* -------------------------------------------------------------------------- */
+// memories older than <oldest> are rewritten as <oldest>
+static void restamp_memories(uint8_t oldest) {
+    uint16_t restamped = 0;
+
+    for (uint16_t slot = 0; slot < NUMBER_OF_TABLE_ENTRIES; slot++) {
+        memory_t memory = read_memory(slot);
+        if (memory.relays.all == 0 || memory_age(&memory) <= oldest) {
+            continue;
+        }
+
+        // this saves its pending hit too
+        memory.generation = currentGeneration - oldest;
+        write_memory_entry(slot, pack_memory(&memory));
+        restamped++;
+    }
 
-void address_conversion_test(uint16_t start, uint16_t end, uint16_t step) {
-    println("");
-    println("-----------------------------------------------");
-    printf("(%u,%u) -> (%u)\r\n", start, end, step);
+    LOG_INFO({ printf("restamped %u memories\r\n", restamped); });
+}
 
-    for (uint16_t freq = start; freq < end; freq += step) {
-        printf(" %u -> %u\r\n", freq, find_memory_slot(freq));
+// counts a store or a hit, returns the generation to stamp it with
+static uint8_t next_generation(void) {
+    if (++generationEvents < EVENTS_PER_GENERATION) {
+        return currentGeneration;
     }
+    generationEvents = 0;
 
-    println("-----------------------------------------------");
+    if ((++currentGeneration & MAXIMUM_AGE) == 0) {
+        restamp_memories(MAXIMUM_AGE);
+    }
+    return currentGeneration;
+}
+
+// builds the occupancy map, and finds the newest generation, even if the
+// stamps have wrapped around
+static void scan_memory_table(void) {
+    uint8_t inUse[32];
+    memset(inUse, 0, sizeof(inUse));
+    memset(occupancy, 0, sizeof(occupancy));
+    usedSlots = 0;
+
+    for (uint16_t slot = 0; slot < NUMBER_OF_TABLE_ENTRIES; slot++) {
+        table_entry_t entry = nvm_table_read(slot);
+        if (entry_is_used(&entry)) {
+            inUse[entry.contents[6] >> 3] |= 1 << (entry.contents[6] & 7);
+            mark_memory_slot(slot, true);
+        }
+    }
+
+    LOG_INFO({ printf("%u memories\r\n", usedSlots); });
+
+    if (!usedSlots) {
+        return;
+    }
+
+    // the newest stamp is the one right before the longest run of unused ones
+    uint16_t longestGap = 0;
+    uint16_t gap = 0;
+    for (uint16_t i = 0; i < 512; i++) {
+        uint8_t stamp = i & 0xff;
+        if (inUse[stamp >> 3] & (1 << (stamp & 7))) {
+            gap = 0;
+            continue;
+        }
+        if (++gap > longestGap && gap < 256) {
+            longestGap = gap;
+            currentGeneration = stamp - gap;
+        }
+    }
+
+    LOG_INFO({ printf("current generation: %u\r\n", currentGeneration); });
+
+    // every stamp is in use, so there's no telling which is the newest
+    if (!longestGap) {
+        restamp_memories(0);
+        return;
+    }
+    restamp_memories(MAXIMUM_AGE);
 }
 
 /* ************************************************************************** */
 
+static void migrate_original_memories(void);
+
 void tuning_memories_init(void) {
     // initialize the persistent data structures used to store memories
     nvm_table_init();
 
-    // print_all_frequency_groups();
-
     //
     log_register();
+
+    band_plan_init();
+
+    scan_memory_table();
+    migrate_original_memories();
 }
 
+void reload_memories(void) { scan_memory_table(); }
+
+/* ************************************************************************** */
+
+memory_hit_stats_t memoryHitStats[NUM_OF_ANTENNA_PORTS];
+
+void count_memory_attempt(void) { memoryHitStats[systemFlags.antenna].attempts++; }
+
 /* ************************************************************************** */
 
 // Recall
-relays_t recall_memory(uint16_t slot) {
-    // get the raw memory
-    table_entry_t memory = nvm_table_read(slot);
+memory_t recall_memory_record(uint16_t slot) {
+    memory_t memory = read_memory(slot);
 
-    // unpack the memory contents
-    relay_bits_t relayBits;
-    relayBits.bot = memory.contents[0];
-    relayBits.top = memory.contents[1];
-    relays_t relays = unpack_relays(relayBits);
+    if (!belongs_to_antenna(&memory, systemFlags.antenna)) {
+        memory.relays.all = 0;
+    }
 
     LOG_DEBUG({
-        print_relays(relays);
+        print_relays(memory.relays);
         printf(" recalled from: %u", slot);
         println("");
     });
-    return relays;
+    return memory;
 }
 
+relays_t recall_memory(uint16_t slot) { return recall_memory_record(slot).relays; }
+
 /* -------------------------------------------------------------------------- */
 
+#define NO_SLOT UINT16_MAX
+
+// true if <memory> is <antenna>'s memory for a frequency that maps to <slot>,
+// one that an earlier store already displaced
+static bool is_displaced_memory(memory_t *memory, uint16_t slot, uint8_t antenna) {
+    if (memory->relays.all == 0 || is_legacy_memory(memory)) {
+        return false;
+    }
+    return (memory->relays.ant == antenna) && (find_memory_slot(memory->frequency) == slot);
+}
+
+// looks within ANTENNA_DISPLACEMENT of <slot>, nearest first, for an empty
+// slot, or with <reuse>, for a memory is_displaced_memory() can replace
+static uint16_t find_displaced_slot(uint16_t slot, uint8_t antenna, bool reuse) {
+    for (uint8_t offset = 1; offset <= ANTENNA_DISPLACEMENT; offset++) {
+        // slot - offset wraps past the end of the table below slot 0
+        uint16_t neighbors[2] = {slot + offset, slot - offset};
+
+        for (uint8_t i = 0; i < 2; i++) {
+            uint16_t neighbor = neighbors[i];
+            if (neighbor >= NUMBER_OF_TABLE_ENTRIES) {
+                continue;
+            }
+
+            if (!reuse && !memory_slot_is_used(neighbor)) {
+                return neighbor;
+            }
+            if (reuse) {
+                memory_t memory = read_memory(neighbor);
+                if (is_displaced_memory(&memory, slot, antenna)) {
+                    return neighbor;
+                }
+            }
+        }
+    }
+    return NO_SLOT;
+}
+
+// picks where a memory for <slot> on <antenna> goes
+static uint16_t choose_store_slot(uint16_t slot, uint8_t antenna) {
+    // the slot itself, unless the other port's memory is in it
+    memory_t memory = read_memory(slot);
+    if (memory.relays.all == 0 || belongs_to_antenna(&memory, antenna)) {
+        return slot;
+    }
+
+    // replace an earlier displaced store, instead of adding another copy
+    uint16_t displaced = find_displaced_slot(slot, antenna, true);
+    if (displaced != NO_SLOT) {
+        return displaced;
+    }
+
+    // neighbors with memories for other frequencies are never overwritten
+    displaced = find_displaced_slot(slot, antenna, false);
+    if (displaced != NO_SLOT) {
+        return displaced;
+    }
+
+    LOG_INFO({ printf("overwriting the other port's memory in slot %u\r\n", slot); });
+    return slot;
+}
+
+// writes the pending hit for <slot> to the table
+static void save_pending_hit(uint16_t slot) {
+    memory_t memory = read_memory(slot);
+
+    // write_memory_entry() drops the pending hit
+    write_memory_entry(slot, pack_memory(&memory));
+}
+
+void save_memory_hits(void) {
+    while (numOfPendingHits) {
+        save_pending_hit(pendingHits[0].slot);
+    }
+}
+
+// adds <hits> to the pending hit for <slot>, and makes it the newest memory
+static void add_pending_hit(uint16_t slot, uint8_t hits) {
+    // this can restamp, and move the pending hits around
+    uint8_t generation = next_generation();
+
+    pending_hit_t *hit = find_pending_hit(slot);
+    if (!hit) {
+        // make room by saving the least recently hit memory
+        if (numOfPendingHits == PENDING_HITS) {
+            uint8_t oldest = 0;
+            for (uint8_t i = 1; i < PENDING_HITS; i++) {
+                if ((uint8_t)(generation - pendingHits[i].generation) >
+                    (uint8_t)(generation - pendingHits[oldest].generation)) {
+                    oldest = i;
+                }
+            }
+            save_pending_hit(pendingHits[oldest].slot);
+        }
+
+        hit = &pendingHits[numOfPendingHits++];
+        hit->slot = slot;
+        hit->hits = 0;
+    }
+
+    uint16_t total = hit->hits + hits;
+    hit->hits = (total > UINT8_MAX) ? UINT8_MAX : total;
+    hit->generation = generation;
+}
+
+// true if storing <relays> for <frequency> wouldn't change <memory>
+static bool is_same_memory(memory_t *memory, relays_t relays, uint16_t frequency) {
+    if (memory->relays.all != relays.all || is_legacy_memory(memory)) {
+        return false;
+    }
+    return find_memory_slot(memory->frequency) == find_memory_slot(frequency);
+}
+
 // Store
-void store_memory(uint16_t slot, relays_t relays) {
+void store_memory(uint16_t slot, relays_t relays, uint16_t frequency, float swr) {
+    relays.ant = systemFlags.antenna;
+    slot = choose_store_slot(slot, systemFlags.antenna);
+
+    // the same memory again only needs to get younger
+    memory_t existing = read_memory(slot);
+    if (is_same_memory(&existing, relays, frequency)) {
+        LOG_DEBUG({ printf("refreshed: %u\r\n", slot); });
+        add_pending_hit(slot, 0);
+        return;
+    }
+
     LOG_DEBUG({
         print_relays(relays);
-        printf(" stored at: %u", slot);
+        printf(" stored at: %u, %u KHz, SWR %f", slot, frequency, swr);
         println("");
     });
 
-    // pack the memory
-    relay_bits_t relayBits = pack_relays(relays);
-    table_entry_t memory = new_table_entry();
-    memory.contents[0] = relayBits.bot;
-    memory.contents[1] = relayBits.top;
+    memory_t memory;
+    memory.relays = relays;
+    memory.frequency = frequency;
+    memory.swr = swr;
+    memory.hits = 0;
+    memory.generation = next_generation();
+
+    // the same relays in the same slot keep their history
+    existing = read_memory(slot);
+    if (existing.relays.all == relays.all) {
+        memory.hits = existing.hits;
+    }
 
     // write the memory to the array
-    nvm_table_write(slot, memory);
-}
\ No newline at end of file
+    table_entry_t entry = pack_memory(&memory);
+    write_memory_entry(slot, entry);
+}
+
+void count_memory_hit(uint16_t slot) {
+    memoryHitStats[systemFlags.antenna].hits++;
+
+    if (!memory_slot_is_used(slot)) {
+        return;
+    }
+
+    // a legacy memory that just proved itself is written right away, once
+    memory_t memory = read_memory(slot);
+    if (is_legacy_memory(&memory) && currentRF.frequency) {
+        memory.relays.ant = systemFlags.antenna;
+        memory.frequency = currentRF.frequency;
+        memory.swr = currentRF.swr;
+        if (memory.hits < UINT8_MAX) {
+            memory.hits++;
+        }
+        memory.generation = next_generation();
+
+        write_memory_entry(slot, pack_memory(&memory));
+        return;
+    }
+
+    add_pending_hit(slot, 1);
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on the scrub
+
+    Recall only notices a broken entry when something asks for it. The scrub
+    walks the whole table in the background, one flash block of entries per
+    call from the idle loop, and empties every broken entry it finds. The
+    fixes go through the write-back cache like any other store, so they reach
+    flash with the next flush.
+
+    One block is 16 entry reads and 16 crcs, well under a mS, and the idle
+    loop only calls it while there's no RF.
+*/
+
+#define SCRUB_SLOTS_PER_CALL (FLASH_ERASE_BLOCKSIZE / TABLE_ENTRY_SIZE)
+
+static uint16_t scrubSlot = 0;
+
+void scrub_memories(void) {
+    for (uint8_t i = 0; i < SCRUB_SLOTS_PER_CALL; i++) {
+        table_entry_t entry = nvm_table_read(scrubSlot);
+
+        if (!entry_is_intact(&entry)) {
+            LOG_WARN({ printf("scrub: emptied corrupted slot %u\r\n", scrubSlot); });
+            memoryScrubStats.repairs++;
+            write_memory_entry(scrubSlot, new_table_entry());
+        }
+
+        if (++scrubSlot >= NUMBER_OF_TABLE_ENTRIES) {
+            scrubSlot = 0;
+            memoryScrubStats.passes++;
+            break;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/*  Notes on migrating memories
+
+    When the band plan changes, every memory has to move to the slot its
+    frequency has under the new plan. Memories that know their frequency use
+    it. Older ones use the center of their old slot, under the old plan, and
+    a moved one gets that frequency written into it. Working out the target
+    again after the move then gives the same answer, instead of treating the
+    new slot as an old one. A moved legacy memory still doesn't know its port,
+    so it stays on both.
+
+    Memories from before the band plan were placed by a different mapping, see
+    the notes on the original mapping in band_plan.c. The fix moved most of
+    them by up to 100 slots, out of reach of the neighbor search, and into the
+    next group's slots. So the first boot with a memory table that hasn't
+    been converted runs one migration from the original mapping, and then
+    sets MEMORY_FORMAT_MARKER in EEPROM. A slot the original mapping never
+    used can't be traced back to a frequency, so its memory is dropped. If
+    the power goes in the middle, the next boot does it again, and the
+    memories that already moved know their frequency.
+
+    The moves happen in place. Both plans put frequencies in the same order,
+    so memories only ever move past each other if they land on the same slot.
+    The first pass goes up the table and moves memories down, into slots that
+    it's already finished with. The second pass goes down the table and moves
+    memories up, the same way. A memory that one pass already moved is in its
+    target slot, or displaced next to it, so it stays put.
+
+    A moved memory goes through choose_store_slot(), like a store, so a memory
+    for one port that lands on the other port's memory is displaced next to
+    it. When two memories for the same port land on the same slot, the newer
+    one wins. If there's no room to displace a memory, the one already in the
+    slot stays.
+*/
+
+// returns NO_SLOT if there's no telling where the memory in <slot> belongs
+static uint16_t migration_target(uint16_t slot, memory_t *memory, band_plan_t *oldPlan) {
+    if (memory->frequency) {
+        return find_memory_slot(memory->frequency);
+    }
+
+    uint16_t frequency = find_slot_frequency(oldPlan, slot);
+    if (!frequency) {
+        return NO_SLOT;
+    }
+    return find_memory_slot(frequency);
+}
+
+// moves the memory in <from> to <target>, or next to it
+// returns false if it was already there
+static bool move_memory(uint16_t from, uint16_t target, band_plan_t *oldPlan) {
+    memory_t incoming = read_memory(from);
+
+    if (!incoming.frequency) {
+        incoming.frequency = find_slot_frequency(oldPlan, from);
+    }
+
+    uint16_t to = choose_store_slot(target, incoming.relays.ant);
+    if (to == from) {
+        return false;
+    }
+
+    memory_t existing = read_memory(to);
+    if (existing.relays.all == 0) {
+        write_memory_entry(to, pack_memory(&incoming));
+    } else if (!belongs_to_antenna(&existing, incoming.relays.ant)) {
+        LOG_WARN({ printf("no room for slot %u's memory near slot %u\r\n", from, target); });
+    } else if (memory_age(&incoming) < memory_age(&existing)) {
+        write_memory_entry(to, pack_memory(&incoming));
+    }
+
+    write_memory_entry(from, new_table_entry());
+    return true;
+}
+
+uint16_t migrate_memories(band_plan_t *oldPlan) {
+    uint16_t moved = 0;
+
+    // the moves copy raw entries, so the hits have to be in them
+    save_memory_hits();
+
+    // first pass, moving down, and dropping what can't be moved
+    for (uint16_t slot = 0; slot < NUMBER_OF_TABLE_ENTRIES; slot++) {
+        memory_t memory = read_memory(slot);
+        if (memory.relays.all == 0) {
+            continue;
+        }
+
+        uint16_t target = migration_target(slot, &memory, oldPlan);
+        if (target == NO_SLOT) {
+            LOG_WARN({ printf("dropped the memory in slot %u\r\n", slot); });
+            write_memory_entry(slot, new_table_entry());
+            continue;
+        }
+        if (target < slot && move_memory(slot, target, oldPlan)) {
+            moved++;
+        }
+    }
+
+    // second pass, moving up
+    for (uint16_t slot = NUMBER_OF_TABLE_ENTRIES; slot > 0; slot--) {
+        memory_t memory = read_memory(slot - 1);
+        if (memory.relays.all == 0) {
+            continue;
+        }
+
+        uint16_t target = migration_target(slot - 1, &memory, oldPlan);
+        if (target > slot - 1 && move_memory(slot - 1, target, oldPlan)) {
+            moved++;
+        }
+    }
+
+    LOG_INFO({ printf("migrated %u memories\r\n", moved); });
+    return moved;
+}
+
+// set once the table uses find_memory_slot()'s mapping, far from rf_freq.c's
+#define MEMORY_FORMAT_ADDRESS 0x3C0
+#define MEMORY_FORMAT_MARKER 0xB6
+
+static void migrate_original_memories(void) {
+    if (internal_eeprom_read(MEMORY_FORMAT_ADDRESS) == MEMORY_FORMAT_MARKER) {
+        return;
+    }
+
+    uint16_t moved = migrate_memories(NULL);
+    flush_memories();
+
+    internal_eeprom_write(MEMORY_FORMAT_ADDRESS, MEMORY_FORMAT_MARKER);
+
+    LOG_INFO({ printf("moved %u memories from the original mapping\r\n", moved); });
+}
+
+/* -------------------------------------------------------------------------- */
+
+// flush when the radio is idle, or when a memory has been waiting too long
+bool memories_need_flushing(void) {
+    if (!nvm_table_is_dirty()) {
+        return false;
+    }
+    return RF_is_absent() || nvm_table_flush_is_due();
+}
+
+void flush_memories(void) { nvm_table_flush(); }
+
+// compact while the radio is idle, before the log fills up during a tune
+bool memories_need_compacting(void) {
+    return RF_is_absent() && nvm_table_needs_compaction();
+}
+
+void compact_memories(void) { nvm_table_compact(); }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #ifndef _TUNING_MEMORIES_H_
 #define _TUNING_MEMORIES_H_
 
+#include "band_plan.h"
+#include "nvm_table.h"
 #include "relays.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 /* ************************************************************************** */
@@ -11,13 +14,96 @@ extern void tuning_memories_init(void);
 
 /* ************************************************************************** */
 
-// Return the memory slot associated with the given frequency
-extern uint16_t find_memory_slot(uint16_t frequency);
+// find_memory_slot() and find_slot_width() are in band_plan.h
+
+/*  memory_t is the unpacked contents of one memory slot
+
+    recall_memory() only returns the relays, use recall_memory_record() to get
+    everything else. A memory is empty if its relays are all 0. Memories saved
+    before these fields existed have 0 in all of them, which means unknown.
+
+    Both recall functions only return memories for the active antenna port, a
+    memory stored on the other port comes back empty.
+*/
+typedef struct {
+    relays_t relays;
+    uint16_t frequency; // KHz, where the memory was stored
+    float swr;          // achieved SWR, 0 if unknown
+    uint8_t hits;       // memory tunes it won, saturates at 255
+    uint8_t generation; // store stamp, see memory_age()
+} memory_t;
 
 // Recall
 extern relays_t recall_memory(uint16_t slot);
+extern memory_t recall_memory_record(uint16_t slot);
+
+// how many generations ago the memory was written or last won a memory tune,
+// a generation is 32 stores and hits, ages stop at 63
+extern uint8_t memory_age(memory_t *memory);
+
+// Store, <swr> is the SWR that <relays> achieved at <frequency>
+extern void store_memory(uint16_t slot, relays_t relays, uint16_t frequency, float swr);
+
+// credit the memory in <slot> with a successful memory tune
+// the hit stays in RAM until save_memory_hits(), or the memory is written
+extern void count_memory_hit(uint16_t slot);
+
+// writes every pending hit to the table
+extern void save_memory_hits(void);
+
+/* -------------------------------------------------------------------------- */
+
+// true if <slot> holds a memory for either port, from RAM, see the notes on
+// the occupancy map in tuning_memories.c
+extern bool memory_slot_is_used(uint16_t slot);
+
+extern uint16_t count_used_memory_slots(void);
+
+// writes a raw table entry, keeping the occupancy map current
+extern void write_memory_entry(uint16_t slot, table_entry_t entry);
+
+/* -------------------------------------------------------------------------- */
+
+typedef struct {
+    uint16_t attempts; // memory tunes that had a frequency to look up
+    uint16_t hits;     // memory tunes that found a good enough memory
+} memory_hit_stats_t;
+
+// read-only: memory tune hit rate since boot, indexed by antenna port
+extern memory_hit_stats_t memoryHitStats[NUM_OF_ANTENNA_PORTS];
+
+// count a memory tune on the active antenna port, hits are counted by
+// count_memory_hit()
+extern void count_memory_attempt(void);
+
+// moves every memory to its slot under the active plan, <oldPlan> is the plan
+// they were stored under, NULL for the mapping from before the band plan,
+// returns how many were moved
+extern uint16_t migrate_memories(band_plan_t *oldPlan);
+
+/* -------------------------------------------------------------------------- */
+
+typedef struct {
+    uint16_t passes;  // complete scrubs of the table
+    uint16_t repairs; // broken entries the scrub emptied
+} memory_scrub_stats_t;
+
+// read-only: since boot
+extern memory_scrub_stats_t memoryScrubStats;
+
+// checks the next block of the table and empties any broken entries in it
+extern void scrub_memories(void);
+
+// re-reads anything derived from the table, after it was replaced wholesale
+extern void reload_memories(void);
+
+// Stored memories are buffered in RAM, see nvm_table.c
+extern bool memories_need_flushing(void);
+extern void flush_memories(void);
 
-// Store
-extern void store_memory(uint16_t slot, relays_t relays);
+// With MEMORY_LOG_ENABLED, stores go to a log that has to be merged into the
+// table before it fills up, see nvm_table.c
+extern bool memories_need_compacting(void);
+extern void compact_memories(void);
 
 #endif // _TUNING_MEMORIES_H_
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "tuning_utils.h"
 #include "display.h"
+#include "hot_switch.h"
 #include "os/logging.h"
 #include "rf_sensor.h"
 #include "ui/ui_bargraphs.h"
@@ -19,9 +20,15 @@ void tuning_utils_init(void) {
 uint16_t comparisonCount;
 uint16_t prevcomparisonCount;
 
+// set when a comparison's result hasn't been shown on the bargraphs yet
+static bool bargraphsArePending = false;
+
 void reset_solution_count(void) {
     comparisonCount = 0;
     prevcomparisonCount = 0;
+
+    // a new tune, anything left over is from the last one
+    bargraphsArePending = false;
 }
 
 /*  print_comparison_count() shows the number of tested tuning solutions
@@ -108,17 +115,19 @@ match_t new_match(void) {
     match.forward = 0;
     match.reverse = 0;
     match.matchQuality = FLT_MAX;
+    match.quality = 100;
 
     return match;
 }
 
 /*  prints out a match_t object
 
-    output: "(C<A>, L<B>, Z<C>, A<D>) Q: <E>, FWD: <G>, #: <H>"
+    output: "(C<A>, L<B>, Z<C>, A<D>) Q: <E>, SWR: <F>, FWD: <G>, #: <H>, MQ: <I>"
 */
 void print_match(match_t *match) {
     print_relays(match->relays);
     printf(" Q: %f, SWR: %f, FWD: %f, #: %u", match->matchQuality, match->swr, match->forward, match->attemptNumber);
+    printf(", MQ: %u", match->quality);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -135,12 +144,25 @@ void print_match(match_t *match) {
     the same calibration or math limitations that SWR is.
 
     If the matchQualities are too close, raw forward is used as a tiebreaker.
+
+    A noisy or clipped measurement can make a bad match look good by luck. Each
+    matchQuality is made worse in proportion to how untrustworthy its
+    measurement was, up to double for a measurement with a quality of 0. A
+    clean measurement is compared unchanged.
 */
+
+static float weighted_match_quality(match_t *match) {
+    return match->matchQuality * (1.0f + ((100 - match->quality) * 0.01f));
+}
+
 // TODO: iterate on this selection algorithm
 match_t select_best_match(match_t matchA, match_t matchB) {
-    if (matchA.matchQuality < matchB.matchQuality) {
+    float weightedA = weighted_match_quality(&matchA);
+    float weightedB = weighted_match_quality(&matchB);
+
+    if (weightedA < weightedB) {
         return matchA;
-    } else if (matchA.matchQuality == matchB.matchQuality) {
+    } else if (weightedA == weightedB) {
         if (matchA.forward > matchB.forward) {
             return matchA;
         } else {
@@ -163,10 +185,22 @@ match_t create_match_from_current_conditions(relays_t relays) {
     match.matchQuality = currentRF.matchQuality;
     match.swr = currentRF.swr;
     match.frequency = currentRF.frequency;
+    match.quality = currentRF.measurementQuality;
 
     return match;
 }
 
+void flush_pending_bargraphs(void) {
+    if (bargraphsArePending) {
+        bargraphsArePending = false;
+        update_bargraphs(); // ~180uS
+    }
+}
+
+// measurements below this quality are taken again before they're compared
+#define MIN_MEASUREMENT_QUALITY 50
+#define REMEASURE_TIMEOUT 250
+
 /*  compare_matches()
 
     Publishes a a relay object, measures the resulting RF, then compares those
@@ -181,12 +215,22 @@ match_t compare_matches(tuning_errors_t *errors, relays_t relays, match_t bestMa
         return bestMatch;
     }
 
+    // the power went over the limit since the last comparison
+    if (hot_switch_tripped()) {
+        errors->relayError = 1;
+        return bestMatch;
+    }
+
     // publish our relays
-    if (put_relays(relays) == -1) {
+    if (start_put_relays(relays) == -1) {
         errors->relayError = 1;
         return bestMatch;
     }
 
+    // show the last comparison while the new relays are bouncing
+    flush_pending_bargraphs();
+    wait_for_relays_to_settle();
+
     // make sure the RF isn't going crazy
     if (!wait_for_stable_RF(2000)) {
         errors->lostRF = 1;
@@ -194,14 +238,23 @@ match_t compare_matches(tuning_errors_t *errors, relays_t relays, match_t bestMa
     }
 
     measure_RF();
+
+    // one more try if the measurement was noisy, clipped, or mid-transient
+    if (currentRF.measurementQuality < MIN_MEASUREMENT_QUALITY) {
+        LOG_DEBUG({ printf("remeasuring, quality: %u\r\n", currentRF.measurementQuality); });
+        wait_for_stable_RF(REMEASURE_TIMEOUT);
+        measure_RF();
+    }
+
     calculate_watts_and_swr();
-    update_bargraphs();
+    bargraphsArePending = true;
 
     LOG_INFO({
         print_comparison_count();
         printf(" <fwd: %f>", currentRF.forwardVolts);
         printf(" <swr: %f>", currentRF.swr);
         printf(" <q: %f>", currentRF.matchQuality);
+        printf(" <mq: %u>", currentRF.measurementQuality);
         println("");
     });
 
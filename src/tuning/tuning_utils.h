@@ -57,6 +57,7 @@ typedef struct {
     float matchQuality;
     float swr;
     uint16_t frequency;
+    uint8_t quality; // measurementQuality, 0-100
 } match_t;
 
 // returns a correctly initialized match_t object
@@ -71,6 +72,11 @@ extern match_t select_best_match(match_t matchA, match_t matchB);
 //
 extern match_t compare_matches(tuning_errors_t *errors, relays_t relays, match_t bestMatch);
 
+// shows the last comparison's result, if it hasn't been shown yet
+// compare_matches() shows each result during the next comparison, so call
+// this when a tune ends
+extern void flush_pending_bargraphs(void);
+
 /* ************************************************************************** */
 
 //
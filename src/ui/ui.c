@@ -3,6 +3,7 @@
 #include "flags.h"
 #include "os/buttons.h"
 #include "pins.h"
+#include "relay_driver.h"
 #include "rf_sensor.h"
 #include "ui_bargraphs.h"
 #include "ui_idle_block.h"
@@ -17,7 +18,9 @@ extern void tune_hold(void);
 
 void ui_mainloop(void) {
     enable_bargraph_updates();
-    clear_RF_history();
+    reset_RF_presence();
+    set_RF_presence_callback(RF_presence_changed);
+    set_relay_settle_callback(relay_settle_block);
 
     while (1) {
         // Most buttons only work when the system is 'on'
@@ -1,14 +1,19 @@
 #include "ui_idle_block.h"
+#include "calibration_sweep.h"
 #include "display.h"
 #include "events.h"
 #include "flags.h"
+#include "frequency_tracker.h"
+#include "memory_transfer.h"
 #include "os/buttons.h"
 #include "os/serial_port.h"
 #include "os/shell/shell.h"
 #include "os/system_time.h"
 #include "os/usb_port.h"
+#include "relay_wear.h"
 #include "relays.h"
 #include "rf_sensor.h"
+#include "tuning_memories.h"
 #include "ui.h"
 #include "ui_bargraphs.h"
 #include "usb/messages.h"
@@ -17,6 +22,29 @@
 
 /* ************************************************************************** */
 
+static bool justKeyed = false;
+
+void RF_presence_changed(bool isPresent) {
+    if (isPresent) {
+        justKeyed = true;
+    }
+}
+
+// skip the cooldowns, so the bargraphs show a new carrier right away
+static bool attempt_keydown_update(void) {
+    if (!justKeyed) {
+        return false;
+    }
+    justKeyed = false;
+
+    measure_RF();              // ~1700uS
+    calculate_watts_and_swr(); // ~3800uS
+    update_bargraphs();        // ~180uS
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
 #define RF_POLLS_PER_SECOND 200
 #define RF_POLL_COOLDOWN 1000 / RF_POLLS_PER_SECOND
 
@@ -33,17 +61,20 @@ bool attempt_RF_poll(void) {
 
 /* -------------------------------------------------------------------------- */
 
-#define FREQUENCY_UPDATES_PER_SECOND 1
-#define FREQUENCY_UPDATE_PERIOD 1000 / FREQUENCY_UPDATES_PER_SECOND
-
+// the frequency tracker backs off while the frequency is stable
 bool attempt_frequency_measurement(void) {
     static system_time_t lastAttempt = 0;
-    if (time_since(lastAttempt) < FREQUENCY_UPDATE_PERIOD) {
+    if (time_since(lastAttempt) < get_frequency_tracking_period()) {
         return false;
     }
     lastAttempt = get_current_time();
 
-    measure_frequency(); // ~2500uS @ 50MHz, ~60000uS @ 1.8MHz
+    bool isValid = measure_frequency(); // ~2500uS @ 50MHz, ~60000uS @ 1.8MHz
+
+    // a QSY can publish a stored memory before the SWR ever goes bad
+    if (update_frequency_tracker(isValid)) {
+        skip_next_peak_decay();
+    }
     return true;
 }
 
@@ -106,6 +137,32 @@ static bool attempt_RF_message(void) {
 
     return true;
 }
+
+// { "command": "calibration_sweep", ... }, see calibration_sweep.c
+
+static bool attempt_calibration_sweep(void) {
+    switch (calibration_sweep_update()) {
+    case SWEEP_CAPTURED:
+        send_calibration_point();
+        return true;
+    case SWEEP_REJECTED:
+        send_calibration_sweep_update();
+        return true;
+    default:
+        return false;
+    }
+}
+
+// { "command": "memory_export", ... }, see memory_transfer.c
+
+static bool attempt_memory_export(void) {
+    if (!memory_export_update()) { // one chunk, ~1mS of flash reads at most
+        return false;
+    }
+
+    send_memory_chunk();
+    return true;
+}
 #endif
 
 /* -------------------------------------------------------------------------- */
@@ -142,6 +199,85 @@ bool attempt_flag_save(void) {
 
 /* -------------------------------------------------------------------------- */
 
+#define MEMORY_FLUSH_COOLDOWN 1000
+
+bool attempt_memory_flush(void) {
+    static system_time_t lastAttempt = 0;
+    if (time_since(lastAttempt) < MEMORY_FLUSH_COOLDOWN) {
+        return false;
+    }
+    lastAttempt = get_current_time();
+
+    if (!memories_need_flushing()) {
+        return false;
+    }
+
+    flush_memories(); // a few mS per dirty block
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+#define MEMORY_COMPACTION_COOLDOWN 1000
+
+bool attempt_memory_compaction(void) {
+    static system_time_t lastAttempt = 0;
+    if (time_since(lastAttempt) < MEMORY_COMPACTION_COOLDOWN) {
+        return false;
+    }
+    lastAttempt = get_current_time();
+
+    if (!memories_need_compacting()) {
+        return false;
+    }
+
+    compact_memories(); // ~10mS per touched block, up to a few hundred mS
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// a full pass of the table every ~2 minutes
+#define MEMORY_SCRUB_COOLDOWN 500
+
+bool attempt_memory_scrub(void) {
+    static system_time_t lastAttempt = 0;
+    if (time_since(lastAttempt) < MEMORY_SCRUB_COOLDOWN) {
+        return false;
+    }
+    lastAttempt = get_current_time();
+
+    // stay out of the way of tuning and RF measurements
+    if (RF_is_present()) {
+        return false;
+    }
+
+    scrub_memories(); // one flash block, <1mS
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+#define RELAY_WEAR_SAVE_COOLDOWN 100
+
+bool attempt_relay_wear_save(void) {
+    static system_time_t lastAttempt = 0;
+    if (time_since(lastAttempt) < RELAY_WEAR_SAVE_COOLDOWN) {
+        return false;
+    }
+    lastAttempt = get_current_time();
+
+    // EEPROM writes stall the CPU, so stay out of the way while the radio is keyed
+    if (RF_is_present() || !relay_wear_needs_saving()) {
+        return false;
+    }
+
+    continue_relay_wear_save(); // a few bytes, <20mS
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
 bool allowedToAutoTune = true;
 
 void disable_auto_tuning(void) { allowedToAutoTune = false; }
@@ -171,13 +307,46 @@ bool attempt_auto_tune(void) {
 
 /* -------------------------------------------------------------------------- */
 
+// calculate_watts_and_swr() + update_bargraphs(), in mS
+#define BARGRAPH_UPDATE_TIME 4
+
+// registered with the relay driver, runs while the relays are settling
+void relay_settle_block(void) {
+    // don't make the tune wait on the display
+    if (relay_settle_time_remaining() > BARGRAPH_UPDATE_TIME) {
+        if (attempt_bargraph_update()) {
+            return;
+        }
+    }
+
+#if defined DEVELOPMENT && defined USB_ENABLED
+    // shell and JUDI commands can publish relays, so only the output side runs
+    if (attempt_RF_message()) {
+        return;
+    }
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
 void ui_idle_block(void) {
     // TODO: profile me
     if (attempt_RF_poll()) {
         return;
     }
 
-    if (RF_is_present()) {
+#if defined DEVELOPMENT && defined USB_ENABLED
+    // takes over the RF measurement and holds off auto tuning while running
+    if (attempt_calibration_sweep()) {
+        return;
+    }
+#endif
+
+    if (RF_is_present() && !calibration_sweep_is_running()) {
+        // ~5700uS, once per keydown
+        if (attempt_keydown_update()) {
+            return;
+        }
         // ~2500uS @ 50MHz, ~60000uS @ 1.8MHz
         if (attempt_frequency_measurement()) {
             return;
@@ -193,7 +362,8 @@ void ui_idle_block(void) {
     }
 
     if (!RF_is_present()) {
-        enable_auto_tuning(); // reset when radio is unkeyed
+        enable_auto_tuning();      // reset when radio is unkeyed
+        reset_frequency_tracker(); // measure quickly on the next key-up
     }
 
     // ~4000uS
@@ -213,6 +383,11 @@ void ui_idle_block(void) {
     if (attempt_RF_message()) {
         return;
     }
+
+    // ~1 chunk per pass, a sparse table is only a few chunks
+    if (attempt_memory_export()) {
+        return;
+    }
     #endif
 #endif
 
@@ -220,4 +395,24 @@ void ui_idle_block(void) {
     if (attempt_flag_save()) {
         return;
     }
+
+    // ~10mS per stored block, merged over several stores
+    if (attempt_memory_flush()) {
+        return;
+    }
+
+    // up to a few hundred mS, every 66 stores with MEMORY_LOG_ENABLED
+    if (attempt_memory_compaction()) {
+        return;
+    }
+
+    // <20mS per pass, ~2 seconds of passes every 256 relay toggles at most
+    if (attempt_relay_wear_save()) {
+        return;
+    }
+
+    // <1mS, one block of the table every 500mS
+    if (attempt_memory_scrub()) {
+        return;
+    }
 }
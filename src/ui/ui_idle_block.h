@@ -1,6 +1,8 @@
 #ifndef _UI_IDLE_BLOCK_H_
 #define _UI_IDLE_BLOCK_H_
 
+#include <stdbool.h>
+
 /* ************************************************************************** */
 
 extern void disable_auto_tuning(void);
@@ -8,6 +10,12 @@ extern void enable_auto_tuning(void);
 
 /* ************************************************************************** */
 
+// registered with the RF presence detector
+extern void RF_presence_changed(bool isPresent);
+
+// registered with the relay driver, must not publish relays
+extern void relay_settle_block(void);
+
 extern void ui_idle_block(void);
 
 #endif // _UI_IDLE_BLOCK_H_
\ No newline at end of file
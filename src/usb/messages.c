@@ -1,16 +1,22 @@
 #include "messages.h"
+#include "band_plan.h"
+#include "calibration.h"
+#include "calibration_sweep.h"
 #include "display.h"
 #include "events.h"
 #include "flags.h"
 #include "hash.h"
+#include "memory_transfer.h"
 #include "os/json/json_print.h"
 #include "os/judi/hash.h"
 #include "os/judi/message_id.h"
 #include "os/serial_port.h"
+#include "relay_wear.h"
 #include "relays.h"
 #include "rf_sensor.h"
 #include "system.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -34,6 +40,18 @@ const json_node_t rfUpdate[] = {
     {nKey, "swr"},     {nFloat, &currentRF.swr},          //
 
     {nKey, "freq"},    {nU16, &currentRF.frequency},
+    {nKey, "freqConf"}, {nU8, &currentRF.frequencyConfidence},
+    {nKey, "range"},   {nU8, &currentRF.range},
+
+    {nKey, "fwdVar"},  {nFloat, &currentRF.forwardVariance}, //
+    {nKey, "revVar"},  {nFloat, &currentRF.reverseVariance}, //
+    {nKey, "fwdMin"},  {nU16, &currentRF.forwardMin},        //
+    {nKey, "fwdMax"},  {nU16, &currentRF.forwardMax},        //
+    {nKey, "revMin"},  {nU16, &currentRF.reverseMin},        //
+    {nKey, "revMax"},  {nU16, &currentRF.reverseMax},        //
+    {nKey, "sat"},     {nU8, &currentRF.saturatedSamples},   //
+    {nKey, "n"},       {nU8, &currentRF.sampleCount},        //
+    {nKey, "quality"}, {nU8, &currentRF.measurementQuality}, //
 
     {nControl, "\e"},
 };
@@ -56,6 +74,179 @@ void send_relay_update(void) {
     print_message(usb_print);
 }
 
+const json_node_t calibrationUpdate[] = {
+    {nKey, "calibration"},            //
+    {nControl, "{"},                  //
+    {nKey, "serial"},                 //
+    {nU16, &calibrationInfo.serial},  //
+    {nKey, "revision"},               //
+    {nU8, &calibrationInfo.revision}, //
+    {nControl, "\e"},                 //
+};
+
+void send_calibration_update(void) {
+    add_nodes(updatePreamble);
+    add_nodes(calibrationUpdate);
+    print_message(usb_print);
+}
+
+const json_node_t calibrationSweepUpdate[] = {
+    {nKey, "calibration_sweep"},            //
+    {nControl, "{"},                        //
+    {nKey, "freqs"},                        //
+    {nU8, &sweepPlan.numOfFrequencies},     //
+    {nKey, "powers"},                       //
+    {nU8, &sweepPlan.numOfPowers},          //
+    {nKey, "samples"},                      //
+    {nU16, &sweepPlan.samples},             //
+    {nKey, "next"},                         //
+    {nU16, &sweepStatus.next},              //
+    {nKey, "rejected"},                     //
+    {nU16, &sweepStatus.rejected},          //
+    {nKey, "rfreq"},                        //
+    {nU16, &sweepStatus.rejectedFrequency}, //
+    {nControl, "\e"},                       //
+};
+
+void send_calibration_sweep_update(void) {
+    add_nodes(updatePreamble);
+    add_nodes(calibrationSweepUpdate);
+    print_message(usb_print);
+}
+
+const json_node_t calibrationPoint[] = {
+    {nKey, "calibration_point"}, //
+    {nControl, "{"},             //
+
+    {nKey, "index"},   {nU16, &sweepPoint.index},             //
+    {nKey, "freq"},    {nU16, &sweepPoint.frequency},         //
+    {nKey, "power"},   {nU16, &sweepPoint.power},             //
+    {nKey, "mfreq"},   {nU16, &sweepPoint.measuredFrequency}, //
+    {nKey, "samples"}, {nU16, &sweepPoint.samples},           //
+    {nKey, "range"},   {nU8, &sweepPoint.range},              //
+    {nKey, "fwdV"},    {nFloat, &sweepPoint.forwardMean},     //
+    {nKey, "fwdVar"},  {nFloat, &sweepPoint.forwardVariance}, //
+    {nKey, "revV"},    {nFloat, &sweepPoint.reverseMean},     //
+    {nKey, "revVar"},  {nFloat, &sweepPoint.reverseVariance}, //
+
+    {nControl, "\e"},
+};
+
+void send_calibration_point(void) {
+    add_nodes(updatePreamble);
+    add_nodes(calibrationPoint);
+    print_message(usb_print);
+}
+
+const json_node_t relayWearUpdate[] = {
+    {nKey, "relay_wear"}, //
+    {nControl, "{"},      //
+
+    {nKey, "C0"}, {nU32, &relayWear.toggles[0]},  //
+    {nKey, "C1"}, {nU32, &relayWear.toggles[1]},  //
+    {nKey, "C2"}, {nU32, &relayWear.toggles[2]},  //
+    {nKey, "C3"}, {nU32, &relayWear.toggles[3]},  //
+    {nKey, "C4"}, {nU32, &relayWear.toggles[4]},  //
+    {nKey, "C5"}, {nU32, &relayWear.toggles[5]},  //
+    {nKey, "C6"}, {nU32, &relayWear.toggles[6]},  //
+    {nKey, "Z"},  {nU32, &relayWear.toggles[7]},  //
+    {nKey, "L0"}, {nU32, &relayWear.toggles[8]},  //
+    {nKey, "L1"}, {nU32, &relayWear.toggles[9]},  //
+    {nKey, "L2"}, {nU32, &relayWear.toggles[10]}, //
+    {nKey, "L3"}, {nU32, &relayWear.toggles[11]}, //
+    {nKey, "L4"}, {nU32, &relayWear.toggles[12]}, //
+    {nKey, "L5"}, {nU32, &relayWear.toggles[13]}, //
+    {nKey, "L6"}, {nU32, &relayWear.toggles[14]}, //
+    {nKey, "A"},  {nU32, &relayWear.toggles[15]}, //
+
+    {nKey, "blocked"}, {nU32, &relayWear.blockedHotSwitches}, //
+
+    {nControl, "\e"},
+};
+
+void send_relay_wear_update(void) {
+    add_nodes(updatePreamble);
+    add_nodes(relayWearUpdate);
+    print_message(usb_print);
+}
+
+const json_node_t bandPlanUpdate[] = {
+    {nKey, "band_plan"},              //
+    {nControl, "{"},                  //
+    {nKey, "groups"},                 //
+    {nU8, &bandPlanInfo.numOfGroups}, //
+    {nKey, "custom"},                 //
+    {nU8, &bandPlanInfo.isCustom},    //
+    {nKey, "crc"},                    //
+    {nU16, &bandPlanInfo.crc},        //
+    {nKey, "migrated"},               //
+    {nU16, &bandPlanInfo.migrated},   //
+    {nControl, "\e"},                 //
+};
+
+void send_band_plan_update(void) {
+    add_nodes(updatePreamble);
+    add_nodes(bandPlanUpdate);
+    print_message(usb_print);
+}
+
+const json_node_t memoryImportUpdate[] = {
+    {nKey, "memory_import"},          //
+    {nControl, "{"},                  //
+    {nKey, "next"},                   //
+    {nU16, &memoryImportStatus.next}, //
+    {nKey, "error"},                  //
+    {nU8, &memoryImportStatus.error}, //
+    {nControl, "\e"},                 //
+};
+
+void send_memory_import_update(void) {
+    add_nodes(updatePreamble);
+    add_nodes(memoryImportUpdate);
+    print_message(usb_print);
+}
+
+// there's no node for a string value, so the chunk is printed by hand
+// {"update":{"memory_chunk":{"start":<slot>,"next":<slot>,"plan":<crc>,"crc":<crc>,
+//                              "data":"<base64>"}}}
+void send_memory_chunk(void) {
+    char text[24];
+
+    sprintf(text, "%u,\"next\":%u,", memoryChunk.start, memoryChunk.next);
+    usb_print("{\"update\":{\"memory_chunk\":{\"start\":");
+    usb_print(text);
+    sprintf(text, "\"plan\":%u,", memoryChunk.plan);
+    usb_print(text);
+    sprintf(text, "\"crc\":%u,\"data\":\"", memoryChunk.crc);
+    usb_print(text);
+
+    for (uint8_t i = 0; i < memoryChunk.length; i += 3) {
+        encode_base64_group(text, &memoryChunk.data[i], memoryChunk.length - i);
+        usb_print(text);
+    }
+    usb_print("\"}}}");
+}
+
+const json_node_t memoryTableUpdate[] = {
+    {nKey, "memory_table"},           //
+    {nControl, "{"},                  //
+    {nKey, "used"},                   //
+    {nU16, &memoryTableSummary.used}, //
+    {nKey, "crc"},                    //
+    {nU16, &memoryTableSummary.crc},  //
+    {nKey, "plan"},                   //
+    {nU16, &memoryTableSummary.plan}, //
+    {nControl, "\e"},                 //
+};
+
+void send_memory_table_update(void) {
+    summarize_memory_table();
+
+    add_nodes(updatePreamble);
+    add_nodes(memoryTableUpdate);
+    print_message(usb_print);
+}
+
 /* ************************************************************************** */
 
 #define HASH(number) buf->tokens[number].hash
@@ -94,6 +285,65 @@ void print_message_structure(json_buffer_t *buf) {
     usb_print("\"}");
 }
 
+// reads the flat array of numbers after <key> into <array>
+// returns the length of the array, or maxLength + 1 if it doesn't fit or isn't
+// a flat array of numbers
+static uint8_t read_u16_array(json_buffer_t *buf, uint8_t key, uint16_t *array,
+                              uint8_t maxLength) {
+    uint8_t arrayToken = key + 1;
+    if (arrayToken >= buf->tokensParsed || buf->tokens[arrayToken].type != jsmn_array) {
+        return maxLength + 1;
+    }
+
+    uint16_t size = buf->tokens[arrayToken].size;
+    if (size > maxLength || arrayToken + size >= buf->tokensParsed) {
+        return maxLength + 1;
+    }
+
+    for (uint8_t i = 0; i < size; i++) {
+        uint8_t element = arrayToken + 1 + i;
+        if (buf->tokens[element].type != jsmn_primitive) {
+            return maxLength + 1;
+        }
+        array[i] = strtoul(TOKEN(element), NULL, 10);
+    }
+    return size;
+}
+
+// { "command": "set_band_plan", "ends": [<KHz>, ...], "slots": [<slots>, ...] }
+static void receive_band_plan(json_buffer_t *buf) {
+    uint16_t ends[MAX_BAND_PLAN_GROUPS];
+    uint16_t slots[MAX_BAND_PLAN_GROUPS];
+    uint8_t numOfEnds = 0;
+    uint8_t numOfSlots = 0;
+
+    uint8_t key = find_key(buf, ROOT_OBJECT, hash_ends);
+    if (key) {
+        numOfEnds = read_u16_array(buf, key, ends, MAX_BAND_PLAN_GROUPS);
+    }
+    key = find_key(buf, ROOT_OBJECT, hash_slots);
+    if (key) {
+        numOfSlots = read_u16_array(buf, key, slots, MAX_BAND_PLAN_GROUPS);
+    }
+
+    // a rejected plan leaves the old one in place, so the reply's crc won't match
+    if (numOfEnds != numOfSlots || numOfEnds > MAX_BAND_PLAN_GROUPS) {
+        return;
+    }
+
+    band_plan_t plan;
+    plan.numOfGroups = numOfEnds;
+    for (uint8_t i = 0; i < numOfEnds; i++) {
+        if (slots[i] > UINT8_MAX) {
+            return;
+        }
+        plan.groups[i].end = ends[i];
+        plan.groups[i].slots = slots[i];
+    }
+
+    install_band_plan(&plan);
+}
+
 void respond(json_buffer_t *buf) {
     // print_message_structure(buf);
 
@@ -121,12 +371,24 @@ void respond(json_buffer_t *buf) {
         case hash_relays:
             send_relay_update();
             break;
+        case hash_calibration:
+            send_calibration_update();
+            break;
+        case hash_relay_wear:
+            send_relay_wear_update();
+            break;
+        case hash_band_plan:
+            send_band_plan_update();
+            break;
+        case hash_memory_table:
+            send_memory_table_update();
+            break;
         }
     }
 
     // handle commands
     relays_t relays = read_current_relays();
-    uint8_t caps, inds, z, relays_object;
+    uint8_t caps, inds, z, relays_object, serial, freqs, powers, samples, start, crc, data, plan;
     uint8_t command = find_key(buf, ROOT_OBJECT, hash_command);
     if (command) {
         switch (HASH(command + 1)) {
@@ -134,6 +396,85 @@ void respond(json_buffer_t *buf) {
             // locate_device();
             json_print(usb_print, responseOk);
             break;
+        case hash_save_calibration:
+            // { "command": "save_calibration", "serial": <serial> }
+            serial = find_key(buf, ROOT_OBJECT, hash_serial);
+            if (serial) {
+                save_calibration(atoi(TOKEN(serial + 1)));
+            } else {
+                save_calibration(calibrationInfo.serial);
+            }
+            send_calibration_update();
+            break;
+        case hash_calibration_sweep:
+            // { "command": "calibration_sweep", "freqs": [<KHz>, ...],
+            //   "powers": [<watts>, ...], "samples": <samples per point> }
+            sweepPlan.numOfFrequencies = 0;
+            freqs = find_key(buf, ROOT_OBJECT, hash_freqs);
+            if (freqs) {
+                sweepPlan.numOfFrequencies = read_u16_array(
+                    buf, freqs, sweepPlan.frequencies, MAX_SWEEP_FREQUENCIES);
+            }
+            sweepPlan.numOfPowers = 0;
+            powers = find_key(buf, ROOT_OBJECT, hash_powers);
+            if (powers) {
+                sweepPlan.numOfPowers = read_u16_array(
+                    buf, powers, sweepPlan.powers, MAX_SWEEP_POWERS);
+            }
+            sweepPlan.samples = DEFAULT_SWEEP_SAMPLES;
+            samples = find_key(buf, ROOT_OBJECT, hash_samples);
+            if (samples) {
+                sweepPlan.samples = atoi(TOKEN(samples + 1));
+            }
+            start_calibration_sweep(); // an empty plan in the reply means it was rejected
+            send_calibration_sweep_update();
+            break;
+        case hash_abort_calibration_sweep:
+            abort_calibration_sweep();
+            json_print(usb_print, responseOk);
+            break;
+        case hash_memory_export:
+            // { "command": "memory_export", "start": <slot> }
+            // streams memory_chunk updates from the idle loop, resume with a later start
+            start = find_key(buf, ROOT_OBJECT, hash_start);
+            start_memory_export(start ? atoi(TOKEN(start + 1)) : 0);
+            json_print(usb_print, responseOk);
+            break;
+        case hash_abort_memory_export:
+            abort_memory_export();
+            json_print(usb_print, responseOk);
+            break;
+        case hash_memory_import:
+            // { "command": "memory_import", "start": <slot>, "plan": <crc>, "crc": <crc>,
+            //   "data": "<base64>" }
+            // replies with the slot to send next, and why the chunk was rejected, if it was
+            start = find_key(buf, ROOT_OBJECT, hash_start);
+            plan = find_key(buf, ROOT_OBJECT, hash_plan);
+            crc = find_key(buf, ROOT_OBJECT, hash_crc);
+            data = find_key(buf, ROOT_OBJECT, hash_data);
+            if (start && plan && crc && data) {
+                import_memory_chunk(atoi(TOKEN(start + 1)), TOKEN(data + 1),
+                                    strtoul(TOKEN(crc + 1), NULL, 10),
+                                    strtoul(TOKEN(plan + 1), NULL, 10));
+            } else {
+                reject_memory_import(start ? atoi(TOKEN(start + 1)) : 0);
+            }
+            send_memory_import_update();
+            break;
+        case hash_set_band_plan:
+            // takes a few seconds, the stored memories get moved to match
+            receive_band_plan(buf);
+            send_band_plan_update();
+            break;
+        case hash_reset_band_plan:
+            reset_band_plan();
+            send_band_plan_update();
+            break;
+        case hash_reset_relay_wear:
+            // only after the relay board has been replaced
+            reset_relay_wear();
+            send_relay_wear_update();
+            break;
         case hash_set_relays:
             relays_object = find_key(buf, ROOT_OBJECT, hash_relays);
             caps = find_key(buf, relays_object + 1, hash_caps);
@@ -21,6 +21,16 @@ extern const json_node_t rfUpdate[];
 
 /* ************************************************************************** */
 
+extern void send_calibration_point(void);
+
+// prints sweepPlan and sweepStatus, see calibration_sweep.c
+extern void send_calibration_sweep_update(void);
+
+// prints memoryChunk, see memory_transfer.c
+extern void send_memory_chunk(void);
+
+/* ************************************************************************** */
+
 extern void respond(json_buffer_t *buf);
 
 #endif // _MESSAGES_H_
\ No newline at end of file